@@ -28,13 +28,28 @@ host_comm_header = Header(HOST_COMM_HEADER,
         'INTERRUPT_SOURCE',
         'ADC_CHAN_INDEX',
         'ENERGY_BREAKPOINT_IMPL',
+        'ENERGY_ACCOUNTING_OP',
         'CMP_REF',
         'STREAM',
+        'ADC_STREAM_FLAG',
+        'ADC_STATS',
+        'CAPTURE_TRIGGER',
         'RF_EVENT',
+        'TX_SOURCE',
         'PARAM'
     ],
     numeric_macros=[
-        'UART_IDENTIFIER_USB'
+        'UART_IDENTIFIER_USB',
+        'UART_IDENTIFIER_USB_EXT',
+        'UART_IDENTIFIER_USB_TAGGED',
+        'UART_SLIP_END',
+        'UART_SLIP_ESC',
+        'UART_SLIP_ESC_END',
+        'UART_SLIP_ESC_ESC',
+        'UART_FRAME_CRC_LEN',
+        'USB_BATCH_CMD_HEADER_LEN',
+        'USB_BATCH_RSP_HEADER_LEN',
+        'TX_STATS_RECORD_LEN'
     ])
 
 target_comm_header = Header(TARGET_COMM_HEADER,
@@ -50,6 +65,8 @@ config_header = Header(CONFIG_HEADER,
     numeric_macros=[
         'CONFIG_USB_UART_BAUDRATE',
         'CONFIG_ADC_TIMER_DIV',
+        'CONFIG_STREAM_FLUSH_INTERVAL',
+        'CONFIG_HOST_BAUD_CONFIRM_TIMEOUT_MS',
         'CONFIG_TIMELOG_TIMER_DIV',
         'CONFIG_TIMELOG_TIMER_DIV_EX'
     ])
@@ -0,0 +1,99 @@
+#!/usr/bin/python
+
+"""Generate the host UART divider table (src/uart_baud.h)
+
+For each supported UART clock (SMCLK) frequency, computes the USCI_A divider
+and modulation settings of each baud rate that the FTDI chip supports, and
+keeps the ones within the error bound. The table is what USB_CMD_SET_BAUD
+can switch to at runtime.
+
+Settings, with N = clock / baud:
+    N >= 16 (oversampling): BR = floor(N/16), BRF = round(frac(N/16) * 16), UCOS16
+    otherwise (low-frequency): BR = floor(N), BRS = round(frac(N) * 8)
+"""
+
+import argparse
+
+# Must match the clocks for which src/uart.h has a boot configuration
+CLOCKS = [
+    24576000,
+    24000000,
+    21921792,
+    12500000,
+    12000000,
+    8192000,
+    6250000,
+]
+
+# Rates supported by the FT232R
+BAUDS = [
+    9600, 19200, 38400, 57600, 115200, 171264, 230400, 460800, 500000,
+    576000, 921600, 1000000, 1500000, 2000000, 3000000,
+]
+
+MIN_DIVIDER = 4 # too few clocks per bit to sample reliably below this
+MAX_ERROR = 0.02 # relative difference between the actual and requested rate
+
+def divider(clock, baud):
+    """Return (br, os16, brs, brf, error)"""
+    n = float(clock) / baud
+    if n >= 16:
+        br = int(n / 16)
+        brf = int(round((n / 16 - br) * 16))
+        if brf == 16:
+            br, brf = br + 1, 0
+        actual = 16 * (br + brf / 16.0)
+        return br, True, 0, brf, abs(actual - n) / n
+    else:
+        br = int(n)
+        brs = int(round((n - br) * 8))
+        if brs == 8:
+            br, brs = br + 1, 0
+        actual = br + brs / 8.0
+        return br, False, brs, 0, abs(actual - n) / n
+
+def entry(clock, baud):
+    br, os16, brs, brf, err = divider(clock, baud)
+    if float(clock) / baud < MIN_DIVIDER or err > MAX_ERROR:
+        return None
+    if os16:
+        mctl = "UCOS16 | BRF_BITS(%u)" % brf
+    else:
+        mctl = "BRS_BITS(%u)" % brs
+    return "    { %7u, %4u, %-22s }, /* N = %.4f, error %.2f%% */" % \
+        (baud, br, mctl, float(clock) / baud, err * 100)
+
+def generate():
+    lines = [
+        "// Generated by scripts/gen-uart-baud.py: do not edit",
+        "",
+        "#ifndef UART_BAUD_H",
+        "#define UART_BAUD_H",
+        "",
+        "/**",
+        " * @brief  Host UART rates for the UART clock: { baud, BR, MCTL }",
+        " * @details Within %.0f%% of the requested rate, with at least %u clocks per bit." %
+            (MAX_ERROR * 100, MIN_DIVIDER),
+        " */",
+    ]
+    for i, clock in enumerate(CLOCKS):
+        lines.append("%s CONFIG_UART_CLOCK_FREQ == %u" % ("#if" if i == 0 else "#elif", clock))
+        lines.append("#define UART_BAUD_TABLE \\")
+        entries = [e for e in (entry(clock, baud) for baud in BAUDS) if e is not None]
+        lines += [e + " \\" for e in entries[:-1]]
+        lines.append(entries[-1])
+    lines += [
+        "#endif // CONFIG_UART_CLOCK_FREQ",
+        "",
+        "#endif // UART_BAUD_H",
+    ]
+    return "\n".join(lines) + "\n"
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description=__doc__,
+                formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('out', help="Output header (src/uart_baud.h)")
+    args = parser.parse_args()
+
+    with open(args.out, 'w') as f:
+        f.write(generate())
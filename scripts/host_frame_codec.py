@@ -0,0 +1,142 @@
+#!/usr/bin/python
+
+"""Reference codec for the framed host link (CONFIG_HOST_UART_FRAMING)
+
+Each message, UART header included, is followed by its CRC-16/CCITT-FALSE
+(most significant byte first), escaped as in SLIP and delimited by END bytes
+(see UART_FRAMING in src/host_comm.h). A bad frame is dropped and counted, and
+decoding picks up again at the next END.
+
+Run as a script to decode a raw capture of the link from the debugger and
+report the messages and errors in it.
+"""
+
+import sys
+import argparse
+
+# Must match UART_FRAMING in src/host_comm.h
+SLIP_END = 0xC0
+SLIP_ESC = 0xDB
+SLIP_ESC_END = 0xDC
+SLIP_ESC_ESC = 0xDD
+CRC_LEN = 2
+
+# Must match src/host_comm.h
+UART_IDENTIFIER_USB = 0xF0
+UART_IDENTIFIER_USB_EXT = 0xF2
+UART_IDENTIFIER_USB_TAGGED = 0xF3
+UART_MSG_HEADER_SIZE = 4
+
+def crc16(data, crc=0xFFFF):
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+def encode_msg(descriptor, payload, tag=None):
+    """Build a framed message to the debugger (a tagged request, if tag is given)"""
+    if len(payload) > 0xFF:
+        header = [UART_IDENTIFIER_USB_EXT, descriptor, len(payload) & 0xFF, len(payload) >> 8]
+    elif tag is not None:
+        header = [UART_IDENTIFIER_USB_TAGGED, descriptor, len(payload), tag]
+    else:
+        header = [UART_IDENTIFIER_USB, descriptor, len(payload), 0]
+    msg = bytearray(header) + bytearray(payload)
+    crc = crc16(msg)
+    msg += bytearray([crc >> 8, crc & 0xFF])
+
+    frame = bytearray([SLIP_END])
+    for byte in msg:
+        if byte == SLIP_END:
+            frame += bytearray([SLIP_ESC, SLIP_ESC_END])
+        elif byte == SLIP_ESC:
+            frame += bytearray([SLIP_ESC, SLIP_ESC_ESC])
+        else:
+            frame.append(byte)
+    frame.append(SLIP_END)
+    return frame
+
+class Decoder:
+    """Splits the byte stream from the debugger into (descriptor, payload, tag)
+
+    The tag is None for a message that is not a reply to a tagged request.
+    """
+
+    def __init__(self):
+        self.frame = bytearray()
+        self.crc_errors = 0
+        self.frame_errors = 0
+
+    def feed(self, data):
+        msgs = []
+        for byte in bytearray(data):
+            if byte != SLIP_END:
+                self.frame.append(byte)
+                continue
+            if self.frame:
+                msg = self._decode(self.frame)
+                if msg is not None:
+                    msgs.append(msg)
+            self.frame = bytearray()
+        return msgs
+
+    def _decode(self, frame):
+        msg = bytearray()
+        escaped = False
+        for byte in frame:
+            if escaped:
+                if byte == SLIP_ESC_END:
+                    msg.append(SLIP_END)
+                elif byte == SLIP_ESC_ESC:
+                    msg.append(SLIP_ESC)
+                else:
+                    self.frame_errors += 1
+                    return None
+                escaped = False
+            elif byte == SLIP_ESC:
+                escaped = True
+            else:
+                msg.append(byte)
+
+        if escaped or len(msg) < UART_MSG_HEADER_SIZE + CRC_LEN:
+            self.frame_errors += 1
+            return None
+        if crc16(msg) != 0:
+            self.crc_errors += 1
+            return None
+
+        length = msg[2]
+        tag = None
+        if msg[0] == UART_IDENTIFIER_USB_EXT:
+            length |= msg[3] << 8
+        elif msg[0] == UART_IDENTIFIER_USB_TAGGED:
+            tag = msg[3]
+        elif msg[0] != UART_IDENTIFIER_USB:
+            self.frame_errors += 1
+            return None
+        if UART_MSG_HEADER_SIZE + length + CRC_LEN != len(msg):
+            self.frame_errors += 1
+            return None
+
+        return (msg[1], bytes(msg[UART_MSG_HEADER_SIZE:UART_MSG_HEADER_SIZE + length]), tag)
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description=__doc__,
+                formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('capture', help="Raw bytes received from the debugger")
+    args = parser.parse_args()
+
+    decoder = Decoder()
+    with open(args.capture, 'rb') as f:
+        msgs = decoder.feed(f.read())
+
+    for descriptor, payload, tag in msgs:
+        if tag is None:
+            print("0x%02x: %u bytes" % (descriptor, len(payload)))
+        else:
+            print("0x%02x: %u bytes, tag %u" % (descriptor, len(payload), tag))
+    print("messages: %u, CRC errors: %u, framing errors: %u" %
+          (len(msgs), decoder.crc_errors, decoder.frame_errors))
+    sys.exit(0 if not (decoder.crc_errors or decoder.frame_errors) else 1)
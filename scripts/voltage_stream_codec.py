@@ -0,0 +1,260 @@
+#!/usr/bin/python
+
+"""Reference codec for the voltage sections of USB_RSP_STREAM_VOLTAGES(_COMPACT)
+
+Decodes the voltage section of a frame according to the stream options in the
+frame header (see adc_stream_flag_t in src/host_comm.h): raw 16-bit samples,
+packed 12-bit samples, or the compressed bitstream (see src/compress.h).
+
+With rate divisors, each sample in a frame is one ADC sequence, which covers
+several sampling periods: sequence_schedule() gives the channel and period of
+each value in the sequence. In deadband mode, decode_points() gives the
+points reported for the values in the sequence.
+
+Run as a script to encode a recorded trace with the same algorithm as the
+firmware and report the compression ratio per frame. The trace is a text file
+with one sample per line, with one column per channel (whitespace or comma
+separated, raw ADC values).
+"""
+
+import sys
+import argparse
+
+# Must match adc_stream_flag_t in src/host_comm.h
+ADC_STREAM_FLAG_PACKED_SAMPLES = 0x02
+ADC_STREAM_FLAG_COMPRESSED = 0x04
+
+# Must match STREAM_VOLTAGE_POINT_* in src/host_comm.h
+POINT_LEN = 6
+POINT_INDEX_SHIFT = 12
+
+# Must match src/compress.h
+SAMPLE_BITS = 12
+ZIGZAG_BITS = 13
+RICE_PARAM_BITS = 4
+RICE_ESCAPE = 16
+
+# Default of CONFIG_VOLTAGE_STREAM_BUF_SAMPLES in src/config.h
+SAMPLES_PER_FRAME = 32
+
+# Must match src/adc.c
+ADC_MAX_SEQ_LEN = 16
+ADC_MAX_RATE_DIVISOR = 16
+
+def zigzag(delta):
+    return ((delta << 1) ^ (delta >> 15)) & 0xFFFF
+
+def unzigzag(value):
+    return (value >> 1) ^ -(value & 1)
+
+class BitReader:
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0 # in bits
+
+    def bit(self):
+        byte = self.data[self.pos >> 3]
+        bit = (byte >> (7 - (self.pos & 7))) & 1
+        self.pos += 1
+        return bit
+
+    def bits(self, n):
+        value = 0
+        for i in range(n):
+            value = (value << 1) | self.bit()
+        return value
+
+class BitWriter:
+    def __init__(self):
+        self.bits = []
+
+    def put(self, value, n):
+        for i in reversed(range(n)):
+            self.bits.append((value >> i) & 1)
+
+    def data(self):
+        bits = self.bits + [0] * (-len(self.bits) % 8)
+        return bytearray(int(''.join(str(b) for b in bits[i:i + 8]), 2)
+                         for i in range(0, len(bits), 8))
+
+def interleave(channels):
+    return [chan[i] for i in range(len(channels[0])) for chan in channels]
+
+def deinterleave(samples, num_channels):
+    return [samples[c::num_channels] for c in range(num_channels)]
+
+def decode_raw(data, count, num_channels):
+    n = count * num_channels
+    return [data[2 * i] | (data[2 * i + 1] << 8) for i in range(n)]
+
+def decode_packed(data, count, num_channels):
+    n = count * num_channels
+    samples = []
+    for i in range(0, n - 1, 2):
+        b0, b1, b2 = data[3 * i // 2: 3 * i // 2 + 3]
+        samples.append(b0 | ((b1 & 0x0F) << 8))
+        samples.append((b1 >> 4) | (b2 << 4))
+    if n % 2:
+        off = 3 * (n - 1) // 2
+        samples.append(data[off] | (data[off + 1] << 8))
+    return samples
+
+def decode_compressed(data, count, num_channels):
+    reader = BitReader(data)
+    channels = []
+    for chan in range(num_channels):
+        k = reader.bits(RICE_PARAM_BITS)
+        samples = [reader.bits(SAMPLE_BITS)]
+        for i in range(1, count):
+            q = 0
+            while q < RICE_ESCAPE and reader.bit():
+                q += 1
+            if q == RICE_ESCAPE:
+                value = reader.bits(ZIGZAG_BITS)
+            else:
+                value = (q << k) | reader.bits(k)
+            samples.append((samples[-1] + unzigzag(value)) & 0xFFFF)
+        channels.append(samples)
+    return interleave(channels)
+
+def decode_voltages(flags, data, count, num_channels):
+    """Decode the voltage section of a frame into interleaved samples"""
+    if flags & ADC_STREAM_FLAG_COMPRESSED:
+        return decode_compressed(data, count, num_channels)
+    if flags & ADC_STREAM_FLAG_PACKED_SAMPLES:
+        return decode_packed(data, count, num_channels)
+    return decode_raw(data, count, num_channels)
+
+def decode_points(data, count):
+    """Decode the points of a USB_RSP_STREAM_VOLTAGE_POINTS frame (after its
+    header) into a list of (timestamp, index in sequence, sample)"""
+    points = []
+    for i in range(count):
+        p = data[i * POINT_LEN:(i + 1) * POINT_LEN]
+        timestamp = p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24)
+        value = p[4] | (p[5] << 8)
+        points.append((timestamp, value >> POINT_INDEX_SHIFT,
+                       value & ((1 << POINT_INDEX_SHIFT) - 1)))
+    return points
+
+def sequence_schedule(divisors):
+    """Order of the conversions in an ADC sequence, same as program_sequence()
+    in firmware.
+
+    divisors: rate divisor of each streamed channel, in stream order
+    Returns (slots, num_periods, period_multiplier), where slots is a list of
+    (channel, period) for each value in the sequence: channel is an index into
+    divisors and period is the sampling period within the sequence (in units
+    of period_multiplier sampling periods). Every period has the same number
+    of values, and the conversions are evenly spaced: value i of a period is
+    converted i / len(slots) * num_periods of a period into it. Periods with
+    fewer channels due are padded with values whose channel is None.
+    """
+    divs = []
+    for d in divisors:
+        d = max(1, min(d, ADC_MAX_RATE_DIVISOR))
+        while d & (d - 1):
+            d &= d - 1
+        divs.append(d)
+    multiplier = min(divs)
+    divs = [d // multiplier for d in divs]
+    num_periods = max(divs)
+
+    while True:
+        phases = []
+        num_slow = 0
+        for d in divs:
+            if d > 1:
+                phases.append(num_slow & (d - 1))
+                num_slow += 1
+            else:
+                phases.append(0)
+
+        due = [[chan for chan, d in enumerate(divs)
+                     if (period & (d - 1)) == phases[chan]]
+               for period in range(num_periods)]
+        period_len = max(len(chans) for chans in due)
+        if period_len * num_periods <= ADC_MAX_SEQ_LEN:
+            break
+        divs = [d >> 1 if d == num_periods else d for d in divs]
+        num_periods >>= 1
+
+    slots = [(chan, period) for period, chans in enumerate(due)
+                            for chan in chans + [None] * (period_len - len(chans))]
+    return slots, num_periods, multiplier
+
+def rice_param(samples):
+    n = len(samples) - 1
+    if n == 0:
+        return 0
+    total = sum(zigzag(b - a) for a, b in zip(samples, samples[1:]))
+    k = 0
+    while k < SAMPLE_BITS and (n << (k + 1)) <= total:
+        k += 1
+    return k
+
+def compress(samples, num_channels):
+    """Reference encoder, same output as compress_samples() in firmware"""
+    writer = BitWriter()
+    for chan_samples in deinterleave(samples, num_channels):
+        k = rice_param(chan_samples)
+        writer.put(k, RICE_PARAM_BITS)
+        writer.put(chan_samples[0], SAMPLE_BITS)
+        for a, b in zip(chan_samples, chan_samples[1:]):
+            value = zigzag(b - a)
+            q = value >> k
+            if q >= RICE_ESCAPE:
+                writer.put((1 << RICE_ESCAPE) - 1, RICE_ESCAPE)
+                writer.put(value, ZIGZAG_BITS)
+            else:
+                writer.put(((1 << q) - 1) << 1, q + 1)
+                writer.put(value & ((1 << k) - 1), k)
+    return writer.data()
+
+def read_trace(path):
+    rows = []
+    for line in open(path):
+        line = line.strip()
+        if not line or line.startswith('#'):
+            continue
+        rows.append([int(v) for v in line.replace(',', ' ').split()])
+    return rows
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(
+            description="Report compression ratio of a recorded voltage trace")
+    parser.add_argument('trace',
+            help="Text file with one sample per line, one column per channel")
+    parser.add_argument('--frame-samples', type=int, default=SAMPLES_PER_FRAME,
+            help="Samples per channel in each frame")
+    parser.add_argument('--verbose', action='store_true',
+            help="Report every frame")
+    args = parser.parse_args()
+
+    rows = read_trace(args.trace)
+    num_channels = len(rows[0])
+
+    raw_total = 0
+    coded_total = 0
+    fallbacks = 0
+    for start in range(0, len(rows), args.frame_samples):
+        frame = rows[start:start + args.frame_samples]
+        samples = [v for row in frame for v in row]
+        raw_len = len(samples) * 2
+        coded = compress(samples, num_channels)
+        assert decode_compressed(coded, len(frame), num_channels) == samples
+
+        coded_len = len(coded)
+        if coded_len >= raw_len: # the firmware sends a raw frame instead
+            coded_len = raw_len
+            fallbacks += 1
+
+        raw_total += raw_len
+        coded_total += coded_len
+        if args.verbose:
+            print("frame %u: %u -> %u bytes" % (start // args.frame_samples, raw_len, coded_len))
+
+    print("channels: %u, samples: %u, frames: %u (raw fallback: %u)" %
+          (num_channels, len(rows), -(-len(rows) // args.frame_samples), fallbacks))
+    print("bytes: %u -> %u, ratio: %.2f" %
+          (raw_total, coded_total, float(raw_total) / coded_total))
@@ -1,5 +1,6 @@
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include <msp430.h>
 
 #include <libmsp/periph.h>
@@ -12,6 +13,10 @@
 #include "uart.h"
 #include "config.h"
 #include "error.h"
+#include "dma.h"
+#include "compress.h"
+#include "stats.h"
+#include "params.h"
 
 #ifdef CONFIG_SYSTICK
 #include "systick.h"
@@ -42,260 +47,1664 @@ static adc_stream_t stream_info[] = {
 #endif
 };
 
-#ifdef CONFIG_ENABLE_VOLTAGE_STREAM
-
 #define TIMER_ADC_TRIGGER CONCAT(TMRMOD_ADC_TRIGGER, TMRIDX_ADC_TRIGGER)
 
 #define ADC_MAX_CHANNELS  5
+#define ADC_MAX_OVERSAMPLING 4 // 4^4 samples per value, 16-bit values
+
+static void resume_background();
+
+#ifdef CONFIG_ENABLE_VOLTAGE_STREAM
+
+#define ADC_MAX_SEQ_LEN  16 // ADC12MCTL0..15
+#define ADC_MAX_RATE_DIVISOR 16
+
+#define NUM_BUFFERS    CONFIG_VOLTAGE_STREAM_BUFFERS // ring of buffers
+#define NUM_BUFFERED_SAMPLES    CONFIG_VOLTAGE_STREAM_BUF_SAMPLES
+
+#if NUM_BUFFERS < 2
+#error Voltage stream needs at least two buffers: see CONFIG_VOLTAGE_STREAM_BUFFERS
+#endif
 
-#define NUM_BUFFERS                                  2 // double-buffer pair
-#define NUM_BUFFERED_SAMPLES                        32
+// the stream message header counts the sequences in one byte
+#if NUM_BUFFERED_SAMPLES > 255
+#error Too many sequences per voltage stream buffer: see CONFIG_VOLTAGE_STREAM_BUF_SAMPLES
+#endif
 
 #define SAMPLE_TIMESTAMPS_SIZE (NUM_BUFFERED_SAMPLES * sizeof(uint32_t))
 #define SAMPLE_VOLTAGES_SIZE   (NUM_BUFFERED_SAMPLES * ADC_MAX_CHANNELS * sizeof(uint16_t))
 
 // Buffer layout:
 //
-//    [ uart msg header | stream msg header |
+//    [ uart msg header | voltage stream msg header |
 //      timestamp 0 | .. | timestamp N |
 //      voltage 0 chan 0 | .. | voltage 0 chan K
 //        ...
 //      voltage N chan 0 | .. | voltage N chan K
 //    ]
 //
-// NOTE: The buffer layout with timestamps grouped together and voltage samples
-// groupped together was chosen in preparation for DMA, which would have one
-// channel stream timestamps from the timer and another one stream ADC values,
-// both triggered on exact same timer event.
+// The timestamps and the voltage samples are grouped together so that two DMA
+// channels can fill the buffer: one streams the results of each ADC sequence,
+// the other streams the systick counter, both triggered by the end of the same
+// sequence. The timestamp DMA can only move 16-bit words, so it fills the
+// first half of the timestamps section and the timestamps are widened in place
+// just before the buffer is sent to the host.
+//
+// With compact timestamps, the message is sent from further into the buffer:
+// the headers and the compact timestamp section are written over the tail of
+// the timestamps section, right before the voltages.
 #define SAMPLES_MSG_BUF_SIZE \
-    (UART_MSG_HEADER_SIZE + STREAM_DATA_MSG_HEADER_LEN + \
+    (UART_MSG_HEADER_SIZE + STREAM_VOLTAGES_MSG_HEADER_LEN + \
      SAMPLE_TIMESTAMPS_SIZE + SAMPLE_VOLTAGES_SIZE)
 
-#define SAMPLE_TIMESTAMPS_OFFSET  (UART_MSG_HEADER_SIZE + STREAM_DATA_MSG_HEADER_LEN)
+#define SAMPLE_HEADER_OFFSET      UART_MSG_HEADER_SIZE
+#define SAMPLE_HEADER_FLAGS_OFFSET \
+    (STREAM_DATA_MSG_HEADER_LEN + STREAM_VOLTAGES_OVERFLOW_COUNT_LEN) // within the header
+#define SAMPLE_TIMESTAMPS_OFFSET  (UART_MSG_HEADER_SIZE + STREAM_VOLTAGES_MSG_HEADER_LEN)
 #define SAMPLE_VOLTAGES_OFFSET  (SAMPLE_TIMESTAMPS_OFFSET + SAMPLE_TIMESTAMPS_SIZE)
 
-static unsigned num_channels;
+// Can't have a struct type because the number of channels per 'sample' (sequence) varies.
+// A sequence is the whole ADC sequence (see program_sequence): with rate
+// divisors it covers several trigger periods, so fewer sequences fit in a buffer.
+#define SAMPLE_TIMESTAMPS_BUF(idx) ((uint32_t *)&sample_msg_bufs[idx][SAMPLE_TIMESTAMPS_OFFSET])
+#define SAMPLE_VOLTAGES_BUF(idx)   ((uint16_t *)&sample_msg_bufs[idx][SAMPLE_VOLTAGES_OFFSET])
+
+static uint16_t stream_mask; // see stream_t
+static unsigned stream_sampling_period;
+static uint8_t stream_divisors[ADC_MAX_CHANNELS]; // rate divisor by index in stream_info
+static unsigned seq_len; // conversions in the ADC sequence
+static uint16_t seq_pads; // bitmask of the padding conversions in the sequence
+static unsigned buf_num_seqs; // sequences that fit in a buffer
+static unsigned stream_flags; // see adc_stream_flag_t
+static uint16_t seq_period; // effective period between sequences in timer ticks
 
 static uint8_t sample_msg_bufs[NUM_BUFFERS][SAMPLES_MSG_BUF_SIZE];
 
-// Can't have a struct type because the number of channels per 'sample' (sequence) varies
-static uint32_t * const sample_timestamps_bufs[NUM_BUFFERS] = {
-    (uint32_t *)&sample_msg_bufs[0][SAMPLE_TIMESTAMPS_OFFSET],
-    (uint32_t *)&sample_msg_bufs[1][SAMPLE_TIMESTAMPS_OFFSET],
-};
-static uint16_t * const sample_voltages_bufs[NUM_BUFFERS] = {
-    (uint16_t *)&sample_msg_bufs[0][SAMPLE_VOLTAGES_OFFSET],
-    (uint16_t *)&sample_msg_bufs[1][SAMPLE_VOLTAGES_OFFSET],
-};
+// Non-zero means the buffer is full and waiting to be sent to the host.
+// volatile because main (or the UART TX DMA ISR, for a buffer that is sent
+// as is) frees the buffers that the ISR allocates.
+static volatile unsigned num_samples[NUM_BUFFERS];
+
+// The buffer is queued for sending as is, and freed once it is sent
+static volatile bool buf_queued[NUM_BUFFERS];
+
+static unsigned fill_buf_idx; // buffer the DMA is filling
+static unsigned reload_buf_idx; // buffer the DMA moves on to once that one is full
+static unsigned send_buf_idx; // next buffer to send to the host (oldest)
+
+// Samples at the start of each buffer already sent to the host by a flush
+// before the buffer was full (see ADC_on_flush_tick)
+static unsigned flushed_seqs[NUM_BUFFERS];
+static unsigned flush_age; // flush ticks with unsent samples
+
+// Output of the compressor, copied over the samples if it is smaller. Also
+// holds the header and the widened timestamps of a flush with a timestamp
+// per sample, which cannot be widened in place since the timestamp DMA is
+// still filling the first half of the section (see send_partial_buffer).
+static uint8_t compress_buf[SAMPLE_VOLTAGES_SIZE];
+
+#if STREAM_VOLTAGES_MSG_HEADER_LEN + NUM_BUFFERED_SAMPLES * 4 > \
+    NUM_BUFFERED_SAMPLES * ADC_MAX_CHANNELS * 2 // SAMPLE_TIMESTAMPS_SIZE, SAMPLE_VOLTAGES_SIZE
+#error The widened timestamps of a flush do not fit in the compressor output buffer
+#endif
+
+// Statistics and deadband modes: records accumulate here, since there may
+// be several per buffer and each record is much smaller than a buffer
+#define RECORDS_SIZE 200 // fits a one-byte UART message length
+#define RECORDS_HEADER_LEN 4 // mode-specific header after the voltage stream header
+#define RECORD_MSG_BUF_SIZE \
+    (UART_MSG_HEADER_SIZE + STREAM_VOLTAGES_MSG_HEADER_LEN + \
+     RECORDS_HEADER_LEN + RECORDS_SIZE)
+#define RECORDS_OFFSET \
+    (UART_MSG_HEADER_SIZE + STREAM_VOLTAGES_MSG_HEADER_LEN + RECORDS_HEADER_LEN)
+
+#if STREAM_VOLTAGE_STATS_HEADER_LEN != RECORDS_HEADER_LEN || \
+    STREAM_VOLTAGE_POINTS_HEADER_LEN != RECORDS_HEADER_LEN
+#error Record header length mismatch: see RECORDS_HEADER_LEN
+#endif
+
+static uint8_t record_msg_buf[RECORD_MSG_BUF_SIZE];
+static unsigned records_len; // bytes of records in the message
+static unsigned num_records;
+
+// Deadband mode: per value in the sequence, the last one reported and the
+// number of sequences since then
+static uint16_t deadband_last[ADC_MAX_SEQ_LEN];
+static uint16_t deadband_age[ADC_MAX_SEQ_LEN];
+#define DEADBAND_NONE 0xFFFF // no value reported yet (ADC values are 12-bit)
+
+// Oversampling mode: sums of the values in each slot of the sequence, over
+// the sequences so far of the value being accumulated (may span buffers)
+static uint32_t oversample_sums[ADC_MAX_SEQ_LEN];
+static unsigned oversample_count; // sequences accumulated so far
+static unsigned oversample_exp;
+static uint32_t oversample_first_time;
+
+// Capture mode: the ring keeps the most recent samples until a trigger, and
+// is frozen once it also holds the samples after the trigger. Positions are
+// counted in sequences since the capture was armed (wrapping is harmless).
+typedef enum {
+    CAPTURE_STATE_IDLE = 0,
+    CAPTURE_STATE_ARMED,
+    CAPTURE_STATE_TRIGGERED,
+    CAPTURE_STATE_READY, // frozen, waiting to be sent to the host
+} capture_state_t;
+
+static volatile capture_state_t capture_state;
+static uint16_t buf_first_seq[NUM_BUFFERS]; // sequence number of the first sample in each buffer
+static unsigned num_full_bufs; // buffers filled since armed (saturates at the ring's depth)
+static unsigned capture_buf_idx; // newest buffer in the frozen ring
+static uint16_t capture_trigger_seq; // first sample from the trigger on
+static uint16_t capture_end_seq; // first sample after the capture
+static uint16_t capture_pre_samples; // the parameters as of ADC_start
+static uint16_t capture_post_samples;
+static uint32_t capture_trigger_time;
+static uint8_t capture_trigger_source; // see capture_trigger_t
+static uint8_t capture_trigger_detail;
+static bool vcap_below_brown_out;
+
+static uint8_t capture_msg_buf[UART_MSG_HEADER_SIZE + VOLTAGE_CAPTURE_LEN];
+
+// Samples dropped since the stream began because the ring was full
+static uint16_t overflow_count;
+static uint16_t sent_overflow_count; // as of the last buffer sent to host
+
+// Multi-channel only: where the voltage DMA will put the sequence after the
+// one it is currently waiting for (see ADC_on_voltages_dma).
+static uint16_t *next_seq_voltages;
+static unsigned next_seq_idx;
 
-static unsigned num_samples[NUM_BUFFERS];
-static unsigned voltage_sample_offset;
-// volatile because main uses it to get the index of the ready buffer
-static volatile unsigned sample_buf_idx;
-static uint32_t *sample_timestamps_buf;
-static uint16_t *sample_voltages_buf;
+#ifdef CONFIG_SYSTICK_32BIT
+static uint32_t buf_end_time[NUM_BUFFERS]; // systick when the buffer was filled
+#endif
 
-void ADC_start(uint16_t streams, unsigned sampling_period)
+/** @brief Program the ADC sequence for the streamed channels at their rates
+ *  @details A channel with rate divisor k is converted in every k-th trigger
+ *           period. The sequence covers as many trigger periods as the
+ *           largest divisor, in order of trigger period, and within each
+ *           period in the order of stream_info. Divisors are powers of two,
+ *           and a channel is due in the periods where the period index
+ *           modulo its divisor equals its phase. The phases of the slow
+ *           channels are staggered so that they do not all pile up in the
+ *           first period. If the sequence does not fit in the ADC memory,
+ *           the largest divisors are halved until it does.
+ *
+ *           Conversions are evenly spaced (one per timer period), so every
+ *           trigger period is padded to the same number of conversions, with
+ *           repeats of its last channel (see seq_pads). That way each
+ *           conversion falls at a fixed offset into its trigger period.
+ *
+ *           Divisors are normalized so that the fastest channel has divisor
+ *           one, and the trigger period is multiplied by the smallest divisor.
+ *  @return Number of trigger periods in the sequence
+ */
+static unsigned program_sequence(uint16_t streams, unsigned *period_multiplier)
 {
-    unsigned i;
-    unsigned offset;
-    uint8_t *header;
+    uint8_t divisors[ADC_MAX_CHANNELS];
+    uint8_t phases[ADC_MAX_CHANNELS];
+    unsigned min_divisor = ADC_MAX_RATE_DIVISOR;
+    unsigned max_divisor = 1;
+    unsigned num_slow;
+    unsigned period_len, num_convs, slot = 0;
+    unsigned period, i, d;
     volatile uint8_t *ctl_reg;
+    uint8_t chan = 0;
+
+    for (i = 0; i < ADC_MAX_CHANNELS; ++i) {
+        if (!(streams & stream_info[i].stream))
+            continue;
 
-    LOG("adc: start: streams 0x%04x period %u\r\n", streams, sampling_period);
+        // Round down to a power of two
+        d = stream_divisors[i] > ADC_MAX_RATE_DIVISOR ?
+                ADC_MAX_RATE_DIVISOR : stream_divisors[i];
+        if (d == 0)
+            d = 1;
+        while (d & (d - 1))
+            d &= d - 1;
 
-    ADC12CTL0 &= ~ADC12ENC; // disable conversion so we can set control bits
+        divisors[i] = d;
+        if (d < min_divisor)
+            min_divisor = d;
+    }
+    *period_multiplier = min_divisor;
+
+    for (i = 0; i < ADC_MAX_CHANNELS; ++i) {
+        if (!(streams & stream_info[i].stream))
+            continue;
+        divisors[i] /= min_divisor;
+        if (divisors[i] > max_divisor)
+            max_divisor = divisors[i];
+    }
 
-    // sequence of channels, single conversion
-    ADC12CTL0 = ADC12SHT0_2 + ADC12ON + ADC12MSC; // sampling time, ADC12 on, multiple sample conversion
+    for (;;) {
+        num_slow = 0;
+        for (i = 0; i < ADC_MAX_CHANNELS; ++i) {
+            if ((streams & stream_info[i].stream) && divisors[i] > 1)
+                phases[i] = num_slow++ & (divisors[i] - 1);
+            else
+                phases[i] = 0;
+        }
+
+        // conversions in the busiest period
+        period_len = 0;
+        for (period = 0; period < max_divisor; ++period) {
+            num_convs = 0;
+            for (i = 0; i < ADC_MAX_CHANNELS; ++i)
+                if ((streams & stream_info[i].stream) &&
+                    (period & (divisors[i] - 1)) == phases[i])
+                    num_convs++;
+            if (num_convs > period_len)
+                period_len = num_convs;
+        }
 
-    // use sampling timer, sequence of channels, repeat-conversion, trigger from Timer B CCR0
-    ADC12CTL1 = ADC12SHP + ADC12CONSEQ_1 + ADC12SHS_2;
+        seq_len = period_len * max_divisor;
+        if (seq_len <= ADC_MAX_SEQ_LEN)
+            break;
 
-    // set ADC memory control registers and count channels
-    num_channels = 0;
+        LOG("adc: sequence too long (%u), halving divisor %u\r\n", seq_len, max_divisor);
+        for (i = 0; i < ADC_MAX_CHANNELS; ++i)
+            if (divisors[i] == max_divisor)
+                divisors[i] >>= 1;
+        max_divisor >>= 1;
+    }
+
+    seq_pads = 0;
     ctl_reg = &ADC12MCTL0;
-    for (i = 0; i < ADC_MAX_CHANNELS; ++i) {
-        if (streams & stream_info[i].stream) {
-            *(ctl_reg++) = stream_info[i].chan;
-            num_channels++;
+    for (period = 0; period < max_divisor; ++period) {
+        num_convs = 0;
+        for (i = 0; i < ADC_MAX_CHANNELS; ++i) {
+            if ((streams & stream_info[i].stream) &&
+                (period & (divisors[i] - 1)) == phases[i]) {
+                chan = stream_info[i].chan;
+                *(ctl_reg++) = chan;
+                num_convs++;
+                slot++;
+            }
+        }
+        // the fastest channel is due in every period, so there is a last one
+        for (; num_convs < period_len; ++num_convs) {
+            seq_pads |= 1u << slot++;
+            *(ctl_reg++) = chan;
         }
     }
     *(--ctl_reg) |= ADC12EOS;
 
-    ADC12IFG = 0; // clear int flags
-    ADC12IE = (0x0001 << (num_channels - 1)); // enable interupt on last sample
+    return max_divisor;
+}
 
-    TIMER_CC(TIMER_ADC_TRIGGER, TMRCC_ADC_TRIGGER, CCR) = sampling_period;
-    TIMER_CC(TIMER_ADC_TRIGGER, TMRCC_ADC_TRIGGER, CCTL) = OUTMOD_3; // set/reset output mode
-    TIMER(TIMER_ADC_TRIGGER, CTL) =
-         TIMER_CLK_SOURCE_BITS(TMRMOD_ADC_TRIGGER, CONFIG_ADC_TIMER_SOURCE_NAME) |
-         TIMER_DIV_BITS(CONFIG_ADC_TIMER_DIV) |
-         MC__UP | TIMER_CLR(TMRMOD_ADC_TRIGGER);
+/** @brief Take the timestamps DMA channel from the host RX, if shared */
+static inline void claim_timestamps_dma()
+{
+#if defined(DMA_HOST_UART_RX) && DMA_HOST_UART_RX == DMA_ADC_TIMESTAMPS
+    UART_release_host_rx_dma();
+#endif
+}
+
+/** @brief Give the timestamps DMA channel back to the host RX, if shared */
+static inline void return_timestamps_dma()
+{
+#if defined(DMA_HOST_UART_RX) && DMA_HOST_UART_RX == DMA_ADC_TIMESTAMPS
+    UART_acquire_host_rx_dma();
+#endif
+}
+
+/** @brief Configure the ADC and the DMA for the stream settings and start
+ *  @return False if the settings do not fit in the sample buffers, in which
+ *          case the stream is left half configured for ADC_stop to undo, or
+ *          if the sampling period cannot be kept, in which case it is not
+ *          started at all
+ */
+static bool start_stream()
+{
+    uint16_t streams = stream_mask;
+    unsigned sampling_period = stream_sampling_period;
+    unsigned flags = stream_flags;
+    unsigned i;
+    unsigned offset;
+    uint32_t conv_period;
+    unsigned num_periods;
+    unsigned period_multiplier;
+    uint8_t *header;
+
+    claim_timestamps_dma();
+
+    // the headers are rewritten below, and a capture is sent without a release
+    UART_wait_tx((uint8_t *)sample_msg_bufs, sizeof(sample_msg_bufs));
+    UART_wait_tx(record_msg_buf, sizeof(record_msg_buf));
+
+    ADC12CTL0 &= ~ADC12ENC; // disable conversion so we can set control bits
+    DMA(DMA_ADC_VOLTAGES, CTL) &= ~DMAEN;
+    DMA(DMA_ADC_TIMESTAMPS, CTL) &= ~DMAEN;
+
+    // No ADC12MSC: in repeat mode it would free-run the sequence, instead
+    // each conversion in the sequence waits for the next timer edge.
+    ADC12CTL0 = ADC12SHT0_2 + ADC12ON; // sampling time, ADC12 on
+
+    // use sampling timer, repeat-sequence of channels, trigger from Timer B CCR0
+    ADC12CTL1 = ADC12SHP + ADC12CONSEQ_3 + ADC12SHS_2;
+
+    // set ADC memory control registers
+    num_periods = program_sequence(streams, &period_multiplier);
+
+    // The sequence is converted one channel per timer period, so that the
+    // sequence spans its trigger periods of 'sampling_period' each (rounded
+    // down to a multiple of the number of conversions per period). A
+    // conversion takes at least a timer period, and the sequence period must
+    // fit in the compact timestamp.
+    conv_period = (uint32_t)sampling_period * period_multiplier * num_periods / seq_len;
+    if (conv_period == 0 || conv_period * seq_len > 0xFFFF) {
+        LOG("adc: sampling period out of range: %u x %u\r\n", sampling_period, period_multiplier);
+        return_timestamps_dma();
+        stream_mask = 0; // nothing to undo but the ADC (see ADC_stop)
+        return false;
+    }
+
+    buf_num_seqs = SAMPLE_VOLTAGES_SIZE / (seq_len * sizeof(uint16_t));
+    if (buf_num_seqs > NUM_BUFFERED_SAMPLES)
+        buf_num_seqs = NUM_BUFFERED_SAMPLES;
+
+    // The ring is frozen once the samples after the trigger are in, and only
+    // the newest NUM_BUFFERS - 1 buffers of it are whole: any more samples
+    // and the trigger itself would be overwritten (see capture_end).
+    if ((flags & ADC_STREAM_FLAG_CAPTURE) &&
+        capture_post_samples > (NUM_BUFFERS - 1) * buf_num_seqs) {
+        LOG("adc: capture too long: %u > %u samples\r\n",
+            capture_post_samples, (NUM_BUFFERS - 1) * buf_num_seqs);
+        return false;
+    }
+
+    ADC12IFG = 0; // clear int flags
+    ADC12IE = 0; // results are collected by DMA
 
     for (i = 0; i < NUM_BUFFERS; ++i) {
-        header = &sample_msg_bufs[i][UART_MSG_HEADER_SIZE];
+        flushed_seqs[i] = 0;
+        header = &sample_msg_bufs[i][SAMPLE_HEADER_OFFSET];
         offset = 0;
         header[offset++] = streams;
         header[offset++] = 0; // filled in num events once buffer is ready
+        *(uint16_t *)&header[offset] = 0; // filled in overflow count once buffer is ready
+        offset += STREAM_VOLTAGES_OVERFLOW_COUNT_LEN;
+        header[offset++] = flags;
+        header[offset++] = oversample_exp;
 
         num_samples[i] = 0;
+        buf_queued[i] = false;
     }
-    voltage_sample_offset = 0;
-    sample_buf_idx = 0;
-    sample_timestamps_buf = sample_timestamps_bufs[sample_buf_idx];
-    sample_voltages_buf = sample_voltages_bufs[sample_buf_idx];
+    fill_buf_idx = 0;
+    reload_buf_idx = 1;
+    send_buf_idx = 0;
+    overflow_count = 0;
+    sent_overflow_count = 0;
+    flush_age = 0;
+
+    if ((flags & ADC_STREAM_FLAG_STATS) && seq_len > STATS_MAX_CHANNELS) {
+        LOG("adc: sequence too long for stats: %u\r\n", seq_len);
+        flags &= ~ADC_STREAM_FLAG_STATS;
+        stream_flags = flags;
+    }
+
+    if (flags & ADC_STREAM_FLAG_STATS) {
+        unsigned stats = stats_begin(seq_len, param_stream_stats_window,
+                                     param_stream_stats);
+
+        header = &record_msg_buf[SAMPLE_HEADER_OFFSET];
+        memcpy(header, &sample_msg_bufs[0][SAMPLE_HEADER_OFFSET],
+               STREAM_VOLTAGES_MSG_HEADER_LEN);
+        offset = STREAM_VOLTAGES_MSG_HEADER_LEN;
+        *(uint16_t *)&header[offset] = stats_window_len(); // as collected
+        offset += sizeof(uint16_t);
+        header[offset++] = stats;
+        header[offset++] = 0; // padding
+    } else if (flags & ADC_STREAM_FLAG_DEADBAND) {
+        header = &record_msg_buf[SAMPLE_HEADER_OFFSET];
+        memcpy(header, &sample_msg_bufs[0][SAMPLE_HEADER_OFFSET],
+               STREAM_VOLTAGES_MSG_HEADER_LEN);
+        offset = STREAM_VOLTAGES_MSG_HEADER_LEN;
+        *(uint16_t *)&header[offset] = param_stream_deadband;
+        offset += sizeof(uint16_t);
+        *(uint16_t *)&header[offset] = param_stream_keepalive;
+        offset += sizeof(uint16_t);
+
+        for (i = 0; i < seq_len; ++i)
+            deadband_last[i] = DEADBAND_NONE;
+    }
+    records_len = 0;
+    num_records = 0;
+
+    oversample_count = 0;
+    for (i = 0; i < seq_len; ++i)
+        oversample_sums[i] = 0;
+
+    if (flags & ADC_STREAM_FLAG_CAPTURE) {
+        buf_first_seq[fill_buf_idx] = 0;
+        num_full_bufs = 0;
+        vcap_below_brown_out = true; // trigger only once Vcap has been above
+        capture_state = CAPTURE_STATE_ARMED;
+    }
+
+    // Timestamps: one word from the systick counter per sequence
+    DMA_CTL(DMA_ADC_TIMESTAMPS_CTL) =
+        (DMA_CTL(DMA_ADC_TIMESTAMPS_CTL) & ~DMA_TRIG(DMA_ADC_TIMESTAMPS, DMA_TRIG_SRC_MASK)) |
+        DMA_TRIG(DMA_ADC_TIMESTAMPS, DMA_TRIG_SRC_ADC12);
+    DMA(DMA_ADC_TIMESTAMPS, CTL) =
+        DMADT_4 /* repeated single */ |
+        DMADSTINCR_3 /* dest inc */ | DMASRCINCR_0 /* src no inc */ | DMAIE;
+    DMA(DMA_ADC_TIMESTAMPS, SA) = (__DMA_ACCESS_REG__)(&TA2R);
+    DMA(DMA_ADC_TIMESTAMPS, DA) = (__DMA_ACCESS_REG__)SAMPLE_TIMESTAMPS_BUF(fill_buf_idx);
+    DMA(DMA_ADC_TIMESTAMPS, SZ) = buf_num_seqs;
+
+    // Voltages: the results of the whole sequence per trigger
+    DMA_CTL(DMA_ADC_VOLTAGES_CTL) =
+        (DMA_CTL(DMA_ADC_VOLTAGES_CTL) & ~DMA_TRIG(DMA_ADC_VOLTAGES, DMA_TRIG_SRC_MASK)) |
+        DMA_TRIG(DMA_ADC_VOLTAGES, DMA_TRIG_SRC_ADC12);
+    if (seq_len == 1) {
+        // Fixed source, so the DMA runs on its own until the buffer is full
+        DMA(DMA_ADC_VOLTAGES, CTL) =
+            DMADT_4 /* repeated single */ |
+            DMADSTINCR_3 /* dest inc */ | DMASRCINCR_0 /* src no inc */;
+        DMA(DMA_ADC_VOLTAGES, SZ) = buf_num_seqs;
+    } else {
+        // Block of ADC12MEM0..K per sequence. Each block restarts at the
+        // address in the DA register, which the ISR keeps one sequence ahead.
+        DMA(DMA_ADC_VOLTAGES, CTL) =
+            DMADT_5 /* repeated block */ |
+            DMADSTINCR_3 /* dest inc */ | DMASRCINCR_3 /* src inc */ | DMAIE;
+        DMA(DMA_ADC_VOLTAGES, SZ) = seq_len;
+    }
+    DMA(DMA_ADC_VOLTAGES, SA) = (__DMA_ACCESS_REG__)(&ADC12MEM0);
+    DMA(DMA_ADC_VOLTAGES, DA) = (__DMA_ACCESS_REG__)SAMPLE_VOLTAGES_BUF(fill_buf_idx);
+
+    // Enabling latches the addresses above, the registers now take the
+    // address for the reload that follows the first buffer (or sequence).
+    DMA(DMA_ADC_TIMESTAMPS, CTL) |= DMAEN;
+    DMA(DMA_ADC_VOLTAGES, CTL) |= DMAEN;
+
+    DMA(DMA_ADC_TIMESTAMPS, DA) = (__DMA_ACCESS_REG__)SAMPLE_TIMESTAMPS_BUF(reload_buf_idx);
+    if (seq_len == 1) {
+        DMA(DMA_ADC_VOLTAGES, DA) = (__DMA_ACCESS_REG__)SAMPLE_VOLTAGES_BUF(reload_buf_idx);
+    } else {
+        next_seq_idx = 1;
+        next_seq_voltages = SAMPLE_VOLTAGES_BUF(fill_buf_idx) + seq_len;
+        DMA(DMA_ADC_VOLTAGES, DA) = (__DMA_ACCESS_REG__)next_seq_voltages;
+    }
+
+    seq_period = conv_period * seq_len;
+    TIMER_CC(TIMER_ADC_TRIGGER, TMRCC_ADC_TRIGGER, CCR) = conv_period - 1; // up mode counts CCR + 1
+    TIMER_CC(TIMER_ADC_TRIGGER, TMRCC_ADC_TRIGGER, CCTL) = OUTMOD_3; // set/reset output mode
+    TIMER(TIMER_ADC_TRIGGER, CTL) =
+         TIMER_CLK_SOURCE_BITS(TMRMOD_ADC_TRIGGER, CONFIG_ADC_TIMER_SOURCE_NAME) |
+         TIMER_DIV_BITS(CONFIG_ADC_TIMER_DIV) |
+         MC__UP | TIMER_CLR(TMRMOD_ADC_TRIGGER);
 
     ADC12CTL0 |= ADC12ENC; // launch: wait for trigger
+    return true;
 }
 
-void ADC_send_samples_to_host()
+unsigned ADC_start(uint16_t streams, unsigned sampling_period, unsigned flags,
+               const uint8_t *divisors, unsigned num_divisors)
+{
+    unsigned i;
+
+    LOG("adc: start: streams 0x%04x period %u flags 0x%02x\r\n",
+        streams, sampling_period, flags);
+
+    if (flags & ADC_STREAM_FLAG_CAPTURE)
+        flags &= ~(ADC_STREAM_FLAG_STATS | ADC_STREAM_FLAG_DEADBAND); // a capture is made of samples
+    if (flags & ADC_STREAM_FLAG_STATS)
+        flags &= ~ADC_STREAM_FLAG_DEADBAND;
+    if (flags & (ADC_STREAM_FLAG_STATS | ADC_STREAM_FLAG_DEADBAND | ADC_STREAM_FLAG_CAPTURE))
+        flags &= ~ADC_STREAM_FLAG_OVERSAMPLE; // modes that reduce the samples themselves
+    if (flags & ADC_STREAM_FLAG_OVERSAMPLE) // values no longer fit in 12 bits
+        flags &= ~(ADC_STREAM_FLAG_PACKED_SAMPLES | ADC_STREAM_FLAG_COMPRESSED);
+
+    oversample_exp = 0;
+    if (flags & ADC_STREAM_FLAG_OVERSAMPLE) {
+        oversample_exp = param_stream_oversampling;
+        if (oversample_exp < 1)
+            oversample_exp = 1;
+        if (oversample_exp > ADC_MAX_OVERSAMPLING)
+            oversample_exp = ADC_MAX_OVERSAMPLING;
+    }
+
+    stream_mask = streams;
+    stream_sampling_period = sampling_period;
+    stream_flags = flags;
+    capture_pre_samples = param_capture_pre_samples;
+    capture_post_samples = param_capture_post_samples;
+
+    // One divisor per streamed channel, the ones not given default to one
+    for (i = 0; i < ADC_MAX_CHANNELS; ++i) {
+        stream_divisors[i] = 1;
+        if ((streams & stream_info[i].stream) && num_divisors) {
+            stream_divisors[i] = *divisors++;
+            num_divisors--;
+        }
+    }
+
+    if (!start_stream()) {
+        ADC_stop();
+        return RETURN_CODE_INVALID_ARGS;
+    }
+    return RETURN_CODE_SUCCESS;
+}
+
+/** @brief Widen the 16-bit timestamps recorded by DMA into the 32-bit slots
+ *  @details Done in place from the end, since each 32-bit slot covers the
+ *           16-bit slots at twice its index, which have been consumed by then.
+ */
+static void widen_timestamps(unsigned buf_idx, unsigned count)
+{
+    uint16_t *timestamps16 = (uint16_t *)SAMPLE_TIMESTAMPS_BUF(buf_idx);
+    uint32_t *timestamps = SAMPLE_TIMESTAMPS_BUF(buf_idx);
+    uint32_t high = 0;
+    int i;
+
+    if (!count)
+        return; // no newest timestamp to walk back from
+
+#ifdef CONFIG_SYSTICK_32BIT
+    // Walk back from the time the buffer was filled, borrowing on each wrap
+    high = buf_end_time[buf_idx] & 0xFFFF0000;
+    if ((uint16_t)buf_end_time[buf_idx] < timestamps16[count - 1])
+        high -= 0x10000;
+#endif // CONFIG_SYSTICK_32BIT
+
+    for (i = count - 1; i >= 0; --i) {
+        uint16_t low = timestamps16[i];
+#ifdef CONFIG_SYSTICK_32BIT
+        if (i < count - 1 && low > timestamps16[i + 1])
+            high -= 0x10000;
+#endif // CONFIG_SYSTICK_32BIT
+        timestamps[i] = high | low;
+    }
+}
+
+/** @brief Pack pairs of 12-bit samples into three bytes, in place
+ *  @details Little-endian: the low byte of the first sample, then its high
+ *           nibble in the low half of the middle byte, the low nibble of the
+ *           second sample in the high half, and its high byte last. An odd
+ *           sample at the end takes two bytes. Works in place because each
+ *           pair is read before it is written and the output never gets
+ *           ahead of the input.
+ *  @return Length of the packed samples in bytes
+ */
+static unsigned pack_samples(uint16_t *samples, unsigned count)
 {
-    unsigned ready_buf_idx = sample_buf_idx ^ 1; // the other one in the double-buffer pair
+    uint8_t *packed = (uint8_t *)samples;
+    uint16_t first, second;
+    unsigned i;
+
+    for (i = 0; i + 1 < count; i += 2) {
+        first = samples[i];
+        second = samples[i + 1];
+        *packed++ = first;
+        *packed++ = (first >> 8) | (second << 4);
+        *packed++ = second >> 4;
+    }
+    if (i < count) {
+        first = samples[i];
+        *packed++ = first;
+        *packed++ = first >> 8;
+    }
+    return packed - (uint8_t *)samples;
+}
 
-    sample_msg_bufs[ready_buf_idx][UART_MSG_HEADER_SIZE + STREAM_DATA_STREAMS_BITMASK_LEN] =
-        num_samples[ready_buf_idx];
+/** @brief Prepare the voltages section of a buffer for sending
+ *  @details Compressed blocks that would not be smaller than the samples
+ *           sent as they are (packed or not) are sent as they are, and the
+ *           flags in the header tell the host which format the frame is in.
+ *  @return Length of the voltages section in bytes
+ */
+static unsigned encode_voltages(unsigned buf_idx, unsigned count)
+{
+    uint8_t *header = &sample_msg_bufs[buf_idx][SAMPLE_HEADER_OFFSET];
+    uint16_t *voltages = SAMPLE_VOLTAGES_BUF(buf_idx);
+    unsigned flags = stream_flags;
+    unsigned num_voltages = count * seq_len;
+    unsigned len;
+    unsigned compressed_len;
 
-    UART_begin_transmission();
+    if (flags & ADC_STREAM_FLAG_PACKED_SAMPLES)
+        len = (num_voltages * 3 + 1) / 2;
+    else
+        len = num_voltages * sizeof(uint16_t);
+
+    if (flags & ADC_STREAM_FLAG_COMPRESSED) {
+        UART_wait_tx(compress_buf, sizeof(compress_buf)); // a flush (see send_partial_buffer)
+        compressed_len = compress_samples(compress_buf, len - 1,
+                                          voltages, count, seq_len);
+        if (compressed_len) {
+            memcpy(voltages, compress_buf, compressed_len);
+            header[SAMPLE_HEADER_FLAGS_OFFSET] = flags & ~ADC_STREAM_FLAG_PACKED_SAMPLES;
+            return compressed_len;
+        }
+        flags &= ~ADC_STREAM_FLAG_COMPRESSED; // fall back
+    }
+
+    header[SAMPLE_HEADER_FLAGS_OFFSET] = flags;
+
+    if (flags & ADC_STREAM_FLAG_PACKED_SAMPLES)
+        pack_samples(voltages, num_voltages);
+    return len;
+}
+
+/** @brief Free a buffer of the ring once it is sent (from DMA ISR) */
+static void on_buffer_sent(unsigned buf_idx)
+{
+    num_samples[buf_idx] = 0;
+    buf_queued[buf_idx] = false;
+}
+
+/** @brief Send a buffer with a timestamp for each sample */
+static void send_buffer(unsigned buf_idx, unsigned count, UART_tx_release_t release)
+{
+    uint8_t *buf = &sample_msg_bufs[buf_idx][0];
+    unsigned voltages_len;
+
+    voltages_len = encode_voltages(buf_idx, count);
 
     // Concatenated timestamps buf and samples buf
-    // sample_buf_idx points to the 'other' (i.e. the ready buf)
-    UART_send_msg_to_host(USB_RSP_STREAM_VOLTAGES,
-            STREAM_DATA_MSG_HEADER_LEN +
+    UART_queue_msg_to_host(TX_SOURCE_VOLTAGES, USB_RSP_STREAM_VOLTAGES,
+            STREAM_VOLTAGES_MSG_HEADER_LEN +
             /* always tx full timestamps section even if buf not completely
              * full because the voltage section is always offset by the
              * size of the timestamp section (i.e. timestamps section is fixed-width,
              * and only the (trailing) voltage section is variable-length). */
-            SAMPLE_TIMESTAMPS_SIZE +
-            num_samples[ready_buf_idx] * sizeof(uint16_t) * num_channels,
-            (uint8_t *)&sample_msg_bufs[ready_buf_idx][0]);
+            SAMPLE_TIMESTAMPS_SIZE + voltages_len,
+            buf, release, buf_idx);
+}
+
+/** @brief Send a buffer with only the timestamp of the first sample
+ *  @details Touches only the voltages of the samples sent and the tail of the
+ *           timestamps section (which the timestamp DMA does not reach), so
+ *           it can send the filled part of the buffer the DMA is filling.
+ */
+static void send_buffer_compact(unsigned buf_idx, unsigned count, uint32_t base_time,
+                                UART_tx_release_t release)
+{
+    uint8_t *buf = &sample_msg_bufs[buf_idx][0];
+    uint8_t *header = &buf[SAMPLE_HEADER_OFFSET];
+    uint8_t *msg = &buf[SAMPLE_VOLTAGES_OFFSET - STREAM_VOLTAGES_COMPACT_TIMESTAMP_LEN -
+                        STREAM_VOLTAGES_MSG_HEADER_LEN - UART_MSG_HEADER_SIZE];
+    uint8_t *msg_header = &msg[UART_MSG_HEADER_SIZE];
+    uint8_t *compact_timestamp = &msg_header[STREAM_VOLTAGES_MSG_HEADER_LEN];
+    uint16_t buf_overflow_count = *(uint16_t *)&header[STREAM_DATA_MSG_HEADER_LEN];
+    unsigned voltages_len;
+    unsigned offset = 0;
+
+    voltages_len = encode_voltages(buf_idx, count);
+
+    *(uint32_t *)&compact_timestamp[offset] = base_time;
+    offset += sizeof(uint32_t);
+    *(uint16_t *)&compact_timestamp[offset] = seq_period;
+    offset += sizeof(uint16_t);
+    *(uint16_t *)&compact_timestamp[offset] = buf_overflow_count - sent_overflow_count;
+    offset += sizeof(uint16_t);
+
+    memcpy(msg_header, header, STREAM_VOLTAGES_MSG_HEADER_LEN);
+
+    UART_queue_msg_to_host(TX_SOURCE_VOLTAGES, USB_RSP_STREAM_VOLTAGES_COMPACT,
+            STREAM_VOLTAGES_MSG_HEADER_LEN + STREAM_VOLTAGES_COMPACT_TIMESTAMP_LEN +
+            voltages_len,
+            msg, release, buf_idx);
+}
+
+/** @brief Send the statistics or deadband records accumulated so far */
+static void send_records()
+{
+    uint8_t *header = &record_msg_buf[SAMPLE_HEADER_OFFSET];
+
+    header[STREAM_DATA_STREAMS_BITMASK_LEN] = num_records;
+    *(uint16_t *)&header[STREAM_DATA_MSG_HEADER_LEN] = overflow_count;
+
+    UART_send_msg_to_host(TX_SOURCE_VOLTAGES, (stream_flags & ADC_STREAM_FLAG_STATS) ?
+                USB_RSP_STREAM_VOLTAGE_STATS : USB_RSP_STREAM_VOLTAGE_POINTS,
+            STREAM_VOLTAGES_MSG_HEADER_LEN + RECORDS_HEADER_LEN + records_len,
+            record_msg_buf);
+
+    records_len = 0;
+    num_records = 0;
+}
+
+/** @brief Where the next record goes, once the previous message is sent */
+static uint8_t *next_record()
+{
+    if (!records_len)
+        UART_wait_tx(record_msg_buf, sizeof(record_msg_buf));
+    return &record_msg_buf[RECORDS_OFFSET + records_len];
+}
+
+/** @brief Run the samples in a buffer through the statistics
+ *  @details Records are sent once the message has no room for another one,
+ *           and whatever is left at the end of the buffer is sent too, so
+ *           that a record is never held back for longer than a buffer.
+ */
+static void process_buffer_stats(unsigned buf_idx, unsigned count)
+{
+    uint32_t *timestamps = SAMPLE_TIMESTAMPS_BUF(buf_idx);
+    uint16_t *voltages = SAMPLE_VOLTAGES_BUF(buf_idx);
+    unsigned record_len = stats_record_len();
+    unsigned i;
+
+    for (i = 0; i < count; ++i) {
+        if (!stats_add(&voltages[i * seq_len], timestamps[i]))
+            continue;
+
+        if (records_len + record_len > RECORDS_SIZE)
+            send_records();
+
+        records_len += stats_record(next_record());
+        num_records++;
+    }
+
+    if (num_records)
+        send_records();
+}
+
+/** @brief Accumulate the sequences in a buffer into oversampled values
+ *  @details Each value is the sum of 4^k consecutive values of a slot in the
+ *           sequence, shifted right by k, so it has k more bits than the ADC.
+ *           The values are written over the start of the buffer, in place,
+ *           since each one is done only once its last sequence is read. A
+ *           value that is not done at the end of the buffer is carried over.
+ *  @return Number of oversampled sequences now at the start of the buffer
+ */
+static unsigned oversample_buffer(unsigned buf_idx, unsigned count)
+{
+    uint32_t *timestamps = SAMPLE_TIMESTAMPS_BUF(buf_idx);
+    uint16_t *voltages = SAMPLE_VOLTAGES_BUF(buf_idx);
+    uint16_t *out = voltages;
+    unsigned num_seqs = 1 << (2 * oversample_exp);
+    unsigned num_out = 0;
+    unsigned i, j;
+
+    for (i = 0; i < count; ++i) {
+        if (!oversample_count)
+            oversample_first_time = timestamps[i];
+
+        for (j = 0; j < seq_len; ++j)
+            oversample_sums[j] += *voltages++;
+
+        if (++oversample_count < num_seqs)
+            continue;
+
+        timestamps[num_out++] = oversample_first_time;
+        for (j = 0; j < seq_len; ++j) {
+            *out++ = oversample_sums[j] >> oversample_exp;
+            oversample_sums[j] = 0;
+        }
+        oversample_count = 0;
+    }
+    return num_out;
+}
+
+/** @brief Report the values in a buffer that moved out of the deadband
+ *  @details Each value in the sequence is compared against the last one
+ *           reported for it. A value is also reported when none has been
+ *           for 'keepalive' sequences. Points are sent like the statistics
+ *           records: when the message is full, and at the end of the buffer.
+ */
+static void process_buffer_deadband(unsigned buf_idx, unsigned count)
+{
+    uint32_t *timestamps = SAMPLE_TIMESTAMPS_BUF(buf_idx);
+    uint16_t *voltages = SAMPLE_VOLTAGES_BUF(buf_idx);
+    uint16_t deadband = param_stream_deadband;
+    uint16_t keepalive = param_stream_keepalive;
+    uint16_t value, last;
+    uint8_t *point;
+    unsigned i, j;
+
+    for (i = 0; i < count; ++i) {
+        for (j = 0; j < seq_len; ++j) {
+            value = *voltages++;
+            if (seq_pads & (1u << j))
+                continue; // not a sample of its own (see program_sequence)
+            last = deadband_last[j];
+
+            if (last != DEADBAND_NONE &&
+                (value > last ? value - last : last - value) <= deadband &&
+                (!keepalive || ++deadband_age[j] < keepalive))
+                continue;
+
+            if (records_len + STREAM_VOLTAGE_POINT_LEN > RECORDS_SIZE)
+                send_records();
+
+            point = next_record();
+            *(uint32_t *)&point[0] = timestamps[i];
+            *(uint16_t *)&point[sizeof(uint32_t)] = value | (j << STREAM_VOLTAGE_POINT_INDEX_SHIFT);
+            records_len += STREAM_VOLTAGE_POINT_LEN;
+            num_records++;
+
+            deadband_last[j] = value;
+            deadband_age[j] = 0;
+        }
+    }
+
+    if (num_records)
+        send_records();
+}
+
+/** @brief Drop the first samples of a buffer (with widened timestamps) by
+ *         moving the rest of each section down */
+static void trim_buffer(unsigned buf_idx, unsigned offset, unsigned count)
+{
+    uint32_t *timestamps = SAMPLE_TIMESTAMPS_BUF(buf_idx);
+    uint16_t *voltages = SAMPLE_VOLTAGES_BUF(buf_idx);
+
+    memmove(timestamps, &timestamps[offset], count * sizeof(uint32_t));
+    memmove(voltages, &voltages[offset * seq_len], count * seq_len * sizeof(uint16_t));
+}
+
+/** @brief Send the frozen ring: the trigger info, then the frames that
+ *         overlap the capture window, trimmed to it
+ *  @details The pre-trigger part is cut short if the ring does not reach
+ *           that far back (see CONFIG_VOLTAGE_STREAM_BUFFERS).
+ */
+static void send_capture()
+{
+    uint8_t *msg = &capture_msg_buf[UART_MSG_HEADER_SIZE];
+    uint8_t *header;
+    uint16_t start_seq, buf_start_seq, lo, hi;
+    unsigned num_bufs, first_buf_idx, buf_idx;
+    unsigned offset, count;
+    unsigned i;
+
+    UART_wait_tx(capture_msg_buf, sizeof(capture_msg_buf)); // the previous capture
+
+    num_bufs = num_full_bufs;
+    first_buf_idx = (capture_buf_idx + NUM_BUFFERS - (num_bufs - 1)) % NUM_BUFFERS;
+
+    start_seq = capture_trigger_seq - capture_pre_samples;
+    if ((int16_t)(start_seq - buf_first_seq[first_buf_idx]) < 0)
+        start_seq = buf_first_seq[first_buf_idx];
+
+    buf_idx = first_buf_idx;
+    for (i = 0; i < num_bufs; ++i) {
+        widen_timestamps(buf_idx, buf_num_seqs);
+
+        // A brown-out is found in the samples, so its time is the sample's
+        if (capture_trigger_source == CAPTURE_TRIGGER_BROWN_OUT &&
+            (uint16_t)(capture_trigger_seq - buf_first_seq[buf_idx]) < buf_num_seqs)
+            capture_trigger_time = SAMPLE_TIMESTAMPS_BUF(buf_idx)[
+                capture_trigger_seq - buf_first_seq[buf_idx]];
+
+        if (++buf_idx == NUM_BUFFERS)
+            buf_idx = 0;
+    }
+
+    offset = 0;
+    *(uint32_t *)&msg[offset] = capture_trigger_time;
+    offset += sizeof(uint32_t);
+    msg[offset++] = capture_trigger_source;
+    msg[offset++] = capture_trigger_detail;
+    *(uint16_t *)&msg[offset] = capture_trigger_seq - start_seq;
+    offset += sizeof(uint16_t);
+    *(uint16_t *)&msg[offset] = capture_end_seq - capture_trigger_seq;
+    offset += sizeof(uint16_t);
+
+    UART_send_msg_to_host(TX_SOURCE_VOLTAGES, USB_RSP_VOLTAGE_CAPTURE,
+                          VOLTAGE_CAPTURE_LEN, capture_msg_buf);
+
+    buf_idx = first_buf_idx;
+    for (i = 0; i < num_bufs; ++i) {
+        buf_start_seq = buf_first_seq[buf_idx];
+        lo = (int16_t)(start_seq - buf_start_seq) > 0 ? start_seq : buf_start_seq;
+        hi = (int16_t)(capture_end_seq - (buf_start_seq + buf_num_seqs)) < 0 ?
+                capture_end_seq : buf_start_seq + buf_num_seqs;
+
+        if ((int16_t)(hi - lo) > 0) {
+            offset = lo - buf_start_seq;
+            count = hi - lo;
+
+            if (offset)
+                trim_buffer(buf_idx, offset, count);
+
+            header = &sample_msg_bufs[buf_idx][SAMPLE_HEADER_OFFSET];
+            header[STREAM_DATA_STREAMS_BITMASK_LEN] = count;
+            *(uint16_t *)&header[STREAM_DATA_MSG_HEADER_LEN] = 0; // no overflow
+
+            // the ring is re-armed only once they are sent (see start_stream)
+            if (stream_flags & ADC_STREAM_FLAG_COMPACT_TIMESTAMPS)
+                send_buffer_compact(buf_idx, count, SAMPLE_TIMESTAMPS_BUF(buf_idx)[0], NULL);
+            else
+                send_buffer(buf_idx, count, NULL);
+        }
+
+        if (++buf_idx == NUM_BUFFERS)
+            buf_idx = 0;
+    }
+}
+
+/**
+ * @brief   Send the buffers that are ready, in order
+ * @param   wait    Wait for room in the host TX queue, rather than leave the
+ *                  rest for the next pass of the main loop (the final flush,
+ *                  after which the main loop no longer calls back)
+ */
+static void send_samples(bool wait)
+{
+    unsigned count;
+    unsigned offset;
+    uint8_t *header;
+
+    // Drain the ring in order, there may be more than one buffer ready if
+    // the main loop was held up. Buffers sent as they are stay allocated
+    // until they are out.
+    while ((count = num_samples[send_buf_idx]) != 0 && !buf_queued[send_buf_idx]) {
+        // Rather than wait for the other sources on the host link, leave
+        // the rest in the ring for the next pass of the main loop
+        if (!wait && UART_host_tx_full(TX_SOURCE_VOLTAGES)) {
+            main_loop_flags |= FLAG_ADC_COMPLETE;
+            break;
+        }
+
+        header = &sample_msg_bufs[send_buf_idx][SAMPLE_HEADER_OFFSET];
+
+        // Skip what a flush already sent, once it is out
+        offset = flushed_seqs[send_buf_idx];
+        if (offset)
+            UART_wait_tx(sample_msg_bufs[send_buf_idx], SAMPLES_MSG_BUF_SIZE);
+
+        widen_timestamps(send_buf_idx, count);
+
+        if (offset) {
+            count -= offset;
+            trim_buffer(send_buf_idx, offset, count);
+        }
+        if (stream_flags & ADC_STREAM_FLAG_OVERSAMPLE)
+            count = oversample_buffer(send_buf_idx, count);
+        header[STREAM_DATA_STREAMS_BITMASK_LEN] = count;
+
+        sent_overflow_count = *(uint16_t *)&header[STREAM_DATA_MSG_HEADER_LEN];
+        flushed_seqs[send_buf_idx] = 0;
+
+        if (!count || (stream_flags & (ADC_STREAM_FLAG_STATS | ADC_STREAM_FLAG_DEADBAND))) {
+            if (!count) {
+                // the oversampled value continues into the next buffer
+            } else if (stream_flags & ADC_STREAM_FLAG_STATS)
+                process_buffer_stats(send_buf_idx, count);
+            else
+                process_buffer_deadband(send_buf_idx, count);
+
+            num_samples[send_buf_idx] = 0; // mark buffer as free
+        } else {
+            // sent as is, so freed once it is out (see on_buffer_sent)
+            buf_queued[send_buf_idx] = true;
+            if (stream_flags & ADC_STREAM_FLAG_COMPACT_TIMESTAMPS)
+                send_buffer_compact(send_buf_idx, count, SAMPLE_TIMESTAMPS_BUF(send_buf_idx)[0],
+                                    on_buffer_sent);
+            else
+                send_buffer(send_buf_idx, count, on_buffer_sent);
+        }
+
+        if (++send_buf_idx == NUM_BUFFERS)
+            send_buf_idx = 0;
 
-    UART_end_transmission();
+        flush_age = 0;
+    }
+}
+
+void ADC_send_samples_to_host()
+{
+    if (stream_flags & ADC_STREAM_FLAG_CAPTURE) {
+        if (capture_state == CAPTURE_STATE_READY) {
+            send_capture();
+            start_stream(); // re-arm
+        }
+        return;
+    }
+
+    send_samples(false);
+}
+
+/** @brief Widen a 16-bit timestamp in the buffer that the DMA is filling
+ *  @details Walks back from the newest timestamp, which is recent enough to
+ *           be in the current wrap of the systick counter.
+ */
+static uint32_t widen_partial_timestamp(unsigned buf_idx, unsigned idx, unsigned newest)
+{
+    uint16_t *timestamps16 = (uint16_t *)SAMPLE_TIMESTAMPS_BUF(buf_idx);
+    uint32_t high = 0;
+
+#ifdef CONFIG_SYSTICK_32BIT
+    uint32_t now = SYSTICK_CURRENT_TIME;
+    unsigned i;
+
+    high = now & 0xFFFF0000;
+    if ((uint16_t)now < timestamps16[newest])
+        high -= 0x10000;
+    for (i = newest; i > idx; --i) {
+        if (timestamps16[i - 1] > timestamps16[i])
+            high -= 0x10000;
+    }
+#endif // CONFIG_SYSTICK_32BIT
+
+    return high | timestamps16[idx];
+}
+
+/** @brief Send the filled part of the buffer the DMA is filling, with a
+ *         timestamp for each sample
+ *  @details The voltages are at the start of their section already, and go
+ *           out from there. Only the compact format can be sent from the
+ *           buffer itself (see send_buffer_compact), so the header and the
+ *           timestamps of this one are put together in compress_buf, which
+ *           is free once the voltages are encoded.
+ */
+static void send_partial_buffer(unsigned buf_idx, unsigned start, unsigned count)
+{
+    uint16_t *timestamps16 = (uint16_t *)SAMPLE_TIMESTAMPS_BUF(buf_idx);
+    uint32_t *timestamps = (uint32_t *)&compress_buf[STREAM_VOLTAGES_MSG_HEADER_LEN];
+    unsigned newest = start + count - 1;
+    UART_segment_t segs[2];
+    uint32_t high;
+    int i;
+
+    UART_wait_tx(compress_buf, sizeof(compress_buf)); // the previous flush
+
+    segs[1].buf = (uint8_t *)SAMPLE_VOLTAGES_BUF(buf_idx);
+    segs[1].len = encode_voltages(buf_idx, count);
+
+    high = widen_partial_timestamp(buf_idx, newest, newest) & 0xFFFF0000;
+    for (i = count - 1; i >= 0; --i) {
+        uint16_t low = timestamps16[start + i];
+#ifdef CONFIG_SYSTICK_32BIT
+        if (i < count - 1 && low > timestamps16[start + i + 1])
+            high -= 0x10000;
+#endif // CONFIG_SYSTICK_32BIT
+        timestamps[i] = high | low;
+    }
+
+    memcpy(compress_buf, &sample_msg_bufs[buf_idx][SAMPLE_HEADER_OFFSET],
+           STREAM_VOLTAGES_MSG_HEADER_LEN);
+    segs[0].buf = compress_buf;
+    segs[0].len = STREAM_VOLTAGES_MSG_HEADER_LEN + SAMPLE_TIMESTAMPS_SIZE; // fixed-width, see send_buffer
+
+    UART_queue_segments_to_host(TX_SOURCE_VOLTAGES, USB_RSP_STREAM_VOLTAGES,
+                                NULL, 0, segs, 2, NULL, 0);
+}
+
+void ADC_on_flush_tick()
+{
+    unsigned buf_idx;
+    unsigned remaining;
+    unsigned start, count;
+    bool completing, ring_full;
+    uint8_t *header;
 
-    num_samples[ready_buf_idx] = 0; // mark buffer as free
+    // Records are sent per buffer anyway, captures are sent whole, and
+    // oversampled values span several sequences
+    if (!stream_mask || (stream_flags & (ADC_STREAM_FLAG_STATS | ADC_STREAM_FLAG_DEADBAND |
+                                         ADC_STREAM_FLAG_CAPTURE | ADC_STREAM_FLAG_OVERSAMPLE)))
+        return;
+
+    __disable_interrupt();
+    buf_idx = fill_buf_idx;
+    remaining = DMA(DMA_ADC_TIMESTAMPS, SZ);
+    completing = DMA(DMA_ADC_TIMESTAMPS, CTL) & DMAIFG;
+    ring_full = reload_buf_idx == fill_buf_idx;
+    __enable_interrupt();
+
+    // A buffer about to complete is sent by the main loop as usual
+    start = flushed_seqs[buf_idx];
+    if (completing || buf_num_seqs - remaining == start) {
+        flush_age = 0;
+        return;
+    }
+
+    if (!param_stream_latency_voltages || ++flush_age < param_stream_latency_voltages)
+        return;
+
+    // The DMA would overwrite the samples as they are being sent, and the
+    // main loop should not wait for the host link (retried on the next tick)
+    if (ring_full || UART_host_tx_full(TX_SOURCE_VOLTAGES))
+        return;
+
+    // The sequences before the DMA's position are done, send them without
+    // waiting for the rest of the buffer
+    count = buf_num_seqs - remaining - start;
+    if (start) {
+        UART_wait_tx(sample_msg_bufs[buf_idx], SAMPLES_MSG_BUF_SIZE); // the previous flush
+        memmove(SAMPLE_VOLTAGES_BUF(buf_idx), &SAMPLE_VOLTAGES_BUF(buf_idx)[start * seq_len],
+                count * seq_len * sizeof(uint16_t));
+    }
+
+    header = &sample_msg_bufs[buf_idx][SAMPLE_HEADER_OFFSET];
+    header[STREAM_DATA_STREAMS_BITMASK_LEN] = count;
+    *(uint16_t *)&header[STREAM_DATA_MSG_HEADER_LEN] = overflow_count;
+
+    if (stream_flags & ADC_STREAM_FLAG_COMPACT_TIMESTAMPS)
+        send_buffer_compact(buf_idx, count,
+                            widen_partial_timestamp(buf_idx, start, start + count - 1), NULL);
+    else
+        send_partial_buffer(buf_idx, start, count);
+
+    sent_overflow_count = overflow_count;
+    flushed_seqs[buf_idx] = start + count;
+    flush_age = 0;
 }
 
 void ADC_stop()
 {
+    unsigned count;
+    uint8_t *header;
+
     LOG("adc: stop\r\n");
 
+    capture_state = CAPTURE_STATE_IDLE;
+
     ADC12CTL0 &= ~(ADC12SC | ADC12ENC);  // stop conversion and disable ADC
     while (ADC12CTL1 & ADC12BUSY); // conversion stops at end of sequence
+
+    DMA(DMA_ADC_VOLTAGES, CTL) &= ~(DMAEN | DMAIE);
+
+    if (!stream_mask) {
+        resume_background(); // not streaming, but the ADC was stopped
+        return; // and the timestamps channel may be in use by the host RX
+    }
+    DMA(DMA_ADC_TIMESTAMPS, CTL) &= ~(DMAEN | DMAIE);
+
+    stream_mask = 0;
+    resume_background();
+    if (stream_flags & ADC_STREAM_FLAG_CAPTURE) {
+        DMA(DMA_ADC_TIMESTAMPS, CTL) &= ~DMAIFG;
+        return_timestamps_dma();
+        return; // only whole captures are sent
+    }
+
+    // Final flush: the DMA is stopped, so the filled part of the current
+    // buffer can go out the usual way, after the buffers ahead of it.
+    // The interrupt for a buffer that just completed is not going to run.
+    if (DMA(DMA_ADC_TIMESTAMPS, CTL) & DMAIFG)
+        count = buf_num_seqs;
+    else
+        count = buf_num_seqs - DMA(DMA_ADC_TIMESTAMPS, SZ);
+    DMA(DMA_ADC_TIMESTAMPS, CTL) &= ~DMAIFG;
+    return_timestamps_dma();
+
+    if (count > flushed_seqs[fill_buf_idx] && !num_samples[fill_buf_idx]) {
+        header = &sample_msg_bufs[fill_buf_idx][SAMPLE_HEADER_OFFSET];
+        *(uint16_t *)&header[STREAM_DATA_MSG_HEADER_LEN] = overflow_count;
+#ifdef CONFIG_SYSTICK_32BIT
+        buf_end_time[fill_buf_idx] = SYSTICK_CURRENT_TIME;
+#endif
+        num_samples[fill_buf_idx] = count;
+    }
+
+    send_samples(true); // all of them: the stream is over
 }
 
-#endif // CONFIG_ENABLE_VOLTAGE_STREAM
+void ADC_on_voltages_dma()
+{
+    // The block that just completed has already reloaded the destination
+    // register, so program the one for the sequence after the current one.
+    next_seq_voltages += seq_len;
+    if (++next_seq_idx == buf_num_seqs) {
+        next_seq_idx = 0;
+        next_seq_voltages = SAMPLE_VOLTAGES_BUF(reload_buf_idx);
+    }
+    DMA(DMA_ADC_VOLTAGES, DA) = (__DMA_ACCESS_REG__)next_seq_voltages;
+}
 
-uint16_t ADC_read(unsigned chan_index)
+/** @brief Point the DMA at the buffer to move on to once the current one is full */
+static void program_reload()
 {
-    ADC12CTL0 &= ~ADC12ENC; // disable ADC
+    DMA(DMA_ADC_TIMESTAMPS, DA) =
+        (__DMA_ACCESS_REG__)SAMPLE_TIMESTAMPS_BUF(reload_buf_idx);
+    if (seq_len == 1)
+        DMA(DMA_ADC_VOLTAGES, DA) =
+            (__DMA_ACCESS_REG__)SAMPLE_VOLTAGES_BUF(reload_buf_idx);
+}
 
-    ADC12CTL0 = ADC12SHT0_2 + ADC12ON + ADC12REF2_5V + ADC12REFON; // sampling time, ADC12 on
-    ADC12CTL1 = ADC12SHP + ADC12CONSEQ_0; // use sampling timer, single-channel, single-conversion
-    ADC12MCTL0 = stream_info[chan_index].chan; // set ADC memory control register
-    ADC12IE = 0; // disable interrupt
+/** @brief First sample after a capture triggered at a sample
+ *  @param  trigger_seq     Sample of the trigger
+ *  @param  buf_start_seq   First sample of the buffer the trigger is in
+ *  @details The ring is frozen when the buffer with the last sample is full,
+ *           and by then the buffer of the trigger must still be one of the
+ *           NUM_BUFFERS - 1 whole ones. So the samples after the trigger are
+ *           cut short when the trigger comes late in its buffer.
+ */
+static uint16_t capture_end(uint16_t trigger_seq, uint16_t buf_start_seq)
+{
+    uint16_t end_seq = trigger_seq + capture_post_samples;
+    uint16_t max_end_seq = buf_start_seq + (NUM_BUFFERS - 1) * buf_num_seqs;
 
-    ADC12CTL0 |= ADC12ENC; // enable ADC
+    return (int16_t)(end_seq - max_end_seq) > 0 ? max_end_seq : end_seq;
+}
 
-    // Trigger
-    ADC12CTL0 &= ~ADC12SC;  // 'start conversion' bit must be toggled
-    ADC12CTL0 |= ADC12SC; // start conversion
+/** @brief Look for Vcap falling below the brown-out threshold in a buffer
+ *  @details Vcap is the first conversion in the sequence when it is streamed
+ *           (see program_sequence).
+ */
+static void detect_brown_out(unsigned buf_idx)
+{
+    uint16_t *vcap = SAMPLE_VOLTAGES_BUF(buf_idx);
+    bool below;
+    unsigned i;
 
-    while (ADC12CTL1 & ADC12BUSY); // wait for conversion to complete
-    uint16_t reading = ADC12MEM0;
+    for (i = 0; i < buf_num_seqs; ++i) {
+        below = *vcap < param_capture_brown_out_voltage_dl;
+        if (below && !vcap_below_brown_out) {
+            capture_trigger_seq = buf_first_seq[buf_idx] + i;
+            capture_end_seq = capture_end(capture_trigger_seq, buf_first_seq[buf_idx]);
+            capture_trigger_source = CAPTURE_TRIGGER_BROWN_OUT;
+            capture_trigger_detail = 0;
+            capture_state = CAPTURE_STATE_TRIGGERED;
+            return;
+        }
+        vcap_below_brown_out = below;
+        vcap += seq_len;
+    }
+}
 
-    ADC12CTL0 &= ~ADC12ON; // turn ADC off
-    return reading;
+/** @brief Buffer completion in capture mode: keep cycling through the ring
+ *         until the samples after the trigger are in, then freeze it */
+static void on_capture_buffer_full()
+{
+    unsigned full_buf_idx = fill_buf_idx;
+    uint16_t end_seq = buf_first_seq[full_buf_idx] + buf_num_seqs;
+
+#ifdef CONFIG_SYSTICK_32BIT
+    buf_end_time[full_buf_idx] = SYSTICK_CURRENT_TIME;
+#endif
+
+    // The buffer the DMA has moved on to is the oldest, so it is lost
+    if (num_full_bufs < NUM_BUFFERS - 1)
+        num_full_bufs++;
+
+    if (capture_state == CAPTURE_STATE_ARMED &&
+        (param_capture_triggers & CAPTURE_TRIGGER_BROWN_OUT) &&
+        (stream_mask & STREAM_VCAP))
+        detect_brown_out(full_buf_idx);
+
+    if (capture_state == CAPTURE_STATE_TRIGGERED &&
+        (int16_t)(end_seq - capture_end_seq) >= 0) {
+        ADC12CTL0 &= ~ADC12ENC;
+        DMA(DMA_ADC_VOLTAGES, CTL) &= ~DMAEN;
+        DMA(DMA_ADC_TIMESTAMPS, CTL) &= ~DMAEN;
+
+        capture_buf_idx = full_buf_idx;
+        capture_state = CAPTURE_STATE_READY;
+        main_loop_flags |= FLAG_ADC_COMPLETE;
+        return;
+    }
+
+    fill_buf_idx = reload_buf_idx; // the DMA has already moved on to it
+    buf_first_seq[fill_buf_idx] = end_seq;
+
+    // Nothing is waiting to be sent, so always move on around the ring
+    reload_buf_idx = fill_buf_idx + 1;
+    if (reload_buf_idx == NUM_BUFFERS)
+        reload_buf_idx = 0;
 }
 
+void ADC_trigger_capture(unsigned source, unsigned detail)
+{
+    unsigned remaining;
+    uint16_t seq, buf_start_seq;
+
+    if (capture_state != CAPTURE_STATE_ARMED || !(param_capture_triggers & source))
+        return;
+
+#ifdef CONFIG_SYSTICK
+    capture_trigger_time = SYSTICK_CURRENT_TIME;
+#else
+    capture_trigger_time = TA2R; // same counter as the sample timestamps
+#endif
+
+    // The next sequence to complete is the first one from the trigger on.
+    // If the buffer just completed but its ISR has not run yet, the DMA
+    // counter has already started over for the next buffer; a counter that
+    // is nearly done means it completed between the two reads instead.
+    remaining = DMA(DMA_ADC_TIMESTAMPS, SZ);
+    buf_start_seq = buf_first_seq[fill_buf_idx];
+    if ((DMA(DMA_ADC_TIMESTAMPS, CTL) & DMAIFG) && remaining > buf_num_seqs / 2)
+        buf_start_seq += buf_num_seqs;
+    seq = buf_start_seq + buf_num_seqs - remaining;
+
+    capture_trigger_seq = seq;
+    capture_end_seq = capture_end(seq, buf_start_seq);
+    capture_trigger_source = source;
+    capture_trigger_detail = detail;
+    capture_state = CAPTURE_STATE_TRIGGERED;
+}
+
+void ADC_on_timestamps_dma()
+{
+    uint8_t *header;
+    unsigned next_buf_idx;
+
+    if (stream_flags & ADC_STREAM_FLAG_CAPTURE) {
+        on_capture_buffer_full();
+        if (capture_state != CAPTURE_STATE_READY)
+            program_reload();
+        return;
+    }
+
+    if (reload_buf_idx == fill_buf_idx) {
+        // The DMA is already overwriting the buffer that just got full
+        overflow_count += buf_num_seqs;
+    } else {
+        header = &sample_msg_bufs[fill_buf_idx][SAMPLE_HEADER_OFFSET];
+        *(uint16_t *)&header[STREAM_DATA_MSG_HEADER_LEN] = overflow_count;
+#ifdef CONFIG_SYSTICK_32BIT
+        buf_end_time[fill_buf_idx] = SYSTICK_CURRENT_TIME;
+#endif
+        num_samples[fill_buf_idx] = buf_num_seqs;
+
+        main_loop_flags |= FLAG_ADC_COMPLETE;
+    }
+
+    fill_buf_idx = reload_buf_idx; // the DMA has already moved on to it
+
+    // Move on to the next buffer in the ring, unless the main loop has not
+    // sent it yet, in which case keep refilling the current one (its samples
+    // are dropped) and try again when it is full.
+    next_buf_idx = fill_buf_idx + 1;
+    if (next_buf_idx == NUM_BUFFERS)
+        next_buf_idx = 0;
+    reload_buf_idx = num_samples[next_buf_idx] ? fill_buf_idx : next_buf_idx;
+
+    program_reload();
+}
+
+#endif // CONFIG_ENABLE_VOLTAGE_STREAM
+
+// Polling session: the channel being converted, restored after ADC_read
+static bool poll_active;
+static unsigned poll_chan_index;
+
+static void poll_configure(unsigned chan_index);
+
+#ifdef CONFIG_ENABLE_ADC_MONITOR
+
+typedef struct {
+    ADC_monitor_cb_t cb; // NULL if the slot is free
+    uint16_t level;
+    uint16_t hysteresis;
+    uint8_t chan_index;
+    uint8_t edges; // see adc_monitor_edge_t
+    bool below; // side of the threshold
+    bool known; // whether 'below' is from a sample
+} adc_monitor_sub_t;
+
+static adc_monitor_sub_t monitor_subs[CONFIG_ADC_MONITOR_SUBSCRIBERS];
+static uint8_t monitor_mem_idx[ADC_MAX_CHANNELS]; // ADC12MEMx of each monitored channel
+static unsigned monitor_seq_len;
+
+/** @brief Whether the ADC is free for the monitor */
+static bool monitor_may_run()
+{
 #ifdef CONFIG_ENABLE_VOLTAGE_STREAM
+    if (stream_mask)
+        return false;
+#endif
+    return !poll_active;
+}
+
+/** @brief Stop the trigger timer of the monitor */
+static void monitor_halt()
+{
+    ADC12IE = 0;
+    TIMER(TIMER_ADC_TRIGGER, CTL) = 0;
+}
+
+/** @brief Configure the ADC to convert each monitored channel in turn
+ *  @details Same timer-triggered repeat-sequence as the voltage stream, one
+ *           conversion per timer edge, but the results are checked by the
+ *           ISR at the end of each sequence instead of moved by the DMA.
+ *           Turns the ADC off if there is nothing to monitor. The caller
+ *           makes sure that the ADC is free (see monitor_may_run).
+ */
+static void monitor_configure()
+{
+    uint16_t chans = 0;
+    volatile uint8_t *ctl_reg = &ADC12MCTL0;
+    unsigned i;
+
+    ADC12CTL0 &= ~ADC12ENC; // disable conversion so we can set control bits
+    monitor_halt();
+
+    for (i = 0; i < CONFIG_ADC_MONITOR_SUBSCRIBERS; ++i)
+        if (monitor_subs[i].cb)
+            chans |= 1 << monitor_subs[i].chan_index;
+
+    if (!chans) {
+        ADC12CTL0 &= ~ADC12ON; // turn ADC off
+        return;
+    }
+
+    ADC12CTL0 = ADC12SHT0_2 + ADC12ON + ADC12REF2_5V + ADC12REFON; // same as ADC_read
+    ADC12CTL1 = ADC12SHP + ADC12CONSEQ_3 + ADC12SHS_2;
+
+    monitor_seq_len = 0;
+    for (i = 0; i < ADC_MAX_CHANNELS; ++i) {
+        if (chans & (1 << i)) {
+            monitor_mem_idx[i] = monitor_seq_len++;
+            *(ctl_reg++) = stream_info[i].chan;
+        }
+    }
+    *(--ctl_reg) |= ADC12EOS;
+
+    ADC12IFG = 0;
+    ADC12IE = 1 << (monitor_seq_len - 1); // end of sequence
+
+    TIMER_CC(TIMER_ADC_TRIGGER, TMRCC_ADC_TRIGGER, CCR) = CONFIG_ADC_MONITOR_PERIOD - 1;
+    TIMER_CC(TIMER_ADC_TRIGGER, TMRCC_ADC_TRIGGER, CCTL) = OUTMOD_3; // set/reset output mode
+    TIMER(TIMER_ADC_TRIGGER, CTL) =
+         TIMER_CLK_SOURCE_BITS(TMRMOD_ADC_TRIGGER, CONFIG_ADC_TIMER_SOURCE_NAME) |
+         TIMER_DIV_BITS(CONFIG_ADC_TIMER_DIV) |
+         MC__UP | TIMER_CLR(TMRMOD_ADC_TRIGGER);
+
+    ADC12CTL0 |= ADC12ENC; // launch: wait for trigger
+}
+
+int ADC_monitor_subscribe(unsigned chan_index, uint16_t level, uint16_t hysteresis,
+                          unsigned edges, ADC_monitor_cb_t cb)
+{
+    adc_monitor_sub_t *sub;
+    int id;
+
+    ASSERT(ASSERT_INVALID_ADC_MONITOR_SUB, chan_index < ADC_MAX_CHANNELS && cb);
+
+    for (id = 0; id < CONFIG_ADC_MONITOR_SUBSCRIBERS; ++id)
+        if (!monitor_subs[id].cb)
+            break;
+    if (id == CONFIG_ADC_MONITOR_SUBSCRIBERS)
+        return -1;
+
+    ADC12IE = 0; // the ISR walks the subscribers
+
+    sub = &monitor_subs[id];
+    sub->level = level;
+    sub->hysteresis = hysteresis;
+    sub->chan_index = chan_index;
+    sub->edges = edges;
+    sub->known = false;
+    sub->cb = cb;
+
+    LOG("adc: monitor: sub %u: chan %u level %u hyst %u edges 0x%x\r\n",
+        id, chan_index, level, hysteresis, edges);
+
+    if (monitor_may_run())
+        monitor_configure();
+    return id;
+}
+
+void ADC_monitor_unsubscribe(int id)
+{
+    ASSERT(ASSERT_INVALID_ADC_MONITOR_SUB, id >= 0 && id < CONFIG_ADC_MONITOR_SUBSCRIBERS);
+
+    ADC12IE = 0;
+    monitor_subs[id].cb = NULL;
+
+    if (monitor_may_run())
+        monitor_configure();
+}
+
+/** @brief Check the latest sample against a threshold
+ *  @details The side of the threshold changes once the sample is more than
+ *           the hysteresis away from the level. A subscriber for one edge
+ *           starts on the other side, so that it fires right away if the
+ *           level is already crossed; one for both edges starts on the side
+ *           of its first sample.
+ */
+static void monitor_check(unsigned id, adc_monitor_sub_t *sub, uint16_t value)
+{
+    bool below;
+
+    if (!sub->known) {
+        sub->known = true;
+        if (sub->edges == ADC_MONITOR_EDGE_ANY)
+            sub->below = value < sub->level;
+        else
+            sub->below = sub->edges == ADC_MONITOR_EDGE_RISING;
+    }
+
+    if (sub->below)
+        below = value <= sub->level + sub->hysteresis;
+    else
+        below = value + sub->hysteresis < sub->level;
+
+    if (below == sub->below)
+        return;
+    sub->below = below;
+
+    if (sub->edges & (below ? ADC_MONITOR_EDGE_FALLING : ADC_MONITOR_EDGE_RISING))
+        sub->cb(id, below);
+}
 
 #if defined(__TI_COMPILER_VERSION__) || defined(__IAR_SYSTEMS_ICC__)
-#pragma vector = ADC12_VECTOR
+#pragma vector=ADC12_VECTOR
 __interrupt void ADC12_ISR(void)
 #elif defined(__GNUC__)
-void __attribute__ ((interrupt(ADC12_VECTOR))) ADC12_ISR (void)
+void __attribute__ ((interrupt(ADC12_VECTOR))) ADC12_ISR(void)
 #else
 #error Compiler not supported!
 #endif
 {
-    uint32_t timestamp;
+    uint16_t values[ADC_MAX_CHANNELS];
+    adc_monitor_sub_t *sub;
+    unsigned i;
 
-    unsigned current_num_samples = num_samples[sample_buf_idx];
+    // Reading the results clears the flags
+    for (i = 0; i < monitor_seq_len; ++i)
+        values[i] = (&ADC12MEM0)[i];
 
-    uint16_t iv = ADC12IV;
-    ADC12IFG = 0; // clear interrupt flags, since ASSERT enables nesting
+    // A callback may unsubscribe (and reconfigure the ADC), so the samples
+    // are taken first, and a free slot is skipped
+    for (i = 0; i < CONFIG_ADC_MONITOR_SUBSCRIBERS; ++i) {
+        sub = &monitor_subs[i];
+        if (sub->cb)
+            monitor_check(i, sub, values[monitor_mem_idx[sub->chan_index]]);
+    }
+}
 
-    ASSERT(ASSERT_ADC_BUFFER_OVERFLOW, current_num_samples < NUM_BUFFERED_SAMPLES);
+#endif // CONFIG_ENABLE_ADC_MONITOR
 
-#ifdef CONFIG_SYSTICK
-    timestamp = SYSTICK_CURRENT_TIME;
-#else // !CONFIG_SYSTICK
-    timestamp = 0;
-#endif // !CONFIG_SYSTICK
-
-    sample_timestamps_buf[current_num_samples] = timestamp;
-
-    switch(__even_in_range(iv,34))
-    {
-        case ADC12IV_NONE:                         // Vector  0:  No interrupt
-        case ADC12IV_ADC12OVIFG:                   // Vector  2:  ADC overflow
-        case ADC12IV_ADC12TOVIFG:                  // Vector  4:  ADC timing overflow
-            ASSERT(ASSERT_ADC_FAULT, false);
-
-        case ADC12IV_ADC12IFG0:                           // Vector  6:  ADC12IFG0
-            sample_voltages_buf[voltage_sample_offset++] = ADC12MEM0;
-            break;
-        case ADC12IV_ADC12IFG1:                           // Vector  8:  ADC12IFG1
-            sample_voltages_buf[voltage_sample_offset++] = ADC12MEM0;
-            sample_voltages_buf[voltage_sample_offset++] = ADC12MEM1;
-            break;
-        case ADC12IV_ADC12IFG2:                           // Vector 10:  ADC12IFG2
-            sample_voltages_buf[voltage_sample_offset++] = ADC12MEM0;
-            sample_voltages_buf[voltage_sample_offset++] = ADC12MEM1;
-            sample_voltages_buf[voltage_sample_offset++] = ADC12MEM2;
-            break;
-        case ADC12IV_ADC12IFG3:                           // Vector 12:  ADC12IFG3
-            sample_voltages_buf[voltage_sample_offset++] = ADC12MEM0;
-            sample_voltages_buf[voltage_sample_offset++] = ADC12MEM1;
-            sample_voltages_buf[voltage_sample_offset++] = ADC12MEM2;
-            sample_voltages_buf[voltage_sample_offset++] = ADC12MEM3;
-            break;
-        case ADC12IV_ADC12IFG4:                           // Vector 14:  ADC12IFG4
-            sample_voltages_buf[voltage_sample_offset++] = ADC12MEM0;
-            sample_voltages_buf[voltage_sample_offset++] = ADC12MEM1;
-            sample_voltages_buf[voltage_sample_offset++] = ADC12MEM2;
-            sample_voltages_buf[voltage_sample_offset++] = ADC12MEM3;
-            sample_voltages_buf[voltage_sample_offset++] = ADC12MEM4;
-            break;
-        case ADC12IV_ADC12IFG5:
-        case ADC12IV_ADC12IFG6:
-        case ADC12IV_ADC12IFG7:
-        case ADC12IV_ADC12IFG8:
-        case ADC12IV_ADC12IFG9:
-        case ADC12IV_ADC12IFG10:
-        case ADC12IV_ADC12IFG11:
-        case ADC12IV_ADC12IFG12:
-        case ADC12IV_ADC12IFG13:
-        case ADC12IV_ADC12IFG14:
-        default:
-            ASSERT(ASSERT_UNEXPECTED_INTERRUPT, false);
-    }
+/** @brief Give the ADC back to the polling session or the monitor
+ *  @details Called when the ADC becomes free: the end of a stream, a polling
+ *           session, or of an ADC_read that interrupted one of them.
+ */
+static void resume_background()
+{
+    if (poll_active)
+        poll_configure(poll_chan_index);
+#ifdef CONFIG_ENABLE_ADC_MONITOR
+    else if (monitor_may_run())
+        monitor_configure();
+#endif
+}
 
-    // If buffer is full, then swap to the other buffer in the double-buffer pair
-    if (++(num_samples[sample_buf_idx]) == NUM_BUFFERED_SAMPLES) {
+/** @brief Convert one channel repeatedly, as fast as the ADC goes
+ *  @details Repeat-single-channel mode with ADC12MSC: each conversion starts
+ *           as soon as the previous one completes, with no CPU involvement.
+ */
+static void poll_configure(unsigned chan_index)
+{
+    ADC12CTL0 &= ~ADC12ENC; // disable ADC
 
-        sample_buf_idx ^= 1;
-        sample_timestamps_buf = sample_timestamps_bufs[sample_buf_idx];
-        sample_voltages_buf = sample_voltages_bufs[sample_buf_idx];
+    ADC12CTL0 = ADC12SHT0_2 + ADC12MSC + ADC12ON + ADC12REF2_5V + ADC12REFON;
+    ADC12CTL1 = ADC12SHP + ADC12CONSEQ_2; // use sampling timer, repeat-single-channel
+    ADC12MCTL0 = stream_info[chan_index].chan;
+    ADC12IE = 0; // results are polled
+    ADC12IFG = 0;
 
-        voltage_sample_offset = 0;
+    ADC12CTL0 |= ADC12ENC; // enable ADC
+    ADC12CTL0 |= ADC12SC; // start the first conversion, the rest follow
+}
 
-        main_loop_flags |= FLAG_ADC_COMPLETE;
-    }
+void ADC_poll_begin(unsigned chan_index)
+{
+#ifdef CONFIG_ENABLE_ADC_MONITOR
+    monitor_halt(); // paused until the session ends
+#endif
+    poll_chan_index = chan_index;
+    poll_active = true;
+    poll_configure(chan_index);
+}
+
+void ADC_poll_end()
+{
+    poll_active = false;
+
+    ADC12CTL0 &= ~ADC12ENC; // stops at the end of the current conversion
+    while (ADC12CTL1 & ADC12BUSY);
+    ADC12CTL0 &= ~ADC12ON; // turn ADC off
 
-    ADC12CTL0 |= ADC12ENC;
+    resume_background();
+}
+
+uint16_t ADC_read_oversampled(unsigned chan_index, unsigned exponent)
+{
+    uint32_t sum = 0;
+    unsigned num_samples;
+    unsigned i;
+
+    if (exponent > ADC_MAX_OVERSAMPLING)
+        exponent = ADC_MAX_OVERSAMPLING;
+    num_samples = 1 << (2 * exponent);
+
+#ifdef CONFIG_ENABLE_ADC_MONITOR
+    monitor_halt();
+#endif
+    poll_configure(chan_index); // conversions back to back
+
+    for (i = 0; i < num_samples; ++i)
+        sum += ADC_poll_read();
+
+    ADC12CTL0 &= ~ADC12ENC; // stops at the end of the current conversion
+    while (ADC12CTL1 & ADC12BUSY);
+    ADC12CTL0 &= ~ADC12ON; // turn ADC off
+
+    resume_background();
+
+    return sum >> exponent;
+}
+
+uint16_t ADC_read(unsigned chan_index)
+{
+    ADC12CTL0 &= ~ADC12ENC; // disable ADC
+
+    ADC12CTL0 = ADC12SHT0_2 + ADC12ON + ADC12REF2_5V + ADC12REFON; // sampling time, ADC12 on
+    ADC12CTL1 = ADC12SHP + ADC12CONSEQ_0; // use sampling timer, single-channel, single-conversion
+    ADC12MCTL0 = stream_info[chan_index].chan; // set ADC memory control register
+    ADC12IE = 0; // disable interrupt
+
+    ADC12CTL0 |= ADC12ENC; // enable ADC
+
+    // Trigger
+    ADC12CTL0 &= ~ADC12SC;  // 'start conversion' bit must be toggled
+    ADC12CTL0 |= ADC12SC; // start conversion
+
+    while (ADC12CTL1 & ADC12BUSY); // wait for conversion to complete
+    uint16_t reading = ADC12MEM0;
+
+    ADC12CTL0 &= ~ADC12ON; // turn ADC off
+
+    resume_background(); // e.g. read from an ISR during a polling session
+
+    return reading;
 }
-#endif // CONFIG_ENABLE_VOLTAGE_STREAM
 
 #if 0
 #if defined(__TI_COMPILER_VERSION__) || defined(__IAR_SYSTEMS_ICC__)
@@ -2,6 +2,7 @@
 #define ADC_H
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <msp430.h>
 
 /**
@@ -13,11 +14,21 @@
 /**
  * @brief       Configure the 12-bit ADC
  * @param       streams Bitmask of which channels to sample (see stream_t in host_comm.h)
+ * @param       sampling_period Period between samples in ADC timer ticks
+ * @param       flags   Bitmask of stream options (see adc_stream_flag_t in host_comm.h)
+ * @param       divisors Rate divisor for each streamed channel, in stream order:
+ *                      a channel with divisor k is sampled every k sampling periods
+ * @param       num_divisors Number of divisors given, the rest are one
+ * @return      Return code (see return_code_t in host_comm.h): invalid args
+ *              if a capture (ADC_STREAM_FLAG_CAPTURE) has more samples after
+ *              the trigger than the sample buffers hold, and nothing is started
  */
-void ADC_start(uint16_t streams, unsigned sampling_period);
+unsigned ADC_start(uint16_t streams, unsigned sampling_period, unsigned flags,
+               const uint8_t *divisors, unsigned num_divisors);
 
 /**
  * @brief       Stop the ADC conversion and disable the ADC
+ * @details     Sends the samples collected so far to the host.
  */
 void ADC_stop();
 
@@ -30,6 +41,90 @@ void ADC_stop();
  */
 uint16_t ADC_read(unsigned chan_index);
 
+/**
+ * @brief   Blocking read of an ADC channel with more than 12 bits of resolution
+ * @param   chan_index   Permanent index assigned to the ADC channel
+ * @param   exponent     k: accumulate 4^k conversions (at most 4)
+ * @return  Sum of the conversions shifted right by k: a (12 + k)-bit value
+ * @details The conversions run back to back, about 6us each, so the read
+ *          takes 4^k times as long as an ADC_read.
+ */
+uint16_t ADC_read_oversampled(unsigned chan_index, unsigned exponent);
+
+/**
+ * @brief   Begin a polling session on an ADC channel
+ * @param   chan_index   Permanent index assigned to the ADC channel
+ * @details Configures the ADC and the reference once, then converts the
+ *          channel continuously, so that each ADC_poll_read is only a fetch
+ *          of the result. For tight loops that wait for a voltage level,
+ *          where ADC_read would reconfigure the ADC on every iteration.
+ *          The session owns the ADC until ADC_poll_end.
+ */
+void ADC_poll_begin(unsigned chan_index);
+
+/**
+ * @brief   End the polling session and turn the ADC off
+ */
+void ADC_poll_end();
+
+/**
+ * @brief   Read the channel of the polling session
+ * @return  The next ADC12 conversion result
+ * @details Waits for the conversion in progress, which completes every few
+ *          microseconds, so that consecutive reads are never the same sample.
+ */
+static inline uint16_t ADC_poll_read()
+{
+    while (!(ADC12IFG & ADC12IFG0));
+    return ADC12MEM0; // clears the flag
+}
+
+#ifdef CONFIG_ENABLE_ADC_MONITOR
+
+/**
+ * @brief   Edges of a threshold that the ADC monitor reports
+ */
+typedef enum {
+    ADC_MONITOR_EDGE_FALLING    = 0x1, //!< channel went below the level
+    ADC_MONITOR_EDGE_RISING     = 0x2, //!< channel went above the level
+    ADC_MONITOR_EDGE_ANY        = 0x3,
+} adc_monitor_edge_t;
+
+/**
+ * @brief   Callback for a threshold crossing, called from the ADC ISR
+ * @param   id      Subscriber id returned by ADC_monitor_subscribe
+ * @param   below   Whether the channel went below the level (or above it)
+ */
+typedef void (*ADC_monitor_cb_t)(unsigned id, bool below);
+
+/**
+ * @brief   Watch an ADC channel for a threshold crossing in the background
+ * @param   chan_index  Permanent index assigned to the ADC channel
+ * @param   level       Threshold in ADC counts
+ * @param   hysteresis  Distance from the level, in ADC counts, that the
+ *                      channel must move past to cross back
+ * @param   edges       Crossings to report (see adc_monitor_edge_t)
+ * @param   cb          Called on each reported crossing: it may unsubscribe,
+ *                      or set a main loop flag for longer work
+ * @return  Subscriber id, or -1 if all CONFIG_ADC_MONITOR_SUBSCRIBERS are taken
+ * @details The monitored channels are sampled on the ADC trigger timer every
+ *          CONFIG_ADC_MONITOR_PERIOD and checked by the ADC ISR. Several
+ *          subscribers, on the same channel or not, can be active at once.
+ *          The monitor is paused while a voltage stream or a polling session
+ *          has the ADC.
+ */
+int ADC_monitor_subscribe(unsigned chan_index, uint16_t level, uint16_t hysteresis,
+                          unsigned edges, ADC_monitor_cb_t cb);
+
+/**
+ * @brief   Stop watching a threshold
+ * @param   id  Subscriber id returned by ADC_monitor_subscribe
+ * @details May be called from the subscriber's callback.
+ */
+void ADC_monitor_unsubscribe(int id);
+
+#endif // CONFIG_ENABLE_ADC_MONITOR
+
 /**
  * @brief   Send buffered samples to host via UART
  * @details Called by main when the ADC module notifies it that a buffer in the
@@ -37,6 +132,38 @@ uint16_t ADC_read(unsigned chan_index);
  */
 void ADC_send_samples_to_host();
 
+/**
+ * @brief   Handle the completion of a sequence by the voltages DMA channel
+ * @details Called from the DMA ISR. Only enabled when streaming more than
+ *          one channel, to advance the destination of the DMA block.
+ */
+void ADC_on_voltages_dma();
+
+/**
+ * @brief   Handle the completion of a buffer by the timestamps DMA channel
+ * @details Called from the DMA ISR. Swaps the buffers in the double-buffer
+ *          pair and notifies main that a buffer is ready.
+ */
+void ADC_on_timestamps_dma();
+
+/**
+ * @brief   Send the samples collected so far if they have waited too long
+ * @details Called by main on each stream flush tick. The part of the buffer
+ *          that the DMA has filled is sent once it is older than the latency
+ *          bound (see PARAM_STREAM_LATENCY_VOLTAGES).
+ */
+void ADC_on_flush_tick();
+
+/**
+ * @brief   Trigger a capture of the voltage stream
+ * @details Called from the ISRs of debugger events. Ignored unless a capture
+ *          is armed (see ADC_STREAM_FLAG_CAPTURE) and the source is enabled
+ *          (see PARAM_CAPTURE_TRIGGERS).
+ * @param   source  Kind of event (see capture_trigger_t in host_comm.h)
+ * @param   detail  Which event of that kind (e.g. watchpoint index)
+ */
+void ADC_trigger_capture(unsigned source, unsigned detail);
+
 /** @} end ADC12 */
 
 #endif // ADC_H
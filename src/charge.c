@@ -27,13 +27,15 @@ uint16_t charge_adc(uint16_t target)
 
     // Wait for the cap to charge to that voltage
 
-    /* The measured effective period of this loop is roughly 30us ~ 33kHz (out
-     * of 200kHz that the ADC can theoretically do). */
+    /* The period of this loop is the ADC conversion time (one fetch per
+     * conversion of the polling session), so it overshoots by at most that. */
+    ADC_poll_begin(ADC_CHAN_INDEX_VCAP);
     do {
-        cur_voltage = ADC_read(ADC_CHAN_INDEX_VCAP);
+        cur_voltage = ADC_poll_read();
     } while (cur_voltage < target);
 
     GPIO(PORT_CHARGE, OUT) &= ~BIT(PIN_CHARGE); // cut the power supply
+    ADC_poll_end();
 
     return cur_voltage;
 }
@@ -44,13 +46,14 @@ uint16_t discharge_adc(uint16_t target)
 
     GPIO(PORT_DISCHARGE, DIR) |= BIT(PIN_DISCHARGE); // open the discharge "valve"
 
-    /* The measured effective period of this loop is roughly 30us ~ 33kHz (out
-     * of 200kHz that the ADC can theoretically do). */
+    /* The period of this loop is the ADC conversion time (see charge_adc). */
+    ADC_poll_begin(ADC_CHAN_INDEX_VCAP);
     do {
-        cur_voltage = ADC_read(ADC_CHAN_INDEX_VCAP);
+        cur_voltage = ADC_poll_read();
     } while (cur_voltage > target);
 
     GPIO(PORT_DISCHARGE, DIR) &= ~BIT(PIN_DISCHARGE); // close the discharge "valve"
+    ADC_poll_end();
 
     return cur_voltage;
 }
@@ -17,6 +17,11 @@
 #include "main_loop.h"
 #include "tether.h"
 #include "payload.h"
+#include "params.h"
+
+#ifdef CONFIG_ENABLE_ENERGY_ACCOUNTING
+#include "energy.h"
+#endif
 
 #include "codepoint.h"
 
@@ -47,31 +52,21 @@ static uint16_t watchpoints_vcap_snapshot = 0;
 #define NUM_WATCHPOINT_BUFFERS 2
 #define NUM_WATCHPOINT_EVENTS_BUFFERED 16
 
-#define WATCHPOINT_EVENT_BUF_HEADER_SPACE 1 // units of sizeof(watchpoint_event_t)
-#define WATCHPOINT_EVENT_BUF_PAYLOAD_SPACE NUM_WATCHPOINT_EVENTS_BUFFERED // units of sizeof(watchpoint_event_t)
-#define WATCHPOINT_EVENT_BUF_SIZE \
-    (WATCHPOINT_EVENT_BUF_HEADER_SPACE + WATCHPOINT_EVENT_BUF_PAYLOAD_SPACE) // units of sizeof(watchpoint_event_t)
-
-#if STREAM_DATA_MSG_HEADER > WATCHPOINT_EVENT_BUF_HEADER_SPACE
-#error Not enough space for header in event buf: add more units of sizeof(struct watchpoint_event_t)
-#endif
-
-#define WATCHPOINT_EVENT_BUF_HEADER_OFFSET \
-    (WATCHPOINT_EVENT_BUF_HEADER_SPACE * sizeof(watchpoint_event_t) - \
-        (UART_MSG_HEADER_SIZE + STREAM_DATA_MSG_HEADER_LEN))
-
 #ifdef CONFIG_ENABLE_WATCHPOINT_STREAM
+// the message header is sent as a separate segment, see send_watchpoint_events
 static watchpoint_event_t
-watchpoint_events_msg_bufs[NUM_WATCHPOINT_BUFFERS][WATCHPOINT_EVENT_BUF_SIZE];
+watchpoint_events_bufs[NUM_WATCHPOINT_BUFFERS][NUM_WATCHPOINT_EVENTS_BUFFERED];
 
-static watchpoint_event_t *watchpoint_events_bufs[NUM_WATCHPOINT_BUFFERS] = {
-    &watchpoint_events_msg_bufs[0][WATCHPOINT_EVENT_BUF_HEADER_SPACE],
-    &watchpoint_events_msg_bufs[1][WATCHPOINT_EVENT_BUF_HEADER_SPACE]
+static const uint8_t watchpoint_events_header[STREAM_DATA_MSG_HEADER_LEN] = {
+    STREAM_WATCHPOINTS,
+    0, // padding
 };
 
-static unsigned watchpoint_events_count[NUM_WATCHPOINT_BUFFERS];
+// zeroed by the UART once the buffer is out, see on_events_sent
+static volatile unsigned watchpoint_events_count[NUM_WATCHPOINT_BUFFERS];
 static watchpoint_event_t *watchpoint_events_buf;
 static unsigned watchpoint_events_buf_idx;
+static unsigned watchpoint_events_age; // flush ticks the current buffer has had events for
 #endif // CONFIG_ENABLE_WATCHPOINT_STREAM
 
 
@@ -160,6 +155,10 @@ unsigned toggle_breakpoint(breakpoint_type_t type, unsigned index,
                 }
 
                 if (energy_level) {
+                    // On the comparator, not the ADC monitor (unlike ADC
+                    // energy breakpoints, see break_at_vcap_level_adc): the
+                    // level is against cmp_ref, and the pin follows the
+                    // comparator output on both edges.
                     code_energy_breakpoints |= 1 << index;
                     arm_comparator(CMP_OP_CODE_ENERGY_BREAKPOINT, energy_level,
                                    cmp_ref, CMP_EDGE_ANY, COMP_CHAN_VCAP);
@@ -272,19 +271,13 @@ static void swap_buffers()
 #ifdef CONFIG_ENABLE_WATCHPOINT_STREAM
 void init_watchpoint_event_bufs()
 {
-    unsigned i, offset;
-    uint8_t *header;
+    unsigned i;
+
+    UART_wait_tx((uint8_t *)watchpoint_events_bufs, sizeof(watchpoint_events_bufs));
 
     for (i = 0; i < NUM_WATCHPOINT_BUFFERS; ++i) {
         watchpoint_events_count[i] = 0;
 
-        header = (uint8_t *)&watchpoint_events_msg_bufs[i][0] +
-                    UART_MSG_HEADER_SIZE + WATCHPOINT_EVENT_BUF_HEADER_OFFSET;
-        offset = 0;
-        header[offset++] = STREAM_WATCHPOINTS;
-        header[offset++] = 0; // padding
-        ASSERT(ASSERT_INVALID_STREAM_BUF_HEADER, offset == STREAM_DATA_MSG_HEADER_LEN);
-
         // Just for easier diagnostics of problems in the data stream
         memset(watchpoint_events_bufs[i], 0,
                NUM_WATCHPOINT_EVENTS_BUFFERED * sizeof(watchpoint_event_t));
@@ -312,7 +305,8 @@ static void append_watchpoint_event(unsigned index)
 
     if (watchpoint_events_count[watchpoint_events_buf_idx] ==
             NUM_WATCHPOINT_EVENTS_BUFFERED) {// buffer full
-        if (!(main_loop_flags & FLAG_WATCHPOINT_READY)) { // the other buffer is free
+        if (!(main_loop_flags & FLAG_WATCHPOINT_READY) &&
+            !watchpoint_events_count[watchpoint_events_buf_idx ^ 1]) { // the other buffer is free
             swap_buffers();
             // clear error indicator
             GPIO(PORT_LED, OUT) &= ~BIT(PIN_LED_RED);
@@ -328,26 +322,52 @@ static void append_watchpoint_event(unsigned index)
     }
 }
 
+static void on_events_sent(unsigned buf_idx)
+{
+    watchpoint_events_count[buf_idx] = 0; // mark buffer as free
+}
+
 void send_watchpoint_events()
 {
     unsigned ready_events_count;
     unsigned ready_events_buf_idx = watchpoint_events_buf_idx ^ 1; // the other one in the pair
+    UART_segment_t events;
 
     ready_events_count = watchpoint_events_count[ready_events_buf_idx];
 
     LOG("wpts: send buf %u cnt %u\r\n", ready_events_buf_idx, ready_events_count);
 
-    UART_begin_transmission();
+    events.buf = (const uint8_t *)watchpoint_events_bufs[ready_events_buf_idx];
+    events.len = ready_events_count * sizeof(watchpoint_event_t);
+
+    // The buffer is marked as free once the transfer completes
+    UART_queue_segments_to_host(TX_SOURCE_WATCHPOINTS, USB_RSP_STREAM_EVENTS,
+            watchpoint_events_header, sizeof(watchpoint_events_header), &events, 1,
+            on_events_sent, ready_events_buf_idx);
+}
+
+void watchpoints_on_flush_tick()
+{
+    if (!watchpoint_events_count[watchpoint_events_buf_idx]) {
+        watchpoint_events_age = 0;
+        return;
+    }
+
+    if (!param_stream_latency_watchpoints ||
+        ++watchpoint_events_age < param_stream_latency_watchpoints)
+        return;
 
-    // Must use a blocking call in order to mark buffer as free once transfer completes
-    UART_send_msg_to_host(USB_RSP_STREAM_EVENTS,
-            STREAM_DATA_MSG_HEADER_LEN + ready_events_count * sizeof(watchpoint_event_t),
-            (uint8_t *)&watchpoint_events_msg_bufs[ready_events_buf_idx][0] +
-            WATCHPOINT_EVENT_BUF_HEADER_OFFSET);
+    // The other buffer is still waiting to be sent, the events will go out
+    // with the next swap, or it is still going out.
+    if ((main_loop_flags & FLAG_WATCHPOINT_READY) ||
+        watchpoint_events_count[watchpoint_events_buf_idx ^ 1])
+        return;
 
-    UART_end_transmission();
+    __disable_interrupt();
+    swap_buffers();
+    __enable_interrupt();
 
-    watchpoint_events_count[ready_events_buf_idx] = 0; // mark buffer as free
+    watchpoint_events_age = 0;
 }
 #endif // CONFIG_ENABLE_WATCHPOINT_STREAM
 
@@ -384,6 +404,15 @@ void watchpoints_stop_stream()
     LOG("wpts: stop stream\r\n");
 
     disable_watchpoints();
+
+#ifdef CONFIG_ENABLE_WATCHPOINT_STREAM
+    // Final flush: send the buffer waiting to be sent, if any, so that the
+    // swap does not clobber it, then let the main loop send the partial one
+    if (main_loop_flags & FLAG_WATCHPOINT_READY) {
+        main_loop_flags &= ~FLAG_WATCHPOINT_READY;
+        send_watchpoint_events();
+    }
+#endif // CONFIG_ENABLE_WATCHPOINT_STREAM
     swap_buffers();
 }
 
@@ -394,6 +423,9 @@ void handle_codepoint(unsigned index)
         // NOTE: can't encode a zero-based index, because the pulse must
         // trigger the interrupt
         if (watchpoints & (1 << index)) {
+#ifdef CONFIG_ENABLE_ENERGY_ACCOUNTING
+            energy_on_watchpoint(index); // first: reads Vcap closest to the event
+#endif
 #ifdef CONFIG_COLLECT_ENERGY_PROFILE
             // TODO: set and use the flag in watchpoints_vcap_snapshot in sprite-mode too
             uint16_t vcap = ADC_read(ADC_CHAN_INDEX_VCAP);
@@ -401,6 +433,9 @@ void handle_codepoint(unsigned index)
 #endif
 #ifdef CONFIG_ENABLE_WATCHPOINT_STREAM
             append_watchpoint_event(index);
+#endif
+#ifdef CONFIG_ENABLE_VOLTAGE_STREAM
+            ADC_trigger_capture(CAPTURE_TRIGGER_WATCHPOINT, index);
 #endif
         }
 
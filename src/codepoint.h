@@ -24,6 +24,12 @@ void watchpoints_stop_stream();
 void init_watchpoint_event_bufs();
 void send_watchpoint_events();
 
+/** @brief Swap out the current buffer of events if it has waited too long
+ *  @details Called by main on each stream flush tick (see
+ *           PARAM_STREAM_LATENCY_WATCHPOINTS).
+ */
+void watchpoints_on_flush_tick();
+
 void handle_codepoint(unsigned index);
 
 #endif // CODEPOINT_H
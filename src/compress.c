@@ -0,0 +1,111 @@
+#include <stdint.h>
+
+#include "compress.h"
+
+typedef struct {
+    uint8_t *pos;
+    uint8_t *end;
+    uint16_t bits; // pending bits, right-aligned
+    unsigned num_bits; // number of pending bits (less than 8 between calls)
+} bit_writer_t;
+
+/** @brief Append up to 8 bits to the stream
+ *  @return Zero if the output buffer is full
+ */
+static inline int put_bits(bit_writer_t *w, unsigned value, unsigned num_bits)
+{
+    w->bits = (w->bits << num_bits) | value;
+    w->num_bits += num_bits;
+    if (w->num_bits >= 8) {
+        if (w->pos == w->end)
+            return 0;
+        w->num_bits -= 8;
+        *w->pos++ = w->bits >> w->num_bits;
+    }
+    return 1;
+}
+
+/** @brief Append up to 16 bits to the stream */
+static int put_bits_wide(bit_writer_t *w, unsigned value, unsigned num_bits)
+{
+    if (num_bits > 8) {
+        if (!put_bits(w, value >> 8, num_bits - 8))
+            return 0;
+        num_bits = 8;
+    }
+    return put_bits(w, value & ((1 << num_bits) - 1), num_bits);
+}
+
+/** @brief Choose the Rice parameter for a channel: about log2 of the mean */
+static unsigned rice_param(const uint16_t *samples, unsigned count, unsigned num_channels)
+{
+    uint32_t sum = 0;
+    uint32_t n = count - 1;
+    int16_t delta;
+    unsigned k = 0;
+    unsigned i;
+
+    if (n == 0)
+        return 0;
+
+    for (i = 1; i < count; ++i) {
+        delta = samples[i * num_channels] - samples[(i - 1) * num_channels];
+        sum += (uint16_t)((delta << 1) ^ (delta >> 15));
+    }
+
+    while (k < COMPRESS_SAMPLE_BITS && (n << (k + 1)) <= sum)
+        ++k;
+    return k;
+}
+
+unsigned compress_samples(uint8_t *out, unsigned out_size,
+                          const uint16_t *samples, unsigned count, unsigned num_channels)
+{
+    bit_writer_t w = { out, out + out_size, 0, 0 };
+    const uint16_t *chan_samples;
+    unsigned chan, i, k, q;
+    uint16_t zigzag;
+    int16_t delta;
+
+    for (chan = 0; chan < num_channels; ++chan) {
+        chan_samples = &samples[chan];
+
+        k = rice_param(chan_samples, count, num_channels);
+        if (!put_bits(&w, k, COMPRESS_RICE_PARAM_BITS))
+            return 0;
+        if (!put_bits_wide(&w, chan_samples[0], COMPRESS_SAMPLE_BITS))
+            return 0;
+
+        for (i = 1; i < count; ++i) {
+            delta = chan_samples[i * num_channels] - chan_samples[(i - 1) * num_channels];
+            zigzag = (delta << 1) ^ (delta >> 15);
+
+            q = zigzag >> k;
+            if (q >= COMPRESS_RICE_ESCAPE) {
+                if (!put_bits(&w, 0xFF, 8) || !put_bits(&w, 0xFF, 8))
+                    return 0;
+                if (!put_bits_wide(&w, zigzag, COMPRESS_ZIGZAG_BITS))
+                    return 0;
+                continue;
+            }
+
+            while (q >= 7) { // unary ones, in chunks
+                if (!put_bits(&w, 0x7F, 7))
+                    return 0;
+                q -= 7;
+            }
+            if (!put_bits(&w, ((1 << q) - 1) << 1, q + 1)) // ones and the zero
+                return 0;
+            if (k && !put_bits_wide(&w, zigzag & ((1 << k) - 1), k))
+                return 0;
+        }
+    }
+
+    if (w.num_bits) { // flush, padded with zeros
+        if (w.pos == w.end)
+            return 0;
+        *w.pos++ = w.bits << (8 - w.num_bits);
+    }
+
+    return w.pos - out;
+}
@@ -0,0 +1,42 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdint.h>
+
+/**
+ * @defgroup    COMPRESS   Sample compression
+ * @brief       Lossless compression of blocks of ADC samples
+ * @details     Each channel is coded separately (channel-major), as a 4-bit
+ *              Rice parameter, the first sample as is (12 bits), and then the
+ *              zigzag-encoded differences between consecutive samples as Rice
+ *              codes: the quotient in unary (ones terminated by a zero),
+ *              followed by the remainder in 'k' bits. A quotient that reaches
+ *              COMPRESS_RICE_ESCAPE is not terminated and is followed by the
+ *              zigzag value in COMPRESS_ZIGZAG_BITS bits instead. Bits are
+ *              written MSB first, and the last byte is padded with zeros.
+ *
+ *              NOTE: scripts/voltage_stream_codec.py must match this format.
+ * @{
+ */
+
+#define COMPRESS_SAMPLE_BITS        12 //!< bits in a raw sample
+#define COMPRESS_ZIGZAG_BITS        13 //!< bits in a zigzag-encoded difference of samples
+#define COMPRESS_RICE_PARAM_BITS     4 //!< bits in the Rice parameter field
+#define COMPRESS_RICE_ESCAPE        16 //!< unary quotient length that escapes to a raw value
+
+/**
+ * @brief   Compress a block of interleaved multi-channel samples
+ * @param   out             Buffer for the compressed bitstream
+ * @param   out_size        Size of the output buffer: compression is abandoned
+ *                          if the output would not fit
+ * @param   samples         Samples interleaved by channel (sample 0 chan 0..K, ...)
+ * @param   count           Number of samples per channel
+ * @param   num_channels    Number of channels
+ * @return  Length of the compressed block in bytes or zero if it does not fit
+ */
+unsigned compress_samples(uint8_t *out, unsigned out_size,
+                          const uint16_t *samples, unsigned count, unsigned num_channels);
+
+/** @} End COMPRESS */
+
+#endif // COMPRESS_H
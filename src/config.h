@@ -49,6 +49,66 @@
 
 #endif // BOARD_*
 
+/** @brief Size of the circular buffer for bytes received from the host
+ *  @details Filled by DMA, so it must absorb the bytes that arrive while
+ *           the main loop is busy elsewhere (e.g. sending a stream buffer),
+ *           and hold the commands parsed ahead (see CONFIG_HOST_CMD_QUEUE_LEN)
+ *           until they are run. The DMA stops short of them when it is full.
+ */
+#ifndef CONFIG_HOST_UART_RX_BUF_LEN
+#define CONFIG_HOST_UART_RX_BUF_LEN 512 // a full queue of the longest commands
+#endif
+
+/** @brief Longest message data from the host (extended messages may be longer than 255)
+ *  @details Bounds the size of a batch (see USB_CMD_BATCH): 12 reads of
+ *           target memory, at 8 bytes each. The RX buffer holds a full
+ *           command queue of these (see CONFIG_HOST_UART_RX_BUF_LEN).
+ */
+#ifndef CONFIG_HOST_UART_RX_MAX_DATA_LEN
+#define CONFIG_HOST_UART_RX_MAX_DATA_LEN 96
+#endif
+
+/** @brief Messages to the host that can be queued for sending, per source (a power of two)
+ *  @details Each source (see tx_source_t) has its own queue, so that a busy
+ *           stream does not hold up the others while they wait for a slot.
+ */
+#ifndef CONFIG_HOST_UART_TX_QUEUE_LEN
+#define CONFIG_HOST_UART_TX_QUEUE_LEN 4
+#endif
+
+/** @brief Messages to the host that can be queued for sending, of all sources
+ *  @details The queues of the sources draw their descriptors from one pool,
+ *           each up to CONFIG_HOST_UART_TX_QUEUE_LEN of them.
+ */
+#ifndef CONFIG_HOST_UART_TX_POOL_LEN
+#define CONFIG_HOST_UART_TX_POOL_LEN 8
+#endif
+
+/** @brief Bytes a stream may send to the host per round of arbitration, per unit of weight */
+#ifndef CONFIG_HOST_TX_QUANTUM
+#define CONFIG_HOST_TX_QUANTUM 64
+#endif
+
+/** @brief Commands from the host that can be parsed ahead of the one being run (a power of two) */
+#ifndef CONFIG_HOST_CMD_QUEUE_LEN
+#define CONFIG_HOST_CMD_QUEUE_LEN 4
+#endif
+
+/** @brief Size of the reply to a batch of commands (see USB_CMD_BATCH)
+ *  @details Up to 255, the reply keeps the tag of its request (see
+ *           UART_IDENTIFIER_USB_TAGGED).
+ */
+#ifndef CONFIG_HOST_BATCH_REPLY_LEN
+#define CONFIG_HOST_BATCH_REPLY_LEN 255
+#endif
+
+/** @brief Time for the host to confirm a new baud rate (see USB_CMD_SET_BAUD), in ms
+ *  @details Without confirmation, the host UART goes back to the old rate.
+ */
+#ifndef CONFIG_HOST_BAUD_CONFIRM_TIMEOUT_MS
+#define CONFIG_HOST_BAUD_CONFIRM_TIMEOUT_MS 500
+#endif
+
 // #define CONFIG_TIMELOG_TIMER_SOURCE TASSEL__ACLK
 #define CONFIG_TIMELOG_TIMER_SOURCE TASSEL__SMCLK
 
@@ -63,6 +123,19 @@
 
 #define CONFIG_ADC_TIMER_DIV 8
 
+/** @brief Depth of the ring of sample buffers for the voltage stream */
+#ifndef CONFIG_VOLTAGE_STREAM_BUFFERS
+#define CONFIG_VOLTAGE_STREAM_BUFFERS 2
+#endif
+
+/** @brief Sequences per sample buffer of the voltage stream (one message each)
+ *  @details Messages longer than 255 bytes go out with an extended header,
+ *           see UART_IDENTIFIER_USB_EXT.
+ */
+#ifndef CONFIG_VOLTAGE_STREAM_BUF_SAMPLES
+#define CONFIG_VOLTAGE_STREAM_BUF_SAMPLES 32
+#endif
+
 #if defined(CONFIG_ADC_TIMER_SOURCE_ACLK)
 #define CONFIG_ADC_TIMER_SOURCE_NAME ACLK
 #define CONFIG_ADC_TIMER_CLK_FREQ CONFIG_ACLK_FREQ
@@ -79,6 +152,27 @@
 
 #define CONFIG_ADC_TIMER_FREQ (CONFIG_ADC_TIMER_CLK_FREQ / CONFIG_ADC_TIMER_DIV)
 
+/** @brief Period of the stream flush tick in systick timer cycles
+ *  @details Partially filled stream buffers are sent once they have waited
+ *           for their stream's latency bound, counted in these ticks.
+ */
+#ifndef CONFIG_STREAM_FLUSH_INTERVAL
+#define CONFIG_STREAM_FLUSH_INTERVAL 0x8000
+#endif
+
+/** @brief Period between conversions of the ADC threshold monitor in ADC timer ticks
+ *  @details Each conversion is of one monitored channel, so each channel is
+ *           checked once per this period times the number of channels.
+ */
+#ifndef CONFIG_ADC_MONITOR_PERIOD
+#define CONFIG_ADC_MONITOR_PERIOD (CONFIG_ADC_TIMER_FREQ / 20000) // 50us
+#endif
+
+/** @brief Max number of thresholds registered with the ADC threshold monitor */
+#ifndef CONFIG_ADC_MONITOR_SUBSCRIBERS
+#define CONFIG_ADC_MONITOR_SUBSCRIBERS 4
+#endif
+
 // Intervals for schedulable actions: time source fixed at ACLK
 #define CONFIG_ENTER_DEBUG_MODE_TIMEOUT   0xff
 #define CONFIG_EXIT_DEBUG_MODE_TIMEOUT    0xff
@@ -86,4 +180,45 @@
 
 #define CONFIG_WATCHPOINT_COLLECTION_TIME 0x1fff
 
+/** @brief RAM of the MCU, in bytes */
+#ifdef BOARD_EDB
+#define CONFIG_RAM_SIZE 6144 // MSP430F5340, see bld/ccs/msp430f5340.ld
+#endif // BOARD_EDB
+
+/** @brief RAM to leave free of static data, for the stack */
+#ifndef CONFIG_STACK_RESERVE
+#define CONFIG_STACK_RESERVE 512
+#endif
+
+// RAM budget: the buffers sized by the options above, and an allowance for
+// the rest of the static data (state, parsers, fixed-size message buffers),
+// so that a configuration that would leave too little RAM for the stack
+// does not build.
+#define RAM_FIXED 1792
+
+#ifdef CONFIG_HOST_UART
+#define RAM_HOST_UART \
+    (CONFIG_HOST_UART_RX_BUF_LEN + CONFIG_HOST_UART_RX_MAX_DATA_LEN + 2 /* RX ring */ + \
+     CONFIG_HOST_UART_TX_POOL_LEN * 36 /* TX descriptors */ + \
+     CONFIG_HOST_CMD_QUEUE_LEN * 16 /* parsed commands */ + \
+     CONFIG_HOST_BATCH_REPLY_LEN)
+#else // !CONFIG_HOST_UART
+#define RAM_HOST_UART 0
+#endif // !CONFIG_HOST_UART
+
+#ifdef CONFIG_ENABLE_VOLTAGE_STREAM
+// Each sample buffer: headers, a 32-bit timestamp and five 16-bit voltages
+// per sequence (see adc.c), then the compressor output and the records
+#define RAM_VOLTAGE_STREAM \
+    (CONFIG_VOLTAGE_STREAM_BUFFERS * (10 + CONFIG_VOLTAGE_STREAM_BUF_SAMPLES * 14) + \
+     CONFIG_VOLTAGE_STREAM_BUF_SAMPLES * 10 + 214)
+#else // !CONFIG_ENABLE_VOLTAGE_STREAM
+#define RAM_VOLTAGE_STREAM 0
+#endif // !CONFIG_ENABLE_VOLTAGE_STREAM
+
+#if defined(CONFIG_RAM_SIZE) && \
+    RAM_FIXED + RAM_HOST_UART + RAM_VOLTAGE_STREAM + CONFIG_STACK_RESERVE > CONFIG_RAM_SIZE
+#error Static data leaves too little RAM for the stack: see CONFIG_STACK_RESERVE and the buffer sizes
+#endif
+
 #endif // CONFIG_H
@@ -0,0 +1,30 @@
+#ifndef CRC16_H
+#define CRC16_H
+
+#include <stdint.h>
+
+/**
+ * @defgroup    CRC16   CRC-16 for host UART frames
+ * @brief       CRC-16/CCITT-FALSE: polynomial 0x1021, initial value 0xFFFF,
+ *              no reflection, no final XOR
+ * @details     Computed a byte at a time with shifts instead of a table. The
+ *              CRC is sent most significant byte first after the data it
+ *              covers, so the CRC of the data followed by its CRC is zero.
+ * @{
+ */
+
+#define CRC16_INIT 0xFFFF
+
+static inline uint16_t crc16_update(uint16_t crc, uint8_t byte)
+{
+    crc = (crc >> 8) | (crc << 8);
+    crc ^= byte;
+    crc ^= (crc & 0xFF) >> 4;
+    crc ^= crc << 12;
+    crc ^= (crc & 0xFF) << 5;
+    return crc;
+}
+
+/** @} End CRC16 */
+
+#endif // CRC16_H
@@ -9,4 +9,8 @@
 #error Compiler not supported!
 #endif
 
+/** @brief DMA trigger source numbers (DMA trigger assignments in the datasheet) */
+#define DMA_TRIG_SRC_ADC12      24 //!< ADC12IFGx: end of sequence in sequence modes
+#define DMA_TRIG_SRC_MASK     0x1f //!< width of the trigger select field
+
 #endif // DMA_H
@@ -0,0 +1,255 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <msp430.h>
+
+#include <libio/log.h>
+
+#include "config.h"
+#include "pin_assign.h"
+#include "host_comm.h"
+#include "uart.h"
+#include "adc.h"
+#include "systick.h"
+#include "params.h"
+#include "ring.h"
+
+#include "energy.h"
+
+#define MAX_WATCHPOINTS     NUM_CODEPOINT_PINS // see codepoint.c
+
+// Energy in nJ = ½ C (Vref / 2^12)² (a1² − a2²), for C in uF, Vref = 2.5 V,
+// and ADC readings a1, a2: ½ * 1e-6 * 6.25 / 2^24 * 1e9 = 3125 / 2^24.
+#define ENERGY_NJ_SCALE     3125
+#define ENERGY_NJ_SHIFT     24
+
+// Watchpoint events from the codepoint ISR, accounted for by the main loop
+#define EVENTS_SIZE         64 // bytes, eight events
+
+#if !RING_SIZE_VALID(EVENTS_SIZE)
+#error Energy accounting event ring size must be a power of two: see EVENTS_SIZE
+#endif
+
+#define REPORT_RECORDS_SIZE 200 // fits a one-byte UART message length
+#define REPORT_MSG_BUF_SIZE \
+    (UART_MSG_HEADER_SIZE + ENERGY_ACCOUNTING_HEADER_LEN + REPORT_RECORDS_SIZE)
+
+typedef struct {
+    uint16_t count;
+    int64_t energy; // nJ, the sum of up to 0xFFFF pairs of about 1e5 nJ each
+    int32_t energy_min;
+    int32_t energy_max;
+    uint32_t time; // systick ticks
+} pair_stats_t;
+
+typedef struct {
+    uint8_t index;
+    bool after_loss; // the events before it were dropped, so it starts no pair
+    uint16_t vcap; // raw ADC reading
+    uint32_t time; // systick ticks
+} event_t;
+
+static bool enabled;
+static pair_stats_t pairs[MAX_WATCHPOINTS][MAX_WATCHPOINTS]; // [from][to]
+
+// The previous event, the start of the next pair
+static bool have_last;
+static unsigned last_index;
+static uint16_t last_vcap;
+static uint32_t last_time;
+
+static unsigned report_age; // flush ticks since the last report
+
+static uint8_t events_buf[EVENTS_SIZE];
+static ring_t events = RING_INIT(events_buf, EVENTS_SIZE);
+static bool events_lost; // the ring was full, tell the next event
+
+static uint8_t report_msg_buf[REPORT_MSG_BUF_SIZE];
+
+static void reset()
+{
+    memset(pairs, 0, sizeof(pairs));
+    have_last = false;
+    report_age = 0;
+    ring_drop(&events, ring_len(&events));
+    events_lost = false;
+}
+
+/** @brief Add the pair that an event ends to the table */
+static void account_event(const event_t *event)
+{
+    pair_stats_t *pair;
+    int32_t v1_sq, v2_sq;
+    int32_t energy;
+    uint32_t time;
+
+    if (event->after_loss)
+        have_last = false;
+
+    if (have_last) {
+        pair = &pairs[last_index][event->index];
+
+        v1_sq = (int32_t)last_vcap * last_vcap;
+        v2_sq = (int32_t)event->vcap * event->vcap;
+        energy = ((int64_t)(v1_sq - v2_sq) * param_energy_capacitance_uf *
+                  ENERGY_NJ_SCALE) >> ENERGY_NJ_SHIFT;
+
+#ifdef CONFIG_SYSTICK_32BIT
+        time = event->time - last_time;
+#else
+        time = (uint16_t)(event->time - last_time); // wraps if longer than the timer period
+#endif
+
+        if (pair->count < 0xFFFF) { // saturate rather than wrap the averages
+            if (!pair->count || energy < pair->energy_min)
+                pair->energy_min = energy;
+            if (!pair->count || energy > pair->energy_max)
+                pair->energy_max = energy;
+            pair->energy += energy;
+            pair->time += time;
+            pair->count++;
+        }
+    }
+
+    have_last = true;
+    last_index = event->index;
+    last_vcap = event->vcap;
+    last_time = event->time;
+}
+
+/** @brief Send the pairs seen so far, in as many messages as it takes
+ *  @details The table is only updated by the main loop (see
+ *           energy_process_events), so it holds still while the report is
+ *           sent: the messages of a report are of the same state of the
+ *           table, even if the main loop waits for the host link between
+ *           them. Events from the codepoint ISR queue up meanwhile, and are
+ *           accounted for afterwards (or dropped if the queue fills up).
+ */
+static void send_report()
+{
+    uint8_t *header = &report_msg_buf[UART_MSG_HEADER_SIZE];
+    uint8_t *records = &header[ENERGY_ACCOUNTING_HEADER_LEN];
+    pair_stats_t *pair;
+    unsigned num_records = 0;
+    unsigned len = 0;
+    unsigned from, to;
+
+    energy_process_events(); // the table as of now
+    UART_wait_tx(report_msg_buf, sizeof(report_msg_buf));
+
+    *(uint16_t *)&header[0] = param_energy_capacitance_uf;
+
+    for (from = 0; from < MAX_WATCHPOINTS; ++from) {
+        for (to = 0; to < MAX_WATCHPOINTS; ++to) {
+            pair = &pairs[from][to];
+            if (!pair->count)
+                continue;
+
+            if (len + ENERGY_ACCOUNTING_RECORD_LEN > REPORT_RECORDS_SIZE) {
+                header[2] = num_records;
+                header[3] = 0; // more to come
+                UART_send_msg_to_host(TX_SOURCE_ENERGY, USB_RSP_ENERGY_ACCOUNTING,
+                                      ENERGY_ACCOUNTING_HEADER_LEN + len, report_msg_buf);
+                UART_wait_tx(report_msg_buf, sizeof(report_msg_buf));
+                num_records = 0;
+                len = 0;
+            }
+
+            records[len++] = from;
+            records[len++] = to;
+            *(uint16_t *)&records[len] = pair->count;
+            len += sizeof(uint16_t);
+            *(int64_t *)&records[len] = pair->energy;
+            len += sizeof(int64_t);
+            *(int32_t *)&records[len] = pair->energy_min;
+            len += sizeof(int32_t);
+            *(int32_t *)&records[len] = pair->energy_max;
+            len += sizeof(int32_t);
+            *(uint32_t *)&records[len] = pair->time;
+            len += sizeof(uint32_t);
+            num_records++;
+        }
+    }
+
+    header[2] = num_records;
+    header[3] = 1; // last message of the report
+    UART_send_msg_to_host(TX_SOURCE_ENERGY, USB_RSP_ENERGY_ACCOUNTING,
+                          ENERGY_ACCOUNTING_HEADER_LEN + len, report_msg_buf);
+
+    report_age = 0;
+}
+
+unsigned energy_accounting(unsigned op)
+{
+    LOG("energy: op %u\r\n", op);
+
+    switch (op) {
+        case ENERGY_ACCOUNTING_OP_DISABLE:
+            enabled = false;
+            systick_stop_flush_tick(FLUSH_TICK_ENERGY);
+            break;
+        case ENERGY_ACCOUNTING_OP_ENABLE:
+            __disable_interrupt(); // the event queue is filled by the codepoint ISR
+            reset();
+            __enable_interrupt();
+            enabled = true;
+            if (param_energy_report_interval)
+                systick_start_flush_tick(FLUSH_TICK_ENERGY);
+            else
+                systick_stop_flush_tick(FLUSH_TICK_ENERGY);
+            break;
+        case ENERGY_ACCOUNTING_OP_RESET:
+            __disable_interrupt();
+            reset();
+            __enable_interrupt();
+            break;
+        case ENERGY_ACCOUNTING_OP_REPORT:
+            send_report();
+            break;
+        default:
+            return RETURN_CODE_INVALID_ARGS;
+    }
+    return RETURN_CODE_SUCCESS;
+}
+
+void energy_on_watchpoint(unsigned index)
+{
+    event_t event;
+
+    if (!enabled || index >= MAX_WATCHPOINTS)
+        return;
+
+    event.time = SYSTICK_CURRENT_TIME;
+    event.vcap = ADC_read(ADC_CHAN_INDEX_VCAP);
+    event.index = index;
+    event.after_loss = events_lost;
+
+    if (ring_free(&events) < sizeof(event)) {
+        events_lost = true;
+        return;
+    }
+    ring_push(&events, (const uint8_t *)&event, sizeof(event));
+    events_lost = false;
+}
+
+void energy_process_events()
+{
+    event_t event;
+
+    while (ring_len(&events) >= sizeof(event)) {
+        ring_pop(&events, (uint8_t *)&event, sizeof(event));
+        account_event(&event);
+    }
+}
+
+void energy_on_flush_tick()
+{
+    if (!enabled || !param_energy_report_interval)
+        return;
+
+    if (++report_age < param_energy_report_interval)
+        return;
+
+    send_report();
+}
@@ -0,0 +1,47 @@
+#ifndef ENERGY_H
+#define ENERGY_H
+
+#include <stdint.h>
+
+/**
+ * @defgroup    ENERGY  Energy accounting
+ * @brief       Energy and time spent between pairs of watchpoints
+ * @details     For each ordered pair of consecutive watchpoint events, the
+ *              energy drawn from the storage capacitor is computed from the
+ *              Vcap readings at the two events, ½C(V1² − V2²), and added up
+ *              on EDB, so that the host gets one small table instead of a
+ *              stream of events.
+ * @{
+ */
+
+/**
+ * @brief   Enable, disable, reset or report the energy accounting
+ * @param   op      Operation (see energy_accounting_op_t in host_comm.h)
+ * @return  Return code (see return_code_t in host_comm.h)
+ */
+unsigned energy_accounting(unsigned op);
+
+/**
+ * @brief   Record a watchpoint event
+ * @details Called from the codepoint ISR. Reads Vcap and the time, and leaves
+ *          the rest to energy_process_events. Events that do not fit in the
+ *          queue are dropped, along with the pair that they would have ended.
+ */
+void energy_on_watchpoint(unsigned index);
+
+/**
+ * @brief   Add the events recorded so far to the table
+ * @details Called by main on each pass of the main loop.
+ */
+void energy_process_events();
+
+/**
+ * @brief   Send the table to the host if the report interval has passed
+ * @details Called by main on each stream flush tick (see
+ *          PARAM_ENERGY_REPORT_INTERVAL).
+ */
+void energy_on_flush_tick();
+
+/** @} End ENERGY */
+
+#endif // ENERGY_H
@@ -0,0 +1,69 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "host_comm.h"
+#include "main_loop.h"
+#include "adc.h"
+#include "charge.h"
+#include "codepoint.h"
+#include "usb_cmd.h"
+
+// Mock of the board operations that commands drive (see usb_cmd.h): the
+// commands run and reply as on the board, against a capacitor that charges
+// and discharges at once, and a target that is always there.
+
+bool target_powered = false;
+
+static uint16_t vcap; // ADC units
+
+uint16_t ADC_read(unsigned chan_index)
+{
+    return chan_index == ADC_CHAN_INDEX_VCAP ? vcap : 0;
+}
+
+uint16_t ADC_read_oversampled(unsigned chan_index, unsigned exponent)
+{
+    return ADC_read(chan_index);
+}
+
+uint16_t charge_adc(uint16_t target)
+{
+    if (vcap < target)
+        vcap = target;
+    return vcap;
+}
+
+uint16_t discharge_adc(uint16_t target)
+{
+    if (vcap > target)
+        vcap = target;
+    return vcap;
+}
+
+void charge_cmp(uint16_t target, comparator_ref_t ref)
+{
+    main_loop_flags |= FLAG_CHARGER_COMPLETE; // as the comparator ISR
+}
+
+void discharge_cmp(uint16_t target, comparator_ref_t ref)
+{
+    main_loop_flags |= FLAG_CHARGER_COMPLETE; // as the comparator ISR
+}
+
+unsigned toggle_breakpoint(breakpoint_type_t type, unsigned index,
+                           uint16_t energy_level, comparator_ref_t cmp_ref, bool enable)
+{
+    return RETURN_CODE_SUCCESS;
+}
+
+unsigned toggle_watchpoint(unsigned index, bool enable, bool vcap_snapshot)
+{
+    return RETURN_CODE_SUCCESS;
+}
+
+void watchpoints_start_stream() { }
+void watchpoints_stop_stream() { }
+
+void reset_state() { }
+void continuous_power_on() { }
+void continuous_power_off() { }
@@ -0,0 +1,212 @@
+/**
+ * @file    Benchmark of the voltage stream compression (see compress.h)
+ * @details Compresses a trace frame by frame, as the stream does with
+ *          ADC_STREAM_FLAG_COMPRESSED, and reports the compression ratio,
+ *          the frames that fell back to packed samples, and the time per
+ *          sample on the host. The trace is a text file in the format of
+ *          scripts/voltage_stream_codec.py: one sample per line, one column
+ *          per channel. Without one, a synthetic intermittent-power trace is
+ *          used (Vcap charging and discharging, Vreg on and off, with noise).
+ *
+ *              compress-bench [trace] [samples per frame]
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
+
+#include "config.h"
+#include "compress.h"
+
+#define MAX_CHANNELS 8
+#define SYNTH_CHANNELS 2
+#define SYNTH_SAMPLES 65536
+#define MIN_BENCH_NS 200000000 // per trace, for a stable time per sample
+
+static uint16_t *samples; // interleaved
+static unsigned num_samples; // per channel
+static unsigned num_channels;
+
+static int load_trace(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char line[256];
+    unsigned cap = 0;
+    unsigned chans;
+    char *p, *end;
+    long value;
+
+    if (!f)
+        return -1;
+
+    while (fgets(line, sizeof(line), f)) {
+        if (num_samples == cap) {
+            cap = cap ? 2 * cap : 4096;
+            samples = realloc(samples, cap * MAX_CHANNELS * sizeof(uint16_t));
+        }
+
+        chans = 0;
+        for (p = line; chans < MAX_CHANNELS; p = end) {
+            while (*p == ',' || *p == ' ' || *p == '\t')
+                ++p;
+            value = strtol(p, &end, 0);
+            if (end == p)
+                break;
+            samples[num_samples * MAX_CHANNELS + chans++] = value & 0x0FFF;
+        }
+        if (!chans)
+            continue;
+        if (num_channels && chans != num_channels) {
+            fprintf(stderr, "%s: %u columns, expected %u\n", path, chans, num_channels);
+            fclose(f);
+            return -1;
+        }
+        num_channels = chans;
+        num_samples++;
+    }
+    fclose(f);
+
+    // compact the rows to the number of channels
+    for (unsigned i = 0; i < num_samples; ++i)
+        memmove(&samples[i * num_channels], &samples[i * MAX_CHANNELS],
+                num_channels * sizeof(uint16_t));
+    return num_samples ? 0 : -1;
+}
+
+static uint32_t lcg_state = 1;
+
+static int noise(int amplitude)
+{
+    lcg_state = lcg_state * 1664525 + 1013904223;
+    return (int)((lcg_state >> 16) % (2 * amplitude + 1)) - amplitude;
+}
+
+static uint16_t adc_clamp(int value)
+{
+    return value < 0 ? 0 : value > 0x0FFF ? 0x0FFF : value;
+}
+
+static void synth_trace()
+{
+    double vcap = 0;
+    int on = 0;
+
+    num_channels = SYNTH_CHANNELS;
+    num_samples = SYNTH_SAMPLES;
+    samples = malloc(num_samples * num_channels * sizeof(uint16_t));
+
+    for (unsigned i = 0; i < num_samples; ++i) {
+        if (!on) {
+            vcap += (3500 - vcap) / 4000; // harvesting
+            if (vcap > 2900)
+                on = 1;
+        } else {
+            vcap -= 0.35; // target running
+            if (vcap < 2300)
+                on = 0;
+        }
+        samples[i * 2 + 0] = adc_clamp((int)vcap + noise(2));
+        samples[i * 2 + 1] = adc_clamp(on ? 2480 + noise(1) : (int)(vcap / 8) + noise(1));
+    }
+}
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned frame_samples = CONFIG_VOLTAGE_STREAM_BUF_SAMPLES;
+    unsigned num_frames, frame, count, packed_len, len;
+    uint64_t raw_bytes = 0, packed_bytes = 0, out_bytes = 0;
+    unsigned fallbacks = 0;
+    uint64_t start, elapsed, reps = 0;
+#ifdef HAVE_TSC
+    uint64_t tsc_start, tsc = 0;
+#endif
+    uint8_t *out;
+
+    if (argc > 1 && strcmp(argv[1], "-")) {
+        if (load_trace(argv[1])) {
+            fprintf(stderr, "cannot read trace: %s\n", argv[1]);
+            return 1;
+        }
+    } else {
+        synth_trace();
+    }
+    if (argc > 2)
+        frame_samples = atoi(argv[2]);
+    if (!frame_samples) {
+        fprintf(stderr, "bad frame size\n");
+        return 1;
+    }
+
+    num_frames = (num_samples + frame_samples - 1) / frame_samples;
+    out = malloc(frame_samples * num_channels * sizeof(uint16_t));
+
+    // Sizes, with the fallback to packed samples as in encode_voltages()
+    for (frame = 0; frame < num_frames; ++frame) {
+        count = num_samples - frame * frame_samples;
+        if (count > frame_samples)
+            count = frame_samples;
+        packed_len = (count * num_channels * 3 + 1) / 2;
+
+        len = compress_samples(out, packed_len - 1,
+                               &samples[frame * frame_samples * num_channels],
+                               count, num_channels);
+        if (!len) {
+            len = packed_len;
+            fallbacks++;
+        }
+        raw_bytes += count * num_channels * sizeof(uint16_t);
+        packed_bytes += packed_len;
+        out_bytes += len;
+    }
+
+    // Time, over as many passes as it takes
+    start = now_ns();
+    do {
+#ifdef HAVE_TSC
+        tsc_start = __rdtsc();
+#endif
+        for (frame = 0; frame < num_frames; ++frame) {
+            count = num_samples - frame * frame_samples;
+            if (count > frame_samples)
+                count = frame_samples;
+            compress_samples(out, (count * num_channels * 3 + 1) / 2 - 1,
+                             &samples[frame * frame_samples * num_channels],
+                             count, num_channels);
+        }
+#ifdef HAVE_TSC
+        tsc += __rdtsc() - tsc_start;
+#endif
+        reps++;
+        elapsed = now_ns() - start;
+    } while (elapsed < MIN_BENCH_NS);
+
+    printf("trace: %u samples x %u channels, %u frames of %u samples\n",
+           num_samples, num_channels, num_frames, frame_samples);
+    printf("compressed: %llu bytes, ratio %.2f vs raw, %.2f vs packed, %u/%u frames fell back\n",
+           (unsigned long long)out_bytes, (double)raw_bytes / out_bytes,
+           (double)packed_bytes / out_bytes, fallbacks, num_frames);
+    printf("host time: %.1f ns/sample", (double)elapsed / (reps * num_samples * num_channels));
+#ifdef HAVE_TSC
+    printf(", %.1f TSC cycles/sample", (double)tsc / (reps * num_samples * num_channels));
+#endif
+    printf("\n");
+
+    free(out);
+    free(samples);
+    return 0;
+}
@@ -0,0 +1,14 @@
+#ifndef HOST_LIBIO_LOG_H
+#define HOST_LIBIO_LOG_H
+
+/** @file   Mock of the logging macros of libio: to stderr in the host build */
+
+#include <stdio.h>
+
+#define LOG(...) fprintf(stderr, __VA_ARGS__)
+#define PRINTF(...) fprintf(stderr, __VA_ARGS__)
+#define BLOCK_LOG(...) fprintf(stderr, __VA_ARGS__)
+#define BLOCK_LOG_BEGIN()
+#define BLOCK_LOG_END()
+
+#endif // HOST_LIBIO_LOG_H
@@ -0,0 +1,10 @@
+#ifndef HOST_LIBMSP_CLOCK_H
+#define HOST_LIBMSP_CLOCK_H
+
+/** @file   Mock of the clock configuration of libmsp, for the host build */
+
+#define CONFIG_MCLK_FREQ 24000000
+#define CONFIG_SMCLK_FREQ 24000000
+#define CONFIG_ACLK_FREQ 32768
+
+#endif // HOST_LIBMSP_CLOCK_H
@@ -0,0 +1,39 @@
+#ifndef HOST_LIBMSP_PERIPH_H
+#define HOST_LIBMSP_PERIPH_H
+
+/** @file   Mock of the peripheral name macros of libmsp, for the host build */
+
+#define CONCAT_INNER(a, b) a ## b
+#define CONCAT(a, b) CONCAT_INNER(a, b)
+
+#define BIT_INNER(idx) BIT ## idx
+#define BIT(idx) BIT_INNER(idx)
+
+#define GPIO_INNER(port, reg) P ## port ## reg
+#define GPIO(port, reg) GPIO_INNER(port, reg)
+
+#define UART_INNER(idx, reg) UCA ## idx ## reg
+#define UART(idx, reg) UART_INNER(idx, reg)
+
+// Modulation fields of the UCAxMCTL register
+#define BRS_BITS(brs) ((brs) << 1)
+#define BRF_BITS(brf) ((brf) << 4)
+
+#define DMA_INNER(idx, reg) DMA ## idx ## reg
+#define DMA(idx, reg) DMA_INNER(idx, reg)
+
+#define DMA_CTL_INNER(idx) DMACTL ## idx
+#define DMA_CTL(idx) DMA_CTL_INNER(idx)
+
+#define DMA_INTFLAG_INNER(idx) DMAIV_DMA ## idx ## IFG
+#define DMA_INTFLAG(idx) DMA_INTFLAG_INNER(idx)
+
+// Trigger select field of a channel in its (shared) control register
+#define DMA_TRIG(ch, trig) ((trig) << (8 * ((ch) & 1)))
+
+// USCI_A0 RX/TX: 16/17, USCI_A1 RX/TX: 20/21
+#define DMA_TRIG_UART_RX 0
+#define DMA_TRIG_UART_TX 1
+#define DMA_TRIG_UART(idx, dir) (16 + 4 * (idx) + CONCAT(DMA_TRIG_UART_, dir))
+
+#endif // HOST_LIBMSP_PERIPH_H
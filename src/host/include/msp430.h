@@ -0,0 +1,107 @@
+#ifndef HOST_MSP430_H
+#define HOST_MSP430_H
+
+/**
+ * @file    Mock of the device header for the host build
+ * @details Registers are plain variables (see host/regs.c) that the
+ *          peripheral model (see host/main.c) reads and writes. Only the
+ *          registers and bits that the host build touches are defined, at
+ *          their values on the MSP430F5340. The interrupt intrinsics hold
+ *          a lock against the peripheral model, which runs the ISRs.
+ */
+
+#include <stdint.h>
+
+#define interrupt(vector) used // ISRs are plain functions called by the model
+
+void host_disable_interrupt();
+void host_enable_interrupt();
+void host_delay_cycles(unsigned long cycles);
+
+#define __disable_interrupt() host_disable_interrupt()
+#define __enable_interrupt() host_enable_interrupt()
+#define __delay_cycles(n) host_delay_cycles(n)
+#define __even_in_range(x, n) (x)
+#define __no_operation()
+#define __bis_SR_register(x)
+#define __bic_SR_register(x)
+#define __bis_SR_register_on_exit(x)
+#define __bic_SR_register_on_exit(x)
+
+#define GIE                 0x0008
+
+#define BIT0                0x0001
+#define BIT1                0x0002
+#define BIT2                0x0004
+#define BIT3                0x0008
+#define BIT4                0x0010
+#define BIT5                0x0020
+#define BIT6                0x0040
+#define BIT7                0x0080
+
+// GPIO
+
+extern volatile uint8_t P3DIR, P3OUT, P3SEL;
+extern volatile uint8_t P4DIR, P4OUT, P4SEL;
+extern volatile uint8_t PJDIR, PJOUT;
+
+// USCI_A in UART mode
+
+extern volatile uint8_t UCA0CTL1, UCA0BR0, UCA0BR1, UCA0MCTL, UCA0STAT;
+extern volatile uint8_t UCA0RXBUF, UCA0TXBUF, UCA0IE, UCA0IFG;
+extern volatile uint16_t UCA0IV;
+extern volatile uint8_t UCA1CTL1, UCA1BR0, UCA1BR1, UCA1MCTL, UCA1STAT;
+extern volatile uint8_t UCA1RXBUF, UCA1TXBUF, UCA1IE, UCA1IFG;
+extern volatile uint16_t UCA1IV;
+
+#define UCSWRST             0x01
+#define UCRXEIE             0x20
+#define UCSSEL__SMCLK       0x80
+#define UCOS16              0x01
+#define UCBUSY              0x01
+#define UCRXERR             0x04
+#define UCOE                0x20
+#define UCRXIE              0x01
+#define UCTXIE              0x02
+#define UCRXIFG             0x01
+#define UCTXIFG             0x02
+
+#define USCI_NONE           0x00
+#define USCI_UCRXIFG        0x02
+#define USCI_UCTXIFG        0x04
+
+// ADC12_A (only read by the inline helpers of adc.h)
+
+extern volatile uint16_t ADC12IFG, ADC12MEM0;
+
+#define ADC12IFG0           0x0001
+
+// DMA: addresses are host pointers
+
+extern volatile uint16_t DMACTL0, DMACTL1, DMACTL2, DMACTL4, DMAIV;
+extern volatile uint16_t DMA0CTL, DMA0SZ;
+extern volatile uintptr_t DMA0SA, DMA0DA;
+extern volatile uint16_t DMA1CTL, DMA1SZ;
+extern volatile uintptr_t DMA1SA, DMA1DA;
+extern volatile uint16_t DMA2CTL, DMA2SZ;
+extern volatile uintptr_t DMA2SA, DMA2DA;
+
+#define DMARMWDIS           0x0001
+
+#define DMAIE               0x0004
+#define DMAIFG              0x0008
+#define DMAEN               0x0010
+#define DMALEVEL            0x0020
+#define DMASRCBYTE          0x0040
+#define DMADSTBYTE          0x0080
+#define DMASRCINCR_0        0x0000
+#define DMASRCINCR_3        0x0300
+#define DMADSTINCR_0        0x0000
+#define DMADSTINCR_3        0x0C00
+#define DMADT_0             0x0000
+
+#define DMAIV_DMA0IFG       0x0002
+#define DMAIV_DMA1IFG       0x0004
+#define DMAIV_DMA2IFG       0x0006
+
+#endif // HOST_MSP430_H
@@ -0,0 +1,416 @@
+/**
+ * @file    Host build of the command and protocol core, linked to a PTY
+ * @details The host UART is modelled on a pseudo-terminal, so that host
+ *          tools connect to its slave device as they do to the FTDI device
+ *          of the board. A peripheral thread plays the part of the USCI and
+ *          of the DMA, and calls the ISRs of uart.c, while the main thread
+ *          runs the main loop. Commands run through the executeUSBCmd of
+ *          the board, against a mock of the board operations (see board.c).
+ */
+
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 600
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/select.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <msp430.h>
+#include <libmsp/periph.h>
+
+#include "pin_assign.h"
+#include "host_comm.h"
+#include "host_cmd.h"
+#include "usb_cmd.h"
+#include "main_loop.h"
+#include "error.h"
+#include "uart.h"
+
+#define POLL_INTERVAL_NS 100000
+#define PTY_CHUNK_LEN 64
+#define UART_BITS_PER_CHAR 10 // start, 8 data, stop
+
+// Unpaced, a chunk must fit next to the longest partial message
+#ifdef CONFIG_HOST_UART_FRAMING
+#define RX_MAX_PARTIAL_LEN (2 * (UART_MSG_HEADER_SIZE + CONFIG_HOST_UART_RX_MAX_DATA_LEN + 2))
+#else
+#define RX_MAX_PARTIAL_LEN (UART_MSG_HEADER_SIZE + CONFIG_HOST_UART_RX_MAX_DATA_LEN)
+#endif
+#if RX_MAX_PARTIAL_LEN + PTY_CHUNK_LEN > CONFIG_HOST_UART_RX_BUF_LEN
+#error Host UART RX buffer too small for the PTY chunks: CONFIG_HOST_UART_RX_BUF_LEN
+#endif
+
+volatile uint16_t main_loop_flags = 0; // bit mask containing bit flags to check in the main loop
+
+void USCI_A0_ISR(void);
+
+static int pty_fd;
+static bool paced = true; // at the configured baud rate, or as fast as the PTY goes
+
+// Interrupts are disabled while this lock is held: by the main thread
+// between __disable_interrupt() and __enable_interrupt(), or by the
+// peripheral thread while it runs an ISR.
+static pthread_mutex_t irq_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t irq_cond = PTHREAD_COND_INITIALIZER;
+static __thread bool irq_disabled;
+static unsigned irq_count; // ISRs run, to wake the main loop
+static bool main_idle; // the main loop is waiting for an ISR
+static int idle_pipe[2]; // wakes the peripheral thread on main_idle, unpaced
+
+void host_disable_interrupt()
+{
+    if (!irq_disabled) {
+        pthread_mutex_lock(&irq_lock);
+        irq_disabled = true;
+    }
+}
+
+void host_enable_interrupt()
+{
+    if (irq_disabled) {
+        irq_disabled = false;
+        pthread_mutex_unlock(&irq_lock);
+    }
+}
+
+void host_delay_cycles(unsigned long cycles)
+{
+    struct timespec ts;
+    uint64_t ns = (uint64_t)cycles * 1000 / (CONFIG_MCLK_FREQ / 1000000);
+
+    ts.tv_sec = ns / 1000000000;
+    ts.tv_nsec = ns % 1000000000;
+    nanosleep(&ts, NULL);
+}
+
+void error(error_t num)
+{
+    fprintf(stderr, "error: %u\n", num);
+    exit(1);
+}
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/** @brief Time on the wire of a number of characters at the current rate */
+static uint64_t link_time_ns(unsigned len)
+{
+    if (!paced)
+        return 0;
+    return (uint64_t)len * UART_BITS_PER_CHAR * 1000000000 / UART_get_host_baud()->baud;
+}
+
+/** @brief Number of bytes from the host to deliver at once */
+static unsigned rx_chunk_len()
+{
+    uint64_t len;
+
+    if (!paced)
+        return PTY_CHUNK_LEN;
+
+    // as many as the wire carries between two polls
+    len = (uint64_t)UART_get_host_baud()->baud * POLL_INTERVAL_NS /
+          (UART_BITS_PER_CHAR * 1000000000ull) + 1;
+    return len < PTY_CHUNK_LEN ? len : PTY_CHUNK_LEN;
+}
+
+/** @brief Deliver bytes from the host, as the RX DMA or the RX interrupt would */
+static void host_uart_rx(const uint8_t *buf, unsigned len)
+{
+    unsigned n;
+
+    while (len) {
+        if (DMA(DMA_HOST_UART_RX, CTL) & DMAEN) {
+            n = len < DMA(DMA_HOST_UART_RX, SZ) ? len : DMA(DMA_HOST_UART_RX, SZ);
+            memcpy((uint8_t *)DMA(DMA_HOST_UART_RX, DA), buf, n);
+            DMA(DMA_HOST_UART_RX, DA) += n;
+            DMA(DMA_HOST_UART_RX, SZ) -= n;
+
+            if (DMA(DMA_HOST_UART_RX, SZ) == 0) {
+                DMA(DMA_HOST_UART_RX, CTL) &= ~DMAEN;
+                DMA(DMA_HOST_UART_RX, CTL) |= DMAIFG;
+                if (DMA(DMA_HOST_UART_RX, CTL) & DMAIE)
+                    UART_on_host_rx_dma();
+            }
+        } else if (UART(UART_HOST, IE) & UCRXIE) {
+            n = 1;
+            UART(UART_HOST, RXBUF) = *buf;
+            UART(UART_HOST, IV) = USCI_UCRXIFG;
+            USCI_A0_ISR();
+            UART(UART_HOST, IV) = USCI_NONE;
+        } else {
+            // nothing is listening: the last byte waits in the UART, and
+            // any before it (or a byte already waiting) are overrun
+            n = len;
+            if ((UART(UART_HOST, IFG) & UCRXIFG) || n > 1)
+                UART(UART_HOST, STAT) |= UCOE;
+            UART(UART_HOST, RXBUF) = buf[n - 1];
+            UART(UART_HOST, IFG) |= UCRXIFG;
+        }
+
+        buf += n;
+        len -= n;
+    }
+}
+
+/**
+ * @brief   Deliver the byte waiting in the UART, once the DMA or the RX
+ *          interrupt takes it (the DMA trigger is on the level)
+ * @return  Whether there was one
+ */
+static bool host_uart_rx_waiting()
+{
+    uint8_t byte;
+
+    if (!(UART(UART_HOST, IFG) & UCRXIFG) ||
+        !((DMA(DMA_HOST_UART_RX, CTL) & DMAEN) || (UART(UART_HOST, IE) & UCRXIE)))
+        return false;
+
+    byte = UART(UART_HOST, RXBUF);
+    UART(UART_HOST, IFG) &= ~UCRXIFG;
+    UART(UART_HOST, STAT) &= ~UCOE; // cleared by the read of RXBUF
+    host_uart_rx(&byte, 1);
+    return true;
+}
+
+// TX transfer in progress, taken whole from the DMA registers
+static const uint8_t *tx_buf;
+static unsigned tx_len, tx_offset;
+static uint64_t tx_done; // when its last byte is off the wire
+
+/** @brief Start the TX transfer that the DMA was given, if any */
+static void host_uart_tx_start(uint64_t now, bool hup)
+{
+    if (!(DMA(DMA_HOST_UART_TX, CTL) & DMAEN))
+        return;
+
+    tx_buf = (const uint8_t *)DMA(DMA_HOST_UART_TX, SA);
+    tx_len = DMA(DMA_HOST_UART_TX, SZ);
+    tx_offset = hup ? tx_len : 0; // no client: as if the cable were unplugged
+    if (tx_done + POLL_INTERVAL_NS < now) // the line was idle
+        tx_done = now;
+    tx_done += link_time_ns(tx_len);
+}
+
+/** @brief Write out the TX transfer, and complete it (and the next) once sent */
+static void host_uart_tx(uint64_t now, bool hup)
+{
+    ssize_t n;
+
+    if (!tx_buf)
+        host_uart_tx_start(now, hup);
+
+    while (tx_buf) {
+        if (tx_offset < tx_len) {
+            n = write(pty_fd, tx_buf + tx_offset, tx_len - tx_offset);
+            if (n > 0)
+                tx_offset += n;
+        }
+        if (tx_offset < tx_len || now < tx_done)
+            break;
+
+        tx_buf = NULL;
+        DMA(DMA_HOST_UART_TX, CTL) &= ~DMAEN;
+        if (DMA(DMA_HOST_UART_TX, CTL) & DMAIE)
+            UART_on_host_tx_dma(); // may chain the next one
+        irq_count++;
+        host_uart_tx_start(now, hup);
+    }
+}
+
+/**
+ * @brief   Model of the host UART and its DMA channels
+ * @details Paced, bytes take their time on the wire in each direction. Not
+ *          paced, bytes from the host are delivered a chunk at a time while
+ *          the main loop is idle, for the host to flood the link without
+ *          overrunning the RX buffer. Either way, the PTY, unlike the UART,
+ *          pushes back on a writer that is ahead of the reader.
+ */
+static void *peripherals(void *arg)
+{
+    struct timespec timeout;
+    fd_set rfds, wfds;
+    uint8_t rx_buf[PTY_CHUNK_LEN], drain[16];
+    uint64_t rx_free = 0, now, wait;
+    bool hup = false, rx_ready;
+    ssize_t n;
+
+    while (1) {
+        now = now_ns();
+
+        host_disable_interrupt();
+        host_uart_tx(now, hup);
+        if (host_uart_rx_waiting())
+            irq_count++;
+        rx_ready = paced ? now >= rx_free : main_idle;
+        host_enable_interrupt();
+
+        // RX: a chunk at a time, each once the previous one is on the wire
+        if (rx_ready) {
+            n = read(pty_fd, rx_buf, rx_chunk_len());
+            hup = n < 0 && errno == EIO; // until a client opens the PTY
+            if (n > 0) {
+                host_disable_interrupt();
+                host_uart_rx_waiting(); // before the bytes after it
+                host_uart_rx(rx_buf, n);
+                irq_count++;
+                main_idle = false;
+                host_enable_interrupt();
+
+                if (rx_free + POLL_INTERVAL_NS < now) // the line was idle
+                    rx_free = now;
+                rx_free += link_time_ns(n);
+            }
+        }
+
+        host_disable_interrupt();
+        pthread_cond_broadcast(&irq_cond);
+        host_enable_interrupt();
+
+        // until the next byte or the next deadline
+        wait = hup ? 10 * POLL_INTERVAL_NS : POLL_INTERVAL_NS;
+        if (tx_buf && tx_offset == tx_len && tx_done > now && tx_done - now < wait)
+            wait = tx_done - now;
+        if (paced && rx_free > now && rx_free - now < wait)
+            wait = rx_free - now;
+        timeout.tv_sec = 0;
+        timeout.tv_nsec = wait;
+        FD_ZERO(&rfds);
+        FD_ZERO(&wfds);
+        if (!hup && (paced ? rx_free <= now + wait : main_idle))
+            FD_SET(pty_fd, &rfds);
+        if (tx_buf && tx_offset < tx_len)
+            FD_SET(pty_fd, &wfds);
+        if (!paced)
+            FD_SET(idle_pipe[0], &rfds);
+        pselect((pty_fd > idle_pipe[0] ? pty_fd : idle_pipe[0]) + 1,
+                &rfds, &wfds, NULL, &timeout, NULL);
+        if (FD_ISSET(idle_pipe[0], &rfds))
+            while (read(idle_pipe[0], drain, sizeof(drain)) > 0);
+    }
+
+    return NULL;
+}
+
+/** @brief Sleep until an ISR runs, as the board does in low-power mode */
+static void wait_for_interrupt(unsigned count)
+{
+    host_disable_interrupt();
+    main_idle = true;
+    if (!paced && write(idle_pipe[1], "", 1) < 0 && errno != EAGAIN) // else already pending
+        perror("pipe");
+    while (irq_count == count)
+        pthread_cond_wait(&irq_cond, &irq_lock);
+    main_idle = false;
+    host_enable_interrupt();
+}
+
+static int open_pty(const char *link)
+{
+    struct termios tio;
+    const char *name;
+    int fd;
+
+    fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0 || grantpt(fd) || unlockpt(fd))
+        return -1;
+    name = ptsname(fd);
+
+    // raw bytes both ways, as on the FTDI device
+    if (tcgetattr(fd, &tio))
+        return -1;
+    cfmakeraw(&tio);
+    if (tcsetattr(fd, TCSANOW, &tio))
+        return -1;
+
+    if (link) {
+        unlink(link);
+        if (symlink(name, link))
+            return -1;
+    }
+
+    printf("%s\n", link ? link : name);
+    fflush(stdout);
+    return fd;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-f] [-l link]\n"
+            "  -f       do not pace the link at its baud rate\n"
+            "  -l link  symlink to create to the PTY (e.g. /tmp/ttyEDB)\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    const char *link = NULL;
+    pthread_t thread;
+    unsigned count;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "fl:")) != -1) {
+        switch (opt) {
+        case 'f':
+            paced = false;
+            break;
+        case 'l':
+            link = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    pty_fd = open_pty(link);
+    if (pty_fd < 0) {
+        perror("pty");
+        return 1;
+    }
+
+    if (pipe(idle_pipe) || fcntl(idle_pipe[0], F_SETFL, O_NONBLOCK) ||
+        fcntl(idle_pipe[1], F_SETFL, O_NONBLOCK)) {
+        perror("pipe");
+        return 1;
+    }
+
+    UART_setup(UART_INTERFACE_USB);
+    host_cmd_init();
+
+    if (pthread_create(&thread, NULL, peripherals, NULL)) {
+        perror("pthread");
+        return 1;
+    }
+
+    while (1) {
+        host_disable_interrupt();
+        count = irq_count;
+        host_enable_interrupt();
+
+        if (main_loop_flags & FLAG_CHARGER_COMPLETE) {
+            main_loop_flags &= ~FLAG_CHARGER_COMPLETE;
+            usb_cmd_charger_complete();
+        }
+
+        if (!host_cmd_poll(executeUSBCmd))
+            wait_for_interrupt(count);
+    }
+
+    return 0;
+}
@@ -0,0 +1,26 @@
+#include <stdint.h>
+
+#include <msp430.h>
+
+// Registers of the mock device (see include/msp430.h), at their reset values
+
+volatile uint8_t P3DIR, P3OUT, P3SEL;
+volatile uint8_t P4DIR, P4OUT, P4SEL;
+volatile uint8_t PJDIR, PJOUT;
+
+volatile uint8_t UCA0CTL1 = UCSWRST, UCA0BR0, UCA0BR1, UCA0MCTL, UCA0STAT;
+volatile uint8_t UCA0RXBUF, UCA0TXBUF, UCA0IE, UCA0IFG = UCTXIFG;
+volatile uint16_t UCA0IV;
+volatile uint8_t UCA1CTL1 = UCSWRST, UCA1BR0, UCA1BR1, UCA1MCTL, UCA1STAT;
+volatile uint8_t UCA1RXBUF, UCA1TXBUF, UCA1IE, UCA1IFG = UCTXIFG;
+volatile uint16_t UCA1IV;
+
+volatile uint16_t ADC12IFG, ADC12MEM0;
+
+volatile uint16_t DMACTL0, DMACTL1, DMACTL2, DMACTL4, DMAIV;
+volatile uint16_t DMA0CTL, DMA0SZ;
+volatile uintptr_t DMA0SA, DMA0DA;
+volatile uint16_t DMA1CTL, DMA1SZ;
+volatile uintptr_t DMA1SA, DMA1DA;
+volatile uint16_t DMA2CTL, DMA2SZ;
+volatile uintptr_t DMA2SA, DMA2DA;
@@ -0,0 +1,117 @@
+/**
+ * @file    Benchmark of the byte ring (see ring.h)
+ * @details Streams bytes through a ring of the size of the host RX buffer,
+ *          one byte at a time (as the UART ISRs do) and in chunks of several
+ *          sizes (as the DMA and the message copies do), and reports the
+ *          time per byte on the host. The producer runs ahead of the consumer
+ *          by half the ring, so that the copies cross the end of the storage.
+ *
+ *              ring-bench
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
+
+#include "config.h"
+#include "ring.h"
+
+#define RING_SIZE CONFIG_HOST_UART_RX_BUF_LEN
+#define MAX_CHUNK 256
+#define MIN_BENCH_NS 200000000 // per chunk size, for a stable time per byte
+
+static uint8_t storage[RING_SIZE];
+static ring_t ring = RING_INIT(storage, RING_SIZE);
+static uint8_t src[MAX_CHUNK], dest[MAX_CHUNK];
+static volatile uint8_t sink; // keeps the byte loop from being optimized out
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/** @brief Push and pop a ring's worth of bytes, in chunks of a size (0: byte by byte) */
+static void pass(unsigned chunk)
+{
+    unsigned done, i;
+    uint8_t sum = 0;
+
+    if (!chunk) {
+        for (done = 0; done < RING_SIZE; ++done) {
+            ring_push_byte(&ring, done);
+            sum += ring_pop_byte(&ring);
+        }
+        sink = sum;
+        return;
+    }
+
+    for (done = 0; done < RING_SIZE; done += chunk) {
+        ring_push(&ring, src, chunk);
+        ring_pop(&ring, dest, chunk);
+    }
+    for (i = 0; i < chunk; i += 16)
+        sum += dest[i];
+    sink = sum;
+}
+
+int main()
+{
+    static const unsigned chunks[] = { 0, 1, 4, 16, 64, MAX_CHUNK };
+    uint64_t start, elapsed, reps;
+#ifdef HAVE_TSC
+    uint64_t tsc_start, tsc;
+#endif
+    unsigned i, chunk;
+
+    for (i = 0; i < MAX_CHUNK; ++i)
+        src[i] = i;
+
+    printf("ring: %u bytes\n", RING_SIZE);
+    for (i = 0; i < sizeof(chunks) / sizeof(chunks[0]); ++i) {
+        chunk = chunks[i];
+
+        // the consumer half a ring behind
+        ring.head = ring.tail = 0;
+        while (ring_len(&ring) < RING_SIZE / 2)
+            ring_push(&ring, src, MAX_CHUNK);
+
+        reps = 0;
+#ifdef HAVE_TSC
+        tsc = 0;
+#endif
+        start = now_ns();
+        do {
+#ifdef HAVE_TSC
+            tsc_start = __rdtsc();
+#endif
+            pass(chunk);
+#ifdef HAVE_TSC
+            tsc += __rdtsc() - tsc_start;
+#endif
+            reps++;
+            elapsed = now_ns() - start;
+        } while (elapsed < MIN_BENCH_NS);
+
+        if (chunk)
+            printf("chunks of %3u: ", chunk);
+        else
+            printf("byte by byte:  ");
+        printf("%.2f ns/byte, %.0f MB/s", (double)elapsed / (reps * RING_SIZE),
+               (double)reps * RING_SIZE * 1000 / elapsed);
+#ifdef HAVE_TSC
+        printf(", %.2f TSC cycles/byte", (double)tsc / (reps * RING_SIZE));
+#endif
+        printf("\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,172 @@
+/**
+ * @file    Unit test of the byte ring (see ring.h)
+ * @details Covers empty and full rings, bulk pushes and pops across the end
+ *          of the storage, and head and tail wrapping around the range of
+ *          an unsigned. Exits non-zero on the first failure.
+ *
+ *              ring-test
+ */
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ring.h"
+
+#define RING_SIZE 16
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: %s: failed: %s\n", __FILE__, __LINE__, test, #cond); \
+            exit(1); \
+        } \
+    } while (0)
+
+static uint8_t storage[RING_SIZE];
+static ring_t ring = RING_INIT(storage, RING_SIZE);
+static const char *test;
+
+/** @brief Empty the ring, with the indexes at a given count */
+static void reset(unsigned start)
+{
+    memset(storage, 0xAA, sizeof(storage));
+    ring.head = start;
+    ring.tail = start;
+}
+
+static void test_empty(unsigned start)
+{
+    uint8_t byte;
+
+    test = "empty";
+    reset(start);
+    CHECK(ring_empty(&ring));
+    CHECK(ring_len(&ring) == 0);
+    CHECK(ring_free(&ring) == RING_SIZE);
+    CHECK(ring_pop(&ring, &byte, 1) == 0);
+    CHECK(ring.head == start);
+}
+
+static void test_full(unsigned start)
+{
+    uint8_t byte = 0;
+    unsigned i;
+
+    test = "full";
+    reset(start);
+    for (i = 0; i < RING_SIZE; ++i)
+        CHECK(ring_push_byte(&ring, i));
+    CHECK(!ring_push_byte(&ring, 0xFF));
+    CHECK(ring_push(&ring, &byte, 1) == 0);
+    CHECK(!ring_empty(&ring));
+    CHECK(ring_len(&ring) == RING_SIZE);
+    CHECK(ring_free(&ring) == 0);
+
+    for (i = 0; i < RING_SIZE; ++i) {
+        CHECK(ring_peek(&ring, 0) == i);
+        CHECK(ring_pop_byte(&ring) == i);
+    }
+    CHECK(ring_empty(&ring));
+    CHECK(ring.head == start + RING_SIZE);
+}
+
+/** @brief Bulk push and pop of every length, from every position in the storage */
+static void test_bulk(unsigned base)
+{
+    uint8_t src[RING_SIZE + 4], dest[RING_SIZE + 4];
+    unsigned offset, len, i, n;
+
+    test = "bulk";
+    for (i = 0; i < sizeof(src); ++i)
+        src[i] = 0x40 + i;
+
+    for (offset = 0; offset < RING_SIZE; ++offset) {
+        for (len = 0; len <= sizeof(src); ++len) {
+            n = len < RING_SIZE ? len : RING_SIZE;
+            reset(base + offset);
+
+            CHECK(ring_push(&ring, src, len) == n);
+            CHECK(ring_len(&ring) == n);
+            for (i = 0; i < n; ++i)
+                CHECK(ring_peek(&ring, i) == src[i]);
+
+            memset(dest, 0, sizeof(dest));
+            CHECK(ring_pop(&ring, dest, sizeof(dest)) == n);
+            CHECK(!memcmp(dest, src, n));
+            CHECK(ring_empty(&ring));
+            CHECK(ring.tail == base + offset + n);
+        }
+    }
+}
+
+/** @brief A push larger than the free space stops at it, and the rest goes after a pop */
+static void test_partial(unsigned start)
+{
+    uint8_t src[2 * RING_SIZE], dest[RING_SIZE];
+    unsigned i;
+
+    test = "partial";
+    for (i = 0; i < sizeof(src); ++i)
+        src[i] = i;
+    reset(start);
+
+    CHECK(ring_push(&ring, src, 10) == 10);
+    CHECK(ring_pop(&ring, dest, 4) == 4);
+    CHECK(!memcmp(dest, src, 4));
+    CHECK(ring_push(&ring, src + 10, RING_SIZE) == 10);
+    CHECK(ring_free(&ring) == 0);
+    CHECK(ring_pop(&ring, dest, 3) == 3);
+    CHECK(!memcmp(dest, src + 4, 3));
+    CHECK(ring_push(&ring, src, RING_SIZE) == 3);
+
+    CHECK(ring_pop(&ring, dest, RING_SIZE) == RING_SIZE);
+    CHECK(!memcmp(dest, src + 7, 13));
+    CHECK(!memcmp(dest + 13, src, 3));
+    CHECK(ring_empty(&ring));
+}
+
+/** @brief A producer that writes the storage directly, as the RX DMA does */
+static void test_publish(unsigned start)
+{
+    unsigned index;
+
+    test = "publish";
+    reset(start);
+    index = ring_index(&ring, 0);
+
+    ring_publish(&ring, index); // nothing written
+    CHECK(ring_empty(&ring));
+
+    index = (index + RING_SIZE - 1) & ring.mask; // all but one byte
+    ring_publish(&ring, index);
+    CHECK(ring_len(&ring) == RING_SIZE - 1);
+    ring_publish(&ring, index); // again: no change
+    CHECK(ring_len(&ring) == RING_SIZE - 1);
+
+    ring_drop(&ring, 5);
+    CHECK(ring_len(&ring) == RING_SIZE - 6);
+    ring_publish(&ring, (index + 3) & ring.mask); // across the end of the storage
+    CHECK(ring_len(&ring) == RING_SIZE - 3);
+    CHECK(ring.tail == start + RING_SIZE + 2);
+}
+
+int main()
+{
+    // from zero, and across the wraparound of the free-running indexes
+    static const unsigned starts[] = { 0, 5, UINT_MAX - RING_SIZE / 2, UINT_MAX };
+    unsigned i;
+
+    for (i = 0; i < sizeof(starts) / sizeof(starts[0]); ++i) {
+        test_empty(starts[i]);
+        test_full(starts[i]);
+        test_bulk(starts[i]);
+        test_partial(starts[i]);
+        test_publish(starts[i]);
+    }
+
+    printf("ring: ok\n");
+    return 0;
+}
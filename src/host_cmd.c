@@ -0,0 +1,120 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "config.h"
+#include "host_comm.h"
+#include "host_comm_impl.h"
+#include "main_loop.h"
+#include "ring.h"
+#include "uart.h"
+
+#include "host_cmd.h"
+
+#if !RING_SIZE_VALID(CONFIG_HOST_CMD_QUEUE_LEN)
+#error Host command queue length must be a power of two: CONFIG_HOST_CMD_QUEUE_LEN
+#endif
+#define HOST_CMD_QUEUE_MASK (CONFIG_HOST_CMD_QUEUE_LEN - 1)
+
+// Commands parsed ahead of the one being run, run in order. Free-running
+// indexes: the command at the head is the next to run.
+static uartPkt_t host_cmds[CONFIG_HOST_CMD_QUEUE_LEN];
+static unsigned host_cmd_head;
+static unsigned host_cmd_tail;
+
+void host_cmd_init()
+{
+    unsigned i;
+
+    for (i = 0; i < CONFIG_HOST_CMD_QUEUE_LEN; ++i)
+        host_cmds[i].processed = 1;
+    host_cmd_head = host_cmd_tail = 0;
+}
+
+bool host_cmd_poll(host_cmd_handler_t *handler)
+{
+    uartPkt_t *pkt;
+    unsigned rc;
+
+    // The RX DMA raises no flag per byte, so check the buffer itself.
+    while (host_cmd_tail - host_cmd_head < CONFIG_HOST_CMD_QUEUE_LEN &&
+           !UART_RxBufEmpty(UART_INTERFACE_USB)) {
+        // we've received bytes from USB
+        main_loop_flags &= ~FLAG_UART_USB_RX; // set by the RX interrupt, if in use
+        pkt = &host_cmds[host_cmd_tail & HOST_CMD_QUEUE_MASK];
+        rc = UART_buildRxPkt(UART_INTERFACE_USB, pkt);
+        if (rc == 1 && pkt->processed)
+            continue; // skipped bytes that were not a message: parse the rest
+        if (rc != 0)
+            break;
+        host_cmd_tail++; // packet is complete
+    }
+
+    if (host_cmd_head == host_cmd_tail)
+        return false;
+
+    pkt = &host_cmds[host_cmd_head & HOST_CMD_QUEUE_MASK];
+    UART_set_reply_tag(pkt->tag);
+    handler(pkt);
+    UART_set_reply_tag(UART_TAG_NONE);
+    host_cmd_head++;
+    return true;
+}
+
+/** @brief Whether a command replies at once (at most once), so that it can be batched */
+static bool batchable(unsigned descriptor)
+{
+    switch (descriptor) {
+    case USB_CMD_SENSE:
+    case USB_CMD_SET_VCAP:
+    case USB_CMD_SET_VBOOST:
+    case USB_CMD_CHARGE:
+    case USB_CMD_DISCHARGE:
+    case USB_CMD_GET_WISP_PC:
+    case USB_CMD_READ_MEM:
+    case USB_CMD_WRITE_MEM:
+    case USB_CMD_CONT_POWER:
+    case USB_CMD_BREAKPOINT:
+    case USB_CMD_WATCHPOINT:
+    case USB_CMD_GET_INTERRUPT_CONTEXT:
+    case USB_CMD_DMA_ECHO:
+    case USB_CMD_ENABLE_TARGET_UART:
+    case USB_CMD_SET_PARAM:
+    case USB_CMD_GET_PARAM:
+    case USB_CMD_GET_TX_STATS:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void host_cmd_run_batch(uartPkt_t *pkt, host_cmd_handler_t *handler)
+{
+    uartPkt_t cmd = { .identifier = pkt->identifier, .tag = pkt->tag };
+    unsigned offset = 0;
+
+    begin_batch_reply();
+
+    while (offset < pkt->length && begin_batch_cmd()) {
+        if (offset + USB_BATCH_CMD_HEADER_LEN > pkt->length ||
+            offset + USB_BATCH_CMD_HEADER_LEN + pkt->data[offset + 1] > pkt->length) {
+            send_return_code(RETURN_CODE_INVALID_ARGS);
+            end_batch_cmd();
+            break;
+        }
+
+        cmd.descriptor = pkt->data[offset];
+        cmd.length = pkt->data[offset + 1];
+        cmd.data = &pkt->data[offset + USB_BATCH_CMD_HEADER_LEN]; // aligned, thanks to the padding
+        offset += USB_BATCH_CMD_HEADER_LEN + ((cmd.length + 1) & ~1);
+
+        if (batchable(cmd.descriptor))
+            handler(&cmd);
+        else
+            send_return_code(RETURN_CODE_UNSUPPORTED);
+
+        if (!end_batch_cmd())
+            break;
+    }
+
+    send_batch_reply();
+}
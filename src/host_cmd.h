@@ -0,0 +1,33 @@
+#ifndef HOST_CMD_H
+#define HOST_CMD_H
+
+#include <stdbool.h>
+
+#include "uart.h"
+
+/**
+ * @brief   Runs a command from the host, replies to it, and marks it processed
+ * @details executeUSBCmd (see usb_cmd.h), on the board and in the host build.
+ */
+typedef void (host_cmd_handler_t)(uartPkt_t *pkt);
+
+/** @brief  Empty the queue of commands from the host */
+void host_cmd_init();
+
+/**
+ * @brief   Parse commands from the host ahead into the queue, and run the next one
+ * @details Replies are tagged with the tag of their command (see
+ *          UART_IDENTIFIER_USB_TAGGED). One command runs per call, so that
+ *          the main loop gets to its other work in between.
+ * @return  Whether a command ran
+ */
+bool host_cmd_poll(host_cmd_handler_t *handler);
+
+/**
+ * @brief   Run the commands in a batch back to back, and reply to all at once
+ * @param   pkt     Packet of the USB_CMD_BATCH (see USB_BATCH for the format)
+ * @param   handler Runs each command in the batch
+ */
+void host_cmd_run_batch(uartPkt_t *pkt, host_cmd_handler_t *handler);
+
+#endif // HOST_CMD_H
@@ -12,7 +12,22 @@
  *              | 0                    | UART identifier       | Identifies the source of the message   |
  *              | 1                    | Message descriptor    | Identifies the message                 |
  *              | 2                    | Length                | Length of the upcoming data            |
- *              | 3 to (2 + length)    | Data                  | Message data (optional)                |
+ *              | 3                    | Length (high byte)    | Zero (padding) unless extended/tagged  |
+ *              | 4 to (3 + length)    | Data                  | Message data (optional)                |
+ *
+ *              An extended message (UART_IDENTIFIER_USB_EXT) has the same
+ *              header, with the high byte of a 16-bit length in place of the
+ *              padding. Messages to the host use it only when the data does
+ *              not fit a one-byte length.
+ *
+ *              A tagged message (UART_IDENTIFIER_USB_TAGGED) carries a tag
+ *              chosen by the host in place of the padding. The debugger queues
+ *              a few commands from the host and runs them in order, and sends
+ *              every reply to a tagged command tagged the same way, including
+ *              replies sent once the command completes later (e.g. after
+ *              USB_CMD_CHARGE_CMP). So the host can keep several commands in
+ *              flight. Streams and other messages the host did not ask for
+ *              are not tagged, nor are replies too long for a one-byte length.
  *
  * @{
  */
@@ -22,12 +37,40 @@
  */
 #define UART_IDENTIFIER_USB                     0xF0
 
+/**
+ * @brief Same as UART_IDENTIFIER_USB, for a message with a 16-bit length
+ */
+#define UART_IDENTIFIER_USB_EXT                 0xF2 // 0xF1 is the target (UART_IDENTIFIER_WISP)
+
+/**
+ * @brief Same as UART_IDENTIFIER_USB, for a request or its reply, with a tag
+ */
+#define UART_IDENTIFIER_USB_TAGGED              0xF3
+
+/**
+ * @defgroup    UART_FRAMING    Framing of host messages
+ * @brief       SLIP framing with a CRC-16 (with CONFIG_HOST_UART_FRAMING)
+ * @details     Each message to and from the host, header included, is
+ *              followed by its CRC-16 (CRC-16/CCITT-FALSE, most significant
+ *              byte first), and the whole is escaped as in SLIP (RFC 1055)
+ *              and delimited by END bytes. A corrupted frame is dropped, and
+ *              the receiver picks up again at the next END, so that a bad
+ *              byte costs one message and not the session.
+ * @{
+ */
+#define UART_SLIP_END                           0xC0
+#define UART_SLIP_ESC                           0xDB
+#define UART_SLIP_ESC_END                       0xDC //!< END in the data, after ESC
+#define UART_SLIP_ESC_ESC                       0xDD //!< ESC in the data, after ESC
+#define UART_FRAME_CRC_LEN                      2
+/** @} End UART_FRAMING */
+
 /**
  * @brief       Message descriptors sent from the computer to
  *              the WISP monitor over the USB interface.
  */
 typedef enum {
-    USB_CMD_SENSE                           = 0x01, //!< Get ADC12 reading of Vcap
+    USB_CMD_SENSE                           = 0x01, //!< Get ADC12 reading of a channel (optionally oversampled 4^k times)
     USB_CMD_STREAM_BEGIN                    = 0x02, //!< Start streaming ADC12 readings continuously
     USB_CMD_STREAM_END                      = 0x03, //!< Stop stream ADC12 readings continuously
     USB_CMD_SET_VCAP                        = 0x04, //!< Inject charge until Vcap has this ADC12 reading, length should be 2
@@ -70,6 +113,10 @@ typedef enum {
     USB_CMD_SET_PARAM                       = 0x44, //!< set a parameter value
     USB_CMD_GET_PARAM                       = 0x45, //!< get a parameter value
     USB_CMD_PERIODIC_PAYLOAD                = 0x46, //!< enable periodic sending of EDB+App data
+    USB_CMD_ENERGY_ACCOUNTING               = 0x47, //!< control energy accounting between watchpoints (energy_accounting_op_t)
+    USB_CMD_BATCH                           = 0x48, //!< run several commands back to back, with one reply (see USB_BATCH)
+    USB_CMD_SET_BAUD                        = 0x49, //!< switch the host UART to a baud rate (uint32), confirmed by the same command at that rate
+    USB_CMD_GET_TX_STATS                    = 0x4A, //!< get the queueing delay of messages to the host per source (uint8: non-zero to reset after reading)
 } usb_cmd_t;
 
 /**
@@ -97,8 +144,55 @@ typedef enum {
     USB_RSP_WATCHPOINT                      = 0x13, //!< watchpoint event info
     USB_RSP_PARAM                           = 0x14, //!< configurable parameter value
     USB_RSP_ENERGY_PROFILE                  = 0x15, //!< collected energy profile
+    USB_RSP_STREAM_VOLTAGES_COMPACT         = 0x16, //!< voltage stream data with a base timestamp and period instead of per-sample timestamps
+    USB_RSP_STREAM_VOLTAGE_STATS            = 0x17, //!< windowed statistics records of a voltage stream
+    USB_RSP_VOLTAGE_CAPTURE                 = 0x18, //!< trigger info of a voltage capture, followed by the stream frames of the capture
+    USB_RSP_STREAM_VOLTAGE_POINTS           = 0x19, //!< send-on-change points of a voltage stream
+    USB_RSP_ENERGY_ACCOUNTING               = 0x1A, //!< energy and time between pairs of watchpoints
+    USB_RSP_BATCH                           = 0x1B, //!< replies to the commands in a USB_CMD_BATCH
+    USB_RSP_TX_STATS                        = 0x1C, //!< queueing delay of messages to the host, one record per source (see TX_STATS_RECORD_LEN)
 } usb_rsp_t;
 
+/**
+ * @defgroup    USB_BATCH   Batch of commands
+ * @brief       Several commands from the host in one message
+ * @details     The data of USB_CMD_BATCH is a sequence of commands, each as:
+ *
+ *              | Byte                 | Description                            |
+ *              | -------------------- | -------------------------------------- |
+ *              | 0                    | Command descriptor (usb_cmd_t)         |
+ *              | 1                    | Length of the command data             |
+ *              | 2 to (1 + length)    | Command data                           |
+ *              | (2 + length)         | Padding, if the length is odd          |
+ *
+ *              The commands run in order, and their replies are collected
+ *              into one USB_RSP_BATCH message, one entry per command:
+ *
+ *              | Byte                 | Description                            |
+ *              | -------------------- | -------------------------------------- |
+ *              | 0                    | Reply descriptor (usb_rsp_t)           |
+ *              | 1                    | Return code (return_code_t)            |
+ *              | 2                    | Length of the reply data               |
+ *              | 3 to (2 + length)    | Reply data                             |
+ *
+ *              A USB_RSP_RETURN_CODE reply has its code in the entry and no
+ *              data; a command with no reply gets RETURN_CODE_SUCCESS. Only
+ *              commands that reply at once can be batched (not e.g. streams,
+ *              debug mode or comparator charging): others get
+ *              RETURN_CODE_UNSUPPORTED. A malformed command (invalid args) or a
+ *              reply that does not fit (buffer too small) ends the batch with
+ *              its entry.
+ *
+ *              A batch is one message, so its data is at most
+ *              CONFIG_HOST_UART_RX_MAX_DATA_LEN bytes (96 by default: e.g.
+ *              12 USB_CMD_READ_MEM at 8 bytes each), and the replies at most
+ *              CONFIG_HOST_BATCH_REPLY_LEN. A longer batch is dropped whole.
+ * @{
+ */
+#define USB_BATCH_CMD_HEADER_LEN                2
+#define USB_BATCH_RSP_HEADER_LEN                3
+/** @} End USB_BATCH */
+
 
 /**
  * @brief Return codes for return code message
@@ -117,6 +211,28 @@ typedef enum {
     PARAM_TEST                              = 0,
     PARAM_TARGET_BOOT_VOLTAGE_DL            = 1, //!< regulated voltage threshold for determinining target is on
     PARAM_TARGET_BOOT_LATENCY_KCYCLES       = 2, //!< time for target to start listening for EDB signals after voltage reaches on threshold
+    PARAM_STREAM_STATS_WINDOW               = 3, //!< samples per window in the voltage statistics stream
+    PARAM_STREAM_STATS                      = 4, //!< bitmask of statistics in the voltage statistics stream (adc_stats_t)
+    PARAM_CAPTURE_PRE_SAMPLES               = 5, //!< samples before the trigger in a voltage capture (as many as the ring still holds)
+    PARAM_CAPTURE_POST_SAMPLES              = 6, //!< samples from the trigger on in a voltage capture (STREAM_BEGIN fails if more than CONFIG_VOLTAGE_STREAM_BUFFERS - 1 buffers)
+    PARAM_CAPTURE_TRIGGERS                  = 7, //!< bitmask of events that trigger a voltage capture (capture_trigger_t)
+    PARAM_CAPTURE_BROWN_OUT_VOLTAGE_DL      = 8, //!< Vcap threshold for the brown-out capture trigger
+    PARAM_STREAM_LATENCY_VOLTAGES           = 9, //!< max latency of voltage stream samples in flush ticks (0: send only full buffers)
+    PARAM_STREAM_LATENCY_RF_EVENTS          = 10, //!< max latency of RF events in flush ticks (0: send only full buffers)
+    PARAM_STREAM_LATENCY_WATCHPOINTS        = 11, //!< max latency of watchpoint events in flush ticks (0: send only full buffers)
+    PARAM_STREAM_DEADBAND                   = 12, //!< change in ADC counts beyond which the voltage deadband stream reports a value
+    PARAM_STREAM_KEEPALIVE                  = 13, //!< sequences after which an unchanged value is reported anyway (0: never)
+    PARAM_STREAM_OVERSAMPLING               = 14, //!< k: 4^k sequences per value in the oversampled voltage stream (1 to 4)
+    PARAM_ENERGY_CAPACITANCE_UF             = 15, //!< storage capacitance of the target for energy accounting, in uF
+    PARAM_ENERGY_REPORT_INTERVAL            = 16, //!< period of energy accounting reports in flush ticks (0: only on request)
+    PARAM_HOST_UART_CRC_ERRORS              = 17, //!< frames from the host dropped for a bad CRC (set to reset)
+    PARAM_HOST_UART_FRAME_ERRORS            = 18, //!< frames from the host dropped for a bad escape, length or header (set to reset)
+    PARAM_HOST_UART_RX_OVERRUNS             = 19, //!< bytes from the host dropped because the RX buffer was full, or runs of them on the RX DMA (set to reset)
+    PARAM_HOST_TX_WEIGHT_VOLTAGES           = 20, //!< share of the host link that the voltage stream gets when streams contend (tx_source_t)
+    PARAM_HOST_TX_WEIGHT_RF_EVENTS          = 21, //!< share of the host link that the RF event stream gets when streams contend
+    PARAM_HOST_TX_WEIGHT_WATCHPOINTS        = 22, //!< share of the host link that the watchpoint stream gets when streams contend
+    PARAM_HOST_TX_WEIGHT_ENERGY             = 23, //!< share of the host link that energy accounting reports get when streams contend
+    PARAM_TARGET_UART_RX_OVERRUNS           = 24, //!< bytes from the target dropped because the RX buffer was full (set to reset)
 } param_t;
 
 /**
@@ -135,12 +251,26 @@ typedef enum {
 
 /**
  * @brief Select which implementation to use for energy breakpoints
+ * @details With the ADC monitor (CONFIG_ENABLE_ADC_MONITOR), the ADC
+ *          implementation runs in the background. The comparator one, and
+ *          the energy level of external breakpoints (see toggle_breakpoint),
+ *          stay on the comparator.
  */
 typedef enum {
     ENERGY_BREAKPOINT_IMPL_ADC              = 0,
     ENERGY_BREAKPOINT_IMPL_CMP              = 1,
 } energy_breakpoint_impl_t;
 
+/**
+ * @brief Operations on the energy accounting between watchpoints
+ */
+typedef enum {
+    ENERGY_ACCOUNTING_OP_DISABLE            = 0,
+    ENERGY_ACCOUNTING_OP_ENABLE             = 1, //!< also resets
+    ENERGY_ACCOUNTING_OP_RESET              = 2,
+    ENERGY_ACCOUNTING_OP_REPORT             = 3, //!< send USB_RSP_ENERGY_ACCOUNTING now
+} energy_accounting_op_t;
+
 /**
  * @brief Specify the initiator who caused target execution to be interrupted
  */
@@ -178,12 +308,76 @@ typedef enum {
     STREAM_WATCHPOINTS                      = 0x0040,
 } stream_t;
 
+/**
+ * @brief Source of a message to the host, for arbitration of the host link
+ * @details Control messages (replies to commands, and notifications such as
+ *          USB_RSP_INTERRUPTED) are sent before any stream data that is
+ *          waiting. The streams share what is left in proportion to their
+ *          weights (PARAM_HOST_TX_WEIGHT_*), counted in bytes. A message is
+ *          never interrupted once it has started.
+ */
+typedef enum {
+    TX_SOURCE_CONTROL                       = 0,
+    TX_SOURCE_VOLTAGES                      = 1, //!< voltage stream, records, and captures
+    TX_SOURCE_RF_EVENTS                     = 2,
+    TX_SOURCE_WATCHPOINTS                   = 3,
+    TX_SOURCE_ENERGY                        = 4, //!< energy accounting reports
+    TX_SOURCE_COUNT                         = 5,
+} tx_source_t;
+
 /**
  * @brief Bitmask that covers all streams that come from the ADC (for convenience)
  */
 #define ADC_STREAMS \
     (STREAM_VCAP | STREAM_VBOOST | STREAM_VREG | STREAM_VRECT | STREAM_VINJ)
 
+/**
+ * @brief Options for voltage streams
+ * @details Bitmask in the optional byte after the sampling period in
+ *          USB_CMD_STREAM_BEGIN. It may be followed by a rate divisor for
+ *          each streamed channel (one byte each, in stream order): a channel
+ *          with divisor k is sampled every k sampling periods (rounded down
+ *          to a power of two, up to 16). Each sample in a frame is then one
+ *          ADC sequence over as many sampling periods as the largest divisor
+ *          (see program_sequence in adc.c for the order of the channels).
+ *          Every period in the sequence has the same number of values, evenly
+ *          spaced, and the periods with fewer channels due are padded with
+ *          repeats of their last value. USB_CMD_STREAM_BEGIN fails with
+ *          RETURN_CODE_INVALID_ARGS if the sampling period is too short for
+ *          the conversions in it, or the sequence too long for the compact
+ *          timestamp.
+ */
+typedef enum {
+    ADC_STREAM_FLAG_COMPACT_TIMESTAMPS      = 0x01, //!< send USB_RSP_STREAM_VOLTAGES_COMPACT frames
+    ADC_STREAM_FLAG_PACKED_SAMPLES          = 0x02, //!< pack two 12-bit samples into three bytes
+    ADC_STREAM_FLAG_COMPRESSED              = 0x04, //!< delta + Rice coded samples, when smaller (see compress.h)
+    ADC_STREAM_FLAG_STATS                   = 0x08, //!< send USB_RSP_STREAM_VOLTAGE_STATS records instead of samples
+    ADC_STREAM_FLAG_CAPTURE                 = 0x10, //!< send only the samples around trigger events (USB_RSP_VOLTAGE_CAPTURE)
+    ADC_STREAM_FLAG_DEADBAND                = 0x20, //!< send USB_RSP_STREAM_VOLTAGE_POINTS only for changed values
+    ADC_STREAM_FLAG_OVERSAMPLE              = 0x40, //!< send (12 + k)-bit values, each from 4^k sequences (see PARAM_STREAM_OVERSAMPLING)
+} adc_stream_flag_t;
+
+/**
+ * @brief Events that trigger a capture of the voltage stream
+ */
+typedef enum {
+    CAPTURE_TRIGGER_WATCHPOINT              = 0x01, //!< detail is the watchpoint index
+    CAPTURE_TRIGGER_ENERGY_BREAKPOINT       = 0x02, //!< comparator energy breakpoint
+    CAPTURE_TRIGGER_BROWN_OUT               = 0x04, //!< Vcap fell below threshold (Vcap must be streamed)
+    CAPTURE_TRIGGER_RFID_CMD                = 0x08, //!< detail is the RFID command code
+} capture_trigger_t;
+
+/**
+ * @brief Statistics computed over each window in the voltage statistics stream
+ * @details Values in a record are in the order of the bits.
+ */
+typedef enum {
+    ADC_STATS_MIN                           = 0x01,
+    ADC_STATS_MAX                           = 0x02,
+    ADC_STATS_MEAN                          = 0x04,
+    ADC_STATS_FILTERED                      = 0x08, //!< low-pass filtered and decimated waveform (see stats.h)
+} adc_stats_t;
+
 typedef enum {
     CMP_REF_VCC                             = 0,
     CMP_REF_VREF_2_5                        = 1,
@@ -260,4 +454,78 @@ typedef enum {
 #error Stream message header size must be aligned to 2
 #endif
 
+/** @brief Voltage stream message header: the common stream header followed by
+ *         the number of samples dropped since the stream began (uint16), the
+ *         stream options that determine the format of the samples
+ *         (adc_stream_flag_t), and the oversampling exponent k.
+ *  @details With ADC_STREAM_FLAG_OVERSAMPLE, each sample is (12 + k) bits and
+ *           stands for 4^k ADC sequences: its timestamp is that of the first
+ *           one, and the period between samples is 4^k times the sequence
+ *           period (the period in compact frames is the sequence period).
+ *           Otherwise k is zero.
+ */
+#define STREAM_VOLTAGES_OVERFLOW_COUNT_LEN  2
+#define STREAM_VOLTAGES_FLAGS_LEN           1
+#define STREAM_VOLTAGES_OVERSAMPLING_LEN    1
+#define STREAM_VOLTAGES_MSG_HEADER_LEN  (STREAM_DATA_MSG_HEADER_LEN + \
+    STREAM_VOLTAGES_OVERFLOW_COUNT_LEN + STREAM_VOLTAGES_FLAGS_LEN + STREAM_VOLTAGES_OVERSAMPLING_LEN)
+
+/** @brief Timestamp section of USB_RSP_STREAM_VOLTAGES_COMPACT
+ *  @details Timestamp of the first sample (uint32), period between samples in
+ *           ADC timer ticks (uint16), and the number of samples dropped right
+ *           before the first sample (uint16, non-zero only after a gap).
+ */
+#define STREAM_VOLTAGES_COMPACT_TIMESTAMP_LEN   8
+
+/** @brief Header of USB_RSP_STREAM_VOLTAGE_STATS after the voltage stream header
+ *  @details Window length in samples (uint16), bitmask of the statistics in
+ *           each record (adc_stats_t), and padding. The sample count in the
+ *           voltage stream header is the number of records. Each record is
+ *           the timestamp of the first sample in the window (uint32) followed
+ *           by the statistics for each channel (uint16 each).
+ */
+#define STREAM_VOLTAGE_STATS_HEADER_LEN     4
+
+/** @brief Header of USB_RSP_STREAM_VOLTAGE_POINTS after the voltage stream header
+ *  @details Deadband in ADC counts (uint16) and keepalive in sequences
+ *           (uint16). The sample count in the voltage stream header is the
+ *           number of points. Each point is the timestamp of the sample
+ *           (uint32) followed by the sample (uint16), with the index of the
+ *           value in the sequence in the top bits.
+ */
+#define STREAM_VOLTAGE_POINTS_HEADER_LEN    4
+#define STREAM_VOLTAGE_POINT_LEN            6
+#define STREAM_VOLTAGE_POINT_INDEX_SHIFT    12
+
+/** @brief Header of USB_RSP_ENERGY_ACCOUNTING
+ *  @details Capacitance in uF (uint16), number of records, and whether this
+ *           is the last message of the report (a report may take several).
+ *           Each record is for a pair of consecutive watchpoint events: the
+ *           index of the first and of the second watchpoint, the number of
+ *           times the pair was seen (uint16, saturates), the total (int64),
+ *           min and max (int32 each) energy consumed between them in nJ
+ *           (negative if the capacitor gained charge), and the total time
+ *           between them in systick ticks (uint32). The messages of a report
+ *           are all of the same state of the table.
+ */
+#define ENERGY_ACCOUNTING_HEADER_LEN        4
+#define ENERGY_ACCOUNTING_RECORD_LEN        26
+
+/** @brief Payload of USB_RSP_VOLTAGE_CAPTURE
+ *  @details Time of the trigger event (uint32), trigger source
+ *           (capture_trigger_t), source detail, number of samples before the
+ *           trigger (uint16), and number of samples from the trigger on
+ *           (uint16). The samples follow in the usual voltage stream frames.
+ */
+#define VOLTAGE_CAPTURE_LEN                 10
+
+/** @brief Record of USB_RSP_TX_STATS, one per source in tx_source_t order
+ *  @details Messages that started since the last reset (uint16, saturates),
+ *           and their mean and max delay from being queued to starting, in
+ *           systick ticks (uint32 each). The delays are zero without
+ *           CONFIG_SYSTICK, and wrap with the 16-bit timer unless
+ *           CONFIG_SYSTICK_32BIT.
+ */
+#define TX_STATS_RECORD_LEN                 10
+
 #endif // HOST_COMM_H
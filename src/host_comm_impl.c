@@ -16,17 +16,77 @@
 #include "host_comm_impl.h"
 
 #define HOST_MSG_BUF_SIZE       64 // buffer for UART messages (to host) for main loop
+#define HOST_MSG_BUFS            2 // so that one can be filled while the other is sent
+
+#if UART_PKT_MAX_DATA_LEN > HOST_MSG_BUF_SIZE - UART_MSG_HEADER_SIZE
+#error Host message buffer too small for the messages forwarded from the target
+#endif
+
+/**
+ * @brief Buffers for messages to host
+ * @details These buffers are used exclusively by main loop, so they are
+ *          shared only in the sense of being multi-plexed in time, i.e. they
+ *          are never used concurrently but to threads of control. They are
+ *          used in turn, so that a message can be queued while the previous
+ *          one is still being sent.
+ */
+static uint8_t host_msg_bufs[HOST_MSG_BUFS][HOST_MSG_BUF_SIZE];
+static unsigned host_msg_buf_idx;
+
+/** @brief Message payload pointer in the buffer being filled */
+static uint8_t *host_msg_payload;
 
 /**
- * @brief Message payload pointer in a buffer for messages to host
- * @details This buffer is used exclusively by main loop, so it is
- *          shared only in the sense of being multi-plexed in time, i.e. it is
- *          never used concurrently but to threads of control.
+ * @brief Reply to a batch of commands (see USB_BATCH)
+ * @details While a batch runs, the replies of its commands are collected
+ *          here as entries instead of being sent, one entry per command.
  */
-static uint8_t host_msg_buf[HOST_MSG_BUF_SIZE];
-static uint8_t * const host_msg_payload = &host_msg_buf[UART_MSG_HEADER_SIZE];
+static uint8_t batch_reply_buf[CONFIG_HOST_BATCH_REPLY_LEN];
+static unsigned batch_reply_len;
+static bool batching;
+static bool batch_entry_done; // the command being run has its entry
+static bool batch_overflow;
+
+// Replies of a command after the first are dropped (batched commands have one)
+static void add_batch_entry(unsigned descriptor, const uint8_t *data, unsigned len)
+{
+    uint8_t *entry = &batch_reply_buf[batch_reply_len];
+
+    if (batch_entry_done)
+        return;
+
+    entry[0] = descriptor;
+    if (descriptor == USB_RSP_RETURN_CODE) {
+        entry[1] = data[0];
+        len = 0;
+    } else if (batch_reply_len + USB_BATCH_RSP_HEADER_LEN + len > CONFIG_HOST_BATCH_REPLY_LEN) {
+        entry[1] = RETURN_CODE_BUFFER_TOO_SMALL;
+        len = 0;
+        batch_overflow = true;
+    } else {
+        entry[1] = RETURN_CODE_SUCCESS;
+        memcpy(&entry[USB_BATCH_RSP_HEADER_LEN], data, len);
+    }
+    entry[2] = len;
+
+    batch_reply_len += USB_BATCH_RSP_HEADER_LEN + len;
+    batch_entry_done = true;
+}
 
-// Uses the main loop host_msg_buf
+/** @brief Take the next buffer, once the message in it (if any) is sent */
+static inline void begin_msg_to_host()
+{
+    uint8_t *buf;
+
+    if (++host_msg_buf_idx == HOST_MSG_BUFS)
+        host_msg_buf_idx = 0;
+    buf = host_msg_bufs[host_msg_buf_idx];
+
+    UART_wait_tx(buf, HOST_MSG_BUF_SIZE);
+    host_msg_payload = &buf[UART_MSG_HEADER_SIZE];
+}
+
+// Uses the buffer taken by begin_msg_to_host
 static inline void send_msg_to_host(unsigned descriptor, unsigned payload_len)
 {
     // Out-of-bound writes already happen before we get here, but the payload
@@ -34,15 +94,19 @@ static inline void send_msg_to_host(unsigned descriptor, unsigned payload_len)
     // this check should be robust even if memory got a little corrupted.
     ASSERT(ASSERT_HOST_MSG_BUF_OVERFLOW, payload_len <= HOST_MSG_BUF_SIZE - UART_MSG_HEADER_SIZE);
 
-    UART_send_msg_to_host(descriptor, payload_len, host_msg_buf);
-    UART_end_transmission();
+    if (batching) {
+        add_batch_entry(descriptor, host_msg_payload, payload_len);
+        return;
+    }
+
+    UART_send_msg_to_host(TX_SOURCE_CONTROL, descriptor, payload_len, host_msg_bufs[host_msg_buf_idx]);
 }
 
 void send_voltage(uint16_t voltage)
 {
     unsigned payload_len = 0;
 
-    UART_begin_transmission();
+    begin_msg_to_host();
 
     host_msg_payload[payload_len++] = voltage & 0xFF;
     host_msg_payload[payload_len++] = (voltage >> 8) & 0xFF;
@@ -53,7 +117,7 @@ void send_voltage(uint16_t voltage)
 void send_return_code(unsigned code)
 {
     unsigned payload_len = 0;
-    UART_begin_transmission();
+    begin_msg_to_host();
     host_msg_payload[payload_len++] = code;
     send_msg_to_host(USB_RSP_RETURN_CODE, payload_len);
 }
@@ -62,7 +126,7 @@ void send_interrupt_context(interrupt_context_t *int_context)
 {
     unsigned payload_len = 0;
 
-    UART_begin_transmission();
+    begin_msg_to_host();
 
     host_msg_payload[payload_len++] = int_context->type;
     host_msg_payload[payload_len++] = int_context->id;
@@ -76,7 +140,7 @@ void send_interrupt_context(interrupt_context_t *int_context)
 void send_param(param_t param)
 {
     unsigned payload_len = 0;
-    UART_begin_transmission();
+    begin_msg_to_host();
 
     host_msg_payload[payload_len++] = param & 0xff;
     host_msg_payload[payload_len++] = (param >> 8) & 0xff;
@@ -89,7 +153,7 @@ void send_param(param_t param)
 void send_echo(uint8_t value)
 {
     unsigned payload_len = 0;
-    UART_begin_transmission();
+    begin_msg_to_host();
     host_msg_payload[payload_len++] = value;
     send_msg_to_host(USB_RSP_ECHO, payload_len);
 }
@@ -101,7 +165,7 @@ void send_payload(payload_t *payload)
     // also called payload.
 
     unsigned payload_len = 0;
-    UART_begin_transmission();
+    begin_msg_to_host();
 
     memcpy(host_msg_payload, payload, sizeof(payload_t));
     payload_len += sizeof(payload_t);
@@ -109,16 +173,65 @@ void send_payload(payload_t *payload)
     send_msg_to_host(USB_RSP_ENERGY_PROFILE, payload_len);
 }
 
-void forward_msg_to_host(unsigned descriptor, uint8_t *buf, unsigned len)
+void send_tx_stats(bool reset)
 {
+    uart_tx_delay_t delays[TX_SOURCE_COUNT];
     unsigned payload_len = 0;
+    unsigned source;
+
+    UART_get_host_tx_delays(delays, reset);
 
-    UART_begin_transmission();
+    begin_msg_to_host();
 
-    while (len--) {
-        host_msg_payload[payload_len] = buf[payload_len];
-        payload_len++;
+    for (source = 0; source < TX_SOURCE_COUNT; ++source) {
+        *(uint16_t *)&host_msg_payload[payload_len] = delays[source].msgs;
+        payload_len += sizeof(uint16_t);
+        *(uint32_t *)&host_msg_payload[payload_len] =
+            delays[source].msgs ? delays[source].total / delays[source].msgs : 0;
+        payload_len += sizeof(uint32_t);
+        *(uint32_t *)&host_msg_payload[payload_len] = delays[source].max;
+        payload_len += sizeof(uint32_t);
     }
 
-    send_msg_to_host(descriptor, payload_len);
+    send_msg_to_host(USB_RSP_TX_STATS, payload_len);
+}
+
+// Copied, so that the target packet can be released at once: the target
+// RX buffer is small, and bytes from the target are dropped while it is full.
+void forward_msg_to_host(unsigned descriptor, uint8_t *buf, unsigned len)
+{
+    begin_msg_to_host();
+    memcpy(host_msg_payload, buf, len);
+    send_msg_to_host(descriptor, len);
+}
+
+void begin_batch_reply()
+{
+    UART_wait_tx(batch_reply_buf, sizeof(batch_reply_buf)); // the previous reply
+    batch_reply_len = 0;
+    batch_overflow = false;
+    batching = true;
+}
+
+bool begin_batch_cmd()
+{
+    batch_entry_done = false;
+    // there is always room for an entry without data, to report an overflow
+    return batch_reply_len + USB_BATCH_RSP_HEADER_LEN <= CONFIG_HOST_BATCH_REPLY_LEN;
+}
+
+bool end_batch_cmd()
+{
+    uint8_t code = RETURN_CODE_SUCCESS;
+
+    add_batch_entry(USB_RSP_RETURN_CODE, &code, sizeof(code)); // unless it replied
+    return !batch_overflow;
+}
+
+void send_batch_reply()
+{
+    UART_segment_t payload = { .buf = batch_reply_buf, .len = batch_reply_len };
+
+    batching = false;
+    UART_queue_segments_to_host(TX_SOURCE_CONTROL, USB_RSP_BATCH, NULL, 0, &payload, 1, NULL, 0);
 }
@@ -2,6 +2,7 @@
 #define HOST_COMM_IMPL_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #include "host_comm.h"
 #include "interrupt.h"
@@ -15,7 +16,16 @@ void send_interrupt_context(interrupt_context_t *int_context);
 void send_param(param_t param);
 void send_echo(uint8_t value);
 void send_payload(payload_t *payload);
+void send_tx_stats(bool reset);
 void forward_msg_to_host(unsigned descriptor, uint8_t *buf, unsigned len);
 
+// Batch of commands (see USB_BATCH): replies of commands run between
+// begin_batch_cmd and end_batch_cmd are collected until send_batch_reply
+
+void begin_batch_reply();
+bool begin_batch_cmd(); // false if there is no room left for another reply
+bool end_batch_cmd(); // false if the reply did not fit
+void send_batch_reply();
+
 #endif
 
@@ -12,6 +12,8 @@
 #include "dev_console.h"
 #include "host_comm.h"
 #include "host_comm_impl.h"
+#include "host_cmd.h"
+#include "usb_cmd.h"
 #include "target_comm_impl.h"
 #include "adc.h"
 #include "uart.h"
@@ -33,6 +35,10 @@
 #include "sched.h"
 #include "delay.h"
 
+#ifdef CONFIG_ENABLE_ENERGY_ACCOUNTING
+#include "energy.h"
+#endif
+
 #ifdef CONFIG_PWM_CHARGING
 #include "pwm.h"
 #endif
@@ -78,7 +84,7 @@ static uint16_t debug_mode_flags = 0; // TODO: set these by decoding serial bits
 static int sig_serial_bit_index; // debug mode flags are serially encoded on the signal line
 #endif
 
-static bool target_powered = false; // user requested continuous power
+bool target_powered = false; // user requested continuous power
 
 #ifdef CONFIG_ENABLE_TARGET_SIDE_DEBUG_MODE
 static unsigned sig_serial_echo_value = 0;
@@ -96,11 +102,7 @@ static bool target_comm_timeout;
 #endif // CONFIG_COLLECT_APP_OUTPUT
 #endif // CONFIG_ENABLE_DEBUG_MODE
 
-static interrupt_context_t interrupt_context;
-
-#ifdef CONFIG_HOST_UART
-static uartPkt_t usbRxPkt = { .processed = 1 };
-#endif
+interrupt_context_t interrupt_context;
 
 static void set_state(state_t new_state)
 {
@@ -117,7 +119,7 @@ static void set_state(state_t new_state)
 /**
  * @brief       Pulse a designated pin for triggering an oscilloscope
  */
-static void trigger_scope()
+void trigger_scope()
 {
     GPIO(PORT_TRIGGER, OUT) |= BIT(PIN_TRIGGER);
     GPIO(PORT_TRIGGER, DIR) |= BIT(PIN_TRIGGER);
@@ -160,13 +162,13 @@ static void mask_target_signal()
 }
 #endif // CONFIG_ENABLE_DEBUG_MODE
 
-static void continuous_power_on()
+void continuous_power_on()
 {
     // The output level was configured high on boot up
     GPIO(PORT_CONT_POWER, DIR) |= BIT(PIN_CONT_POWER);
 }
 
-static void continuous_power_off()
+void continuous_power_off()
 {
     GPIO(PORT_CONT_POWER, DIR) &= ~BIT(PIN_CONT_POWER); // to high-z state
 }
@@ -203,7 +205,7 @@ static inline void stop_serial_decoder()
 }
 #endif // CONFIG_TARGET_SIDE_DEBUG_MODE
 
-static void reset_state()
+void reset_state()
 {
 #ifdef CONFIG_POWER_TARGET_IN_DEBUG_MODE
     continuous_power_off();
@@ -247,7 +249,7 @@ static sched_cmd_t on_target_comm_timeout()
 #endif // CONFIG_ENABLE_DEBUG_MODE
 
 #ifdef CONFIG_ENABLE_DEBUG_MODE
-static void enter_debug_mode(interrupt_type_t int_type, unsigned flags)
+void enter_debug_mode(interrupt_type_t int_type, unsigned flags)
 {
     interrupt_context.type = int_type;
     interrupt_context.id = 0;
@@ -296,17 +298,20 @@ void wait_until_target_is_on()
     LOG("wait for target: v = %u dl, latency = %u kcycles\r\n",
         param_target_boot_voltage_dl, param_target_boot_latency_kcycles);
 
-    /* The measured effective period of this loop is roughly 30us ~ 33kHz (out
-     * of 200kHz that the ADC can theoretically do). */
+    /* The period of this loop is the ADC conversion time (see charge_adc). */
 
-    uint16_t cur_vreg = ADC_read(ADC_CHAN_INDEX_VREG);
+    ADC_poll_begin(ADC_CHAN_INDEX_VREG);
+    uint16_t cur_vreg = ADC_poll_read();
     if (cur_vreg < param_target_boot_voltage_dl) {
         do {
-            cur_vreg = ADC_read(ADC_CHAN_INDEX_VREG);
+            cur_vreg = ADC_poll_read();
         } while (cur_vreg < param_target_boot_voltage_dl);
+        ADC_poll_end();
 
         // Wait for target MCU to boot and starts listening for EDB signals
         delay_kcycles(param_target_boot_latency_kcycles);
+    } else {
+        ADC_poll_end();
     }
 }
 
@@ -323,7 +328,7 @@ void interrupt_target()
 }
 
 #ifdef CONFIG_FETCH_INTERRUPT_CONTEXT
-static void get_target_interrupt_context(interrupt_context_t *int_context)
+void get_target_interrupt_context(interrupt_context_t *int_context)
 {
     // In case target requested the interrupt, ask it for more details
     target_comm_send_get_interrupt_context();
@@ -660,20 +665,39 @@ static inline void pin_setup()
 }
 
 #ifdef CONFIG_ENABLE_DEBUG_MODE
+#ifdef CONFIG_ENABLE_ADC_MONITOR
+static void on_vcap_level(unsigned id, bool below)
+{
+    ADC_monitor_unsubscribe(id); // one-shot, like the comparator implementation
+    enter_debug_mode(INTERRUPT_TYPE_ENERGY_BREAKPOINT, DEBUG_MODE_FULL_FEATURES);
+}
+#endif // CONFIG_ENABLE_ADC_MONITOR
+
 /**
  * @brief	Interrupt WISP and enter active debug mode when Vcap reaches the given level
  * @param   level   Vcap level to interrupt at
- * @details Implemented by continuously sampling Vcap using the ADC
+ * @details Implemented by sampling Vcap using the ADC: in the background by
+ *          the ADC monitor if there is one, otherwise in a polling session
  */
 void break_at_vcap_level_adc(uint16_t level)
 {
-    uint16_t cur_vcap, cur_vreg;
-
     wait_until_target_is_on();
 
+#ifdef CONFIG_ENABLE_ADC_MONITOR
+    // level is reached once Vcap is no longer above it
+    if (ADC_monitor_subscribe(ADC_CHAN_INDEX_VCAP, level + 1, 0,
+                              ADC_MONITOR_EDGE_FALLING, on_vcap_level) >= 0)
+        return;
+    // no free subscriber: fall back to polling
+#endif
+
+    uint16_t cur_vcap;
+
+    ADC_poll_begin(ADC_CHAN_INDEX_VCAP);
     do {
-        cur_vcap = ADC_read(ADC_CHAN_INDEX_VCAP);
+        cur_vcap = ADC_poll_read();
     } while (cur_vcap > level);
+    ADC_poll_end();
 
     enter_debug_mode(INTERRUPT_TYPE_ENERGY_BREAKPOINT, DEBUG_MODE_FULL_FEATURES);
 }
@@ -682,7 +706,10 @@ void break_at_vcap_level_adc(uint16_t level)
  * @brief	Interrupt WISP and enter active debug mode when Vcap reaches the given level
  * @param   level   Vcap level to interrupt at
  * @param   cmp_ref Voltage reference with resepect to which 'target' voltage is calculated
- * @details Implemented by monitoring Vcap using the analog comparator
+ * @details Implemented by monitoring Vcap using the analog comparator. Not
+ *          moved to the ADC monitor like break_at_vcap_level_adc: the host
+ *          picks this implementation, and gives the level against a
+ *          comparator reference rather than as an ADC reading.
  */
 void break_at_vcap_level_cmp(uint16_t level, comparator_ref_t ref)
 {
@@ -736,370 +763,37 @@ void get_app_output()
 }
 #endif // CONFIG_COLLECT_APP_OUTPUT
 
-sched_cmd_t on_watchpoint_collection_complete()
-{
-    disable_watchpoints();
-    main_loop_flags |= FLAG_ENERGY_PROFILE_READY;
-    return SCHED_CMD_WAKEUP;
-}
-
-#ifdef CONFIG_HOST_UART
-/**
- * @brief       Execute a command received from the computer through the USB port
- * @param       pkt     Packet structure that contains the received message info
- */
-static void executeUSBCmd(uartPkt_t *pkt)
-{
-    uint16_t adc12Result;
-    uint16_t target_vcap, actual_vcap;
-
-#ifdef CONFIG_SCOPE_TRIGGER_SIGNAL
-    trigger_scope();
-#endif
-
-    switch(pkt->descriptor)
-    {
-    case USB_CMD_SENSE:
-        {
-            adc_chan_index_t chan_idx = (adc_chan_index_t)pkt->data[0];
-            adc12Result = ADC_read(chan_idx);
-            send_voltage(adc12Result);
-            break;
-        }
-#ifdef CONFIG_PWM_CHARGING
-    case USB_CMD_SET_VCAP:
-        adc12Target = *((uint16_t *)(pkt->data));
-        setWispVoltage_block(ADC_CHAN_INDEX_VCAP, adc12Target);
-        break;
-
-    case USB_CMD_SET_VBOOST:
-        adc12Target = *((uint16_t *)(pkt->data));
-        setWispVoltage_block(ADC_CHAN_INDEX_VBOOST, adc12Target);
-        break;
-#endif
-
-#ifdef CONFIG_ENABLE_DEBUG_MODE
-    case USB_CMD_ENTER_ACTIVE_DEBUG:
-    	// todo: turn off all logging?
-        enter_debug_mode(INTERRUPT_TYPE_DEBUGGER_REQ, DEBUG_MODE_FULL_FEATURES);
-        break;
-
-    case USB_CMD_EXIT_ACTIVE_DEBUG:
-        exit_debug_mode();
-        break;
-
-    case USB_CMD_INTERRUPT:
-        interrupt_target();
-        break;
-
-    case USB_CMD_GET_WISP_PC:
-        target_comm_send_get_pc();
-    	while((UART_buildRxPkt(UART_INTERFACE_WISP, &wispRxPkt) != 0) ||
-    			(wispRxPkt.descriptor != WISP_RSP_ADDRESS)); // wait for response
-        forward_msg_to_host(USB_RSP_ADDRESS, wispRxPkt.data, wispRxPkt.length);
-    	wispRxPkt.processed = 1;
-    	break;
-#endif // CONFIG_ENABLE_DEBUG_MODE
-
-    case USB_CMD_STREAM_BEGIN: {
-        uint16_t streams = pkt->data[0];
-#ifdef CONFIG_ENABLE_VOLTAGE_STREAM
-        unsigned sampling_period = (pkt->data[2] << 8) | pkt->data[1];
-#endif
-
-#ifdef CONFIG_SYSTICK
-        systick_reset(); // to avoid timestamp wrap-around in middle of stream
-#endif
-
-#ifdef CONFIG_ENABLE_RF_PROTOCOL_MONITORING
-        if (streams & STREAM_RF_EVENTS)
-            RFID_start_event_stream();
-#endif
-        if (streams & STREAM_WATCHPOINTS)
-            watchpoints_start_stream();
-
-#ifdef CONFIG_ENABLE_VOLTAGE_STREAM
-        // actions common to all adc streams
-        if (streams & ADC_STREAMS) {
-            main_loop_flags |= FLAG_LOGGING; // for main loop
-            ADC_start(streams & ADC_STREAMS, sampling_period);
-        }
-#endif
-        break;
-    }
-
-    case USB_CMD_STREAM_END: {
-        unsigned streams = pkt->data[0];
-
-#ifdef CONFIG_ENABLE_RF_PROTOCOL_MONITORING
-        if (streams & STREAM_RF_EVENTS)
-            RFID_stop_event_stream();
-#endif
-        if (streams & STREAM_WATCHPOINTS)
-            watchpoints_stop_stream();
-
-#ifdef CONFIG_ENABLE_VOLTAGE_STREAM
-        // actions common to all adc streams
-        if (streams & ADC_STREAMS) {
-            ADC_stop();
-            main_loop_flags &= ~FLAG_LOGGING; // for main loop
-        }
-#endif
-        break;
-    }
-
-    case USB_CMD_SEND_RF_TX_DATA:
-		// not implemented
-		break;
-
-    case USB_CMD_ENABLE_PORT_INT_TAG_PWR:
-    	// not implemented
-    	break;
-
-    case USB_CMD_DISABLE_PORT_INT_TAG_PWR:
-    	// not implemented
-    	break;
-
-#ifdef CONFIG_PWM_CHARGING
-    case USB_CMD_PWM_ON:
-    	PWM_start();
-    	break;
-#endif
-
-    case USB_CMD_CHARGE:
-        target_vcap = *((uint16_t *)(&pkt->data[0]));
-        actual_vcap = charge_adc(target_vcap);
-        send_voltage(actual_vcap);
-        break;
-
-    case USB_CMD_DISCHARGE:
-        target_vcap = *((uint16_t *)(pkt->data));
-        actual_vcap = discharge_adc(target_vcap);
-        send_voltage(actual_vcap);
-        break;
-
-    case USB_CMD_CHARGE_CMP: {
-        target_vcap = *((uint16_t *)(pkt->data));
-        comparator_ref_t cmp_ref = (comparator_ref_t)pkt->data[2];
-        charge_cmp(target_vcap, cmp_ref);
-        break;
-    }
-
-    case USB_CMD_DISCHARGE_CMP: {
-        target_vcap = *((uint16_t *)(pkt->data));
-        comparator_ref_t cmp_ref = (comparator_ref_t)pkt->data[2];
-        discharge_cmp(target_vcap, cmp_ref);
-        break;
-    }
-
-    case USB_CMD_RESET_STATE:
-        reset_state();
-        send_return_code(RETURN_CODE_SUCCESS);
-        break;
-
-#ifdef CONFIG_PWM_CHARGING
-    case USB_CMD_RELEASE_POWER:
-    case USB_CMD_PWM_OFF:
-    case USB_CMD_PWM_LOW:
-    	PWM_stop();
-    	break;
-
-    case USB_CMD_SET_PWM_FREQUENCY:
-        PWM_set_freq((*((uint16_t *)(pkt->data))) - 1);
-    	break;
-
-    case USB_CMD_SET_PWM_DUTY_CYCLE:
-        PWM_set_duty_cycle(*((uint16_t *)(pkt->data)));
-    	break;
-
-    case USB_CMD_PWM_HIGH:
-    	PWM_stop();
-        GPIO(PORT_CHARGE, OUT) |= BIT(PIN_CHARGE); // output high
-    	break;
-#endif
-
-    // USB_CMD_PWM_LOW and USB_CMD_PWM_OFF do the same thing
-
-    case USB_CMD_MONITOR_MARKER_BEGIN:
-    case USB_CMD_MONITOR_MARKER_END:
-        // DEPRECATED
-        break;
-
-#ifdef CONFIG_ENABLE_DEBUG_MODE
-    case USB_CMD_BREAK_AT_VCAP_LEVEL: {
-        target_vcap = *((uint16_t *)(&pkt->data[0]));
-        energy_breakpoint_impl_t impl = (energy_breakpoint_impl_t)pkt->data[2];
-        switch (impl) {
-            case ENERGY_BREAKPOINT_IMPL_ADC:
-                break_at_vcap_level_adc(target_vcap);
-                break;
-            case ENERGY_BREAKPOINT_IMPL_CMP: {
-                comparator_ref_t cmp_ref = (comparator_ref_t)pkt->data[3];
-                break_at_vcap_level_cmp(target_vcap, cmp_ref);
-                break;
-            }
-        }
-        break;
-    }
-
-    case USB_CMD_READ_MEM:
-    {
-        uint32_t address = *((uint32_t *)(&pkt->data[0]));
-        unsigned len = pkt->data[4];
-
-        target_comm_send_read_mem(address, len);
-        while((UART_buildRxPkt(UART_INTERFACE_WISP, &wispRxPkt) != 0) ||
-                (wispRxPkt.descriptor != WISP_RSP_MEMORY)); // wait for response
-        forward_msg_to_host(USB_RSP_WISP_MEMORY, wispRxPkt.data, wispRxPkt.length);
-        wispRxPkt.processed = 1;
-        break;
-    }
-
-    case USB_CMD_WRITE_MEM:
-    {
-        uint32_t address = *((uint32_t *)(&pkt->data[0]));
-        unsigned len = pkt->data[4];
-        uint8_t *value = &pkt->data[5];
-
-        if (len > WISP_CMD_MAX_LEN - sizeof(uint32_t) - sizeof(uint8_t)) {
-            send_return_code(RETURN_CODE_BUFFER_TOO_SMALL);
-            break;
-        }
-
-        target_comm_send_write_mem(address, value, len);
-        while((UART_buildRxPkt(UART_INTERFACE_WISP, &wispRxPkt) != 0) ||
-                (wispRxPkt.descriptor != WISP_RSP_MEMORY)); // wait for response
-        wispRxPkt.processed = 1;
-
-        send_return_code(RETURN_CODE_SUCCESS); // TODO: have WISP return a code
-        break;
-    }
-#endif // CONFIG_ENABLE_DEBUG_MODE
-
-    case USB_CMD_CONT_POWER:
-    {
-        bool power_on = (bool)pkt->data[0];
-        if (power_on) {
-            continuous_power_on();
-            target_powered = true;
-        } else {
-            continuous_power_off();
-            target_powered = false;
-        }
-        send_return_code(RETURN_CODE_SUCCESS);
-        break;
-    }
-
-    case USB_CMD_BREAKPOINT:
-    {
-        breakpoint_type_t type = (breakpoint_type_t)pkt->data[0];
-        unsigned index = (uint8_t)pkt->data[1];
-        uint16_t energy_level = *(uint16_t *)(&pkt->data[2]);
-        comparator_ref_t cmp_ref = (comparator_ref_t)pkt->data[4];
-        bool enable = (bool)pkt->data[5];
-        unsigned rc = toggle_breakpoint(type, index, energy_level,
-                                        cmp_ref, enable);
-        send_return_code(rc);
-        break;
-    }
-
-    case USB_CMD_WATCHPOINT:
-    {
-        unsigned index = pkt->data[0];
-        bool enable = (bool)(pkt->data[1] & (1 << 0));
-        bool vcap_snapshot = (bool)(pkt->data[1] & (1 << 1));
-        unsigned rc = toggle_watchpoint(index, enable, vcap_snapshot);
-        send_return_code(rc);
-        break;
-    }
-
-#ifdef CONFIG_ENABLE_DEBUG_MODE
-    case USB_CMD_GET_INTERRUPT_CONTEXT: {
-        interrupt_context_t target_int_context;
-        interrupt_source_t source = (interrupt_source_t)pkt->data[0];
-
-        switch (source) {
-            case INTERRUPT_SOURCE_DEBUGGER:
-                send_interrupt_context(&interrupt_context);
-                break;
-            case INTERRUPT_SOURCE_TARGET:
-                get_target_interrupt_context(&target_int_context);
-                send_interrupt_context(&target_int_context);
-                break;
-            default:
-                send_return_code(RETURN_CODE_INVALID_ARGS);
-                break;
-        }
-        break;
-    }
-#endif // CONFIG_ENABLE_DEBUG_MODE
-
 #ifdef CONFIG_ENABLE_TARGET_SIDE_DEBUG_MODE
-    case USB_CMD_SERIAL_ECHO: {
-        unsigned value = pkt->data[0];
-
-        saved_sig_serial_echo_state = state;
-        set_state(STATE_SERIAL_ECHO);
-
-        reset_serial_decoder();
-
-        sig_serial_echo_value = 0;
-        unmask_target_signal();
-
-        target_comm_send_echo(value);
-
-        // Wait while the ISRs decode the serial bit stream
-        volatile uint16_t timeout = 0xffff;
-        while (state == STATE_SERIAL_ECHO && --timeout > 0);
-        if (state == STATE_SERIAL_ECHO) // timeout
-            set_state(saved_sig_serial_echo_state);
-
-        while((UART_buildRxPkt(UART_INTERFACE_WISP, &wispRxPkt) != 0) ||
-                (wispRxPkt.descriptor != WISP_RSP_SERIAL_ECHO)); // wait for response
-        wispRxPkt.processed = 1;
-
-        send_echo(value);
-        break;
-    }
-#endif // CONFIG_ENABLE_DEBUG_MODE
+void serial_echo_target(unsigned value)
+{
+    saved_sig_serial_echo_state = state;
+    set_state(STATE_SERIAL_ECHO);
 
-    case USB_CMD_DMA_ECHO: {
-        unsigned value = pkt->data[0];
-        send_echo(value);
-        break;
-    }
+    reset_serial_decoder();
 
-    case USB_CMD_ENABLE_TARGET_UART: {
-        bool enable = pkt->data[0];
-        if (enable) {
-            UART_setup(UART_INTERFACE_WISP);
-        } else {
-            UART_teardown(UART_INTERFACE_WISP);
-        }
-        send_return_code(RETURN_CODE_SUCCESS);
-        break;
-    }
+    sig_serial_echo_value = 0;
+    unmask_target_signal();
 
-    case USB_CMD_SET_PARAM: {
-        param_t param = (pkt->data[1] << 8) | pkt->data[0];
-        set_param(param, &pkt->data[2]);
-        send_param(param);
-        break;
-    }
+    target_comm_send_echo(value);
 
-    case USB_CMD_GET_PARAM: {
-        param_t param = pkt->data[0];
-        send_param(param);
-        break;
-    }
+    // Wait while the ISRs decode the serial bit stream
+    volatile uint16_t timeout = 0xffff;
+    while (state == STATE_SERIAL_ECHO && --timeout > 0);
+    if (state == STATE_SERIAL_ECHO) // timeout
+        set_state(saved_sig_serial_echo_state);
 
-    default:
-        break;
-    }
+    while((UART_buildRxPkt(UART_INTERFACE_WISP, &wispRxPkt) != 0) ||
+            (wispRxPkt.descriptor != WISP_RSP_SERIAL_ECHO)); // wait for response
+    wispRxPkt.processed = 1;
+}
+#endif // CONFIG_ENABLE_TARGET_SIDE_DEBUG_MODE
 
-    pkt->processed = 1;
+sched_cmd_t on_watchpoint_collection_complete()
+{
+    disable_watchpoints();
+    main_loop_flags |= FLAG_ENERGY_PROFILE_READY;
+    return SCHED_CMD_WAKEUP;
 }
-#endif // CONFIG_HOST_UART
 
 int main(void)
 {
@@ -1143,6 +837,8 @@ int main(void)
 #ifdef CONFIG_HOST_UART
     LOG("initing host uart\r\n");
     UART_setup(UART_INTERFACE_USB); // USCI_A0 UART
+
+    host_cmd_init();
 #endif
 
 #ifdef CONFIG_ENABLE_RF_PROTOCOL_MONITORING
@@ -1284,11 +980,37 @@ int main(void)
 #ifdef CONFIG_HOST_UART
             LOG("sending int context to host\r\n");
             // do it here: reply marks completion of enter sequence
+            UART_set_reply_tag(debug_mode_reply_tag);
             send_interrupt_context(&interrupt_context);
+            UART_set_reply_tag(UART_TAG_NONE);
+            debug_mode_reply_tag = UART_TAG_NONE;
 #endif // CONFIG_HOST_UART
         }
 #endif // CONFIG_FETCH_INTERRUPT_CONTEXT 
 
+#ifdef CONFIG_ENABLE_ENERGY_ACCOUNTING
+        energy_process_events(); // recorded by the codepoint ISR
+#endif
+
+#ifdef CONFIG_SYSTICK
+        if (main_loop_flags & FLAG_STREAM_FLUSH) {
+            main_loop_flags &= ~FLAG_STREAM_FLUSH;
+#ifdef CONFIG_ENABLE_VOLTAGE_STREAM
+            if (main_loop_flags & FLAG_LOGGING)
+                ADC_on_flush_tick();
+#endif
+#ifdef CONFIG_ENABLE_RF_PROTOCOL_MONITORING
+            RFID_on_flush_tick();
+#endif
+#ifdef CONFIG_ENABLE_WATCHPOINT_STREAM
+            watchpoints_on_flush_tick();
+#endif
+#ifdef CONFIG_ENABLE_ENERGY_ACCOUNTING
+            energy_on_flush_tick();
+#endif
+        }
+#endif // CONFIG_SYSTICK
+
 #ifdef CONFIG_ENABLE_WATCHPOINT_STREAM
         if (main_loop_flags & FLAG_WATCHPOINT_READY) {
             send_watchpoint_events();
@@ -1300,40 +1022,31 @@ int main(void)
         if (main_loop_flags & FLAG_EXITED_DEBUG_MODE) {
             main_loop_flags &= ~FLAG_EXITED_DEBUG_MODE;
 
+            UART_set_reply_tag(debug_mode_reply_tag);
             send_voltage(interrupt_context.restored_vcap);
+            UART_set_reply_tag(UART_TAG_NONE);
+            debug_mode_reply_tag = UART_TAG_NONE;
         }
 #endif
 
 #ifdef CONFIG_ENABLE_VOLTAGE_STREAM
         if((main_loop_flags & FLAG_ADC_COMPLETE) && (main_loop_flags & FLAG_LOGGING)) {
-            // ADC12 has completed conversion on all active channels
-            ADC_send_samples_to_host();
+            // ADC12 has filled one or more buffers: clear first so that a
+            // buffer filled while sending is not missed
             main_loop_flags &= ~FLAG_ADC_COMPLETE;
+            ADC_send_samples_to_host();
         }
 #endif // CONFIG_ENABLE_VOLTAGE_STREAM
 
 #ifdef CONFIG_HOST_UART
         if (main_loop_flags & FLAG_CHARGER_COMPLETE) { // comparator triggered after charge/discharge op
             main_loop_flags &= ~FLAG_CHARGER_COMPLETE;
-            send_return_code(RETURN_CODE_SUCCESS);
+            usb_cmd_charger_complete();
         }
 #endif
 
 #ifdef CONFIG_HOST_UART
-        if(main_loop_flags & FLAG_UART_USB_RX) {
-            // we've received a byte from USB
-            if(UART_buildRxPkt(UART_INTERFACE_USB, &usbRxPkt) == 0) {
-                // packet is complete
-                executeUSBCmd(&usbRxPkt);
-            }
-
-            // check if we're done for now
-            UART_DISABLE_USB_RX; // disable interrupt so new bytes don't come in
-            if(UART_RxBufEmpty(UART_INTERFACE_USB)) {
-                main_loop_flags &= ~FLAG_UART_USB_RX; // clear USB Rx flag
-            }
-            UART_ENABLE_USB_RX; // enable interrupt
-        }
+        host_cmd_poll(executeUSBCmd);
 #endif // CONFIG_HOST_UART
 
 /*
@@ -1512,6 +1225,9 @@ void __attribute__ ((interrupt(COMP_B_VECTOR))) Comp_B_ISR (void)
             break;
 #ifdef CONFIG_ENABLE_DEBUG_MODE
         case CMP_OP_ENERGY_BREAKPOINT:
+#ifdef CONFIG_ENABLE_VOLTAGE_STREAM
+            ADC_trigger_capture(CAPTURE_TRIGGER_ENERGY_BREAKPOINT, 0);
+#endif
             enter_debug_mode(INTERRUPT_TYPE_ENERGY_BREAKPOINT, DEBUG_MODE_FULL_FEATURES);
             // TODO: should the interrupt be re-enabled upon exit from debug mode?
             comparator_op = CMP_OP_NONE;
@@ -1523,6 +1239,10 @@ void __attribute__ ((interrupt(COMP_B_VECTOR))) Comp_B_ISR (void)
 
             // comparator output high means Vcap < cmp ref (activate breakpoint)
             set_external_breakpoint_pin_state(code_energy_breakpoints, CBCTL1 & CBOUT);
+#ifdef CONFIG_ENABLE_VOLTAGE_STREAM
+            if (CBCTL1 & CBOUT)
+                ADC_trigger_capture(CAPTURE_TRIGGER_ENERGY_BREAKPOINT, code_energy_breakpoints);
+#endif
 
             CBCTL1 ^= CBIES; // reverse the edge direction of the interrupt
             CBINT &= ~CBIFG; // clear the flag, leave interrupt enabled
@@ -1586,7 +1306,7 @@ void __attribute__ ((interrupt(UNMI_VECTOR))) unmi_isr(void)
     while (1);
 }
 
-#ifdef DMA_HOST_UART_TX
+#if defined(DMA_HOST_UART_TX) || defined(CONFIG_ENABLE_VOLTAGE_STREAM)
 #if defined(__TI_COMPILER_VERSION__) || defined(__IAR_SYSTEMS_ICC__)
 #pragma vector=DMA_VECTOR
 __interrupt void DMA_ISR(void)
@@ -1599,9 +1319,30 @@ void __attribute__ ((interrupt(DMA_VECTOR))) DMA_ISR (void)
     switch (__even_in_range(DMAIV, 16)) {
 #ifdef DMA_HOST_UART_TX
         case DMA_INTFLAG(DMA_HOST_UART_TX):
-               host_uart_status &= ~UART_STATUS_TX_BUSY;
+            UART_on_host_tx_dma();
             break;
 #endif
+#if defined(DMA_HOST_UART_RX) && (!defined(CONFIG_ENABLE_VOLTAGE_STREAM) || \
+                                  DMA_HOST_UART_RX != DMA_ADC_TIMESTAMPS)
+        case DMA_INTFLAG(DMA_HOST_UART_RX):
+            UART_on_host_rx_dma();
+            break;
+#endif
+#ifdef CONFIG_ENABLE_VOLTAGE_STREAM
+        case DMA_INTFLAG(DMA_ADC_VOLTAGES):
+            ADC_on_voltages_dma();
+            break;
+        case DMA_INTFLAG(DMA_ADC_TIMESTAMPS):
+#if defined(DMA_HOST_UART_RX) && DMA_HOST_UART_RX == DMA_ADC_TIMESTAMPS
+            // channel is lent to the ADC only while a stream runs
+            if (host_uart_status & UART_STATUS_RX_DMA) {
+                UART_on_host_rx_dma();
+                break;
+            }
+#endif
+            ADC_on_timestamps_dma();
+            break;
+#endif // CONFIG_ENABLE_VOLTAGE_STREAM
     }
 }
 #endif // DMA users
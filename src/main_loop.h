@@ -23,6 +23,7 @@ typedef enum {
     FLAG_APP_OUTPUT             = 0x1000, //!< interrupt target and get app data packet
     FLAG_COLLECT_WATCHPOINTS    = 0x2000, //!< start collecting energy profile (watchpoints)
     FLAG_SEND_BEACON            = 0x4000, //!< transmit a beacon to ground
+    FLAG_STREAM_FLUSH           = 0x8000, //!< time to check for stream buffers to flush
 } main_loop_flag_t;
 
 extern volatile uint16_t main_loop_flags; // bit mask containing bit flags to check in the main loop
@@ -1,8 +1,27 @@
 #include "params.h"
 
+#ifdef CONFIG_HOST_UART
+#include "uart.h"
+#endif // CONFIG_HOST_UART
+
 uint16_t param_test = 0xbeef;
 uint16_t param_target_boot_voltage_dl = 2745; // = 2.0v * (4096 / EDB_VDD)
 uint16_t param_target_boot_latency_kcycles = 24; // = 24 MHz * 1ms
+uint16_t param_stream_stats_window = 256; // samples
+uint16_t param_stream_stats = ADC_STATS_MIN | ADC_STATS_MAX | ADC_STATS_MEAN;
+uint16_t param_capture_pre_samples = 32;
+uint16_t param_capture_post_samples = 32;
+uint16_t param_capture_triggers = CAPTURE_TRIGGER_WATCHPOINT | CAPTURE_TRIGGER_ENERGY_BREAKPOINT |
+                                  CAPTURE_TRIGGER_BROWN_OUT | CAPTURE_TRIGGER_RFID_CMD;
+uint16_t param_capture_brown_out_voltage_dl = 2470; // = 1.8v * (4096 / EDB_VDD)
+uint16_t param_stream_latency_voltages = 10; // flush ticks (see CONFIG_STREAM_FLUSH_INTERVAL)
+uint16_t param_stream_latency_rf_events = 10;
+uint16_t param_stream_latency_watchpoints = 10;
+uint16_t param_stream_deadband = 4; // ADC counts
+uint16_t param_stream_keepalive = 1024; // sequences
+uint16_t param_stream_oversampling = 2; // 16 sequences per value, 14-bit values
+uint16_t param_energy_capacitance_uf = 47;
+uint16_t param_energy_report_interval = 0; // flush ticks
 
 static unsigned serialize_uint16(uint8_t *buf, uint16_t value)
 {
@@ -54,6 +73,52 @@ unsigned set_param(param_t param, uint8_t *buf)
             return deserialize_uint16(&param_target_boot_voltage_dl, buf);
         case PARAM_TARGET_BOOT_LATENCY_KCYCLES:
             return deserialize_uint16(&param_target_boot_latency_kcycles, buf);
+        case PARAM_STREAM_STATS_WINDOW:
+            return deserialize_uint16(&param_stream_stats_window, buf);
+        case PARAM_STREAM_STATS:
+            return deserialize_uint16(&param_stream_stats, buf);
+        case PARAM_CAPTURE_PRE_SAMPLES:
+            return deserialize_uint16(&param_capture_pre_samples, buf);
+        case PARAM_CAPTURE_POST_SAMPLES:
+            return deserialize_uint16(&param_capture_post_samples, buf);
+        case PARAM_CAPTURE_TRIGGERS:
+            return deserialize_uint16(&param_capture_triggers, buf);
+        case PARAM_CAPTURE_BROWN_OUT_VOLTAGE_DL:
+            return deserialize_uint16(&param_capture_brown_out_voltage_dl, buf);
+        case PARAM_STREAM_LATENCY_VOLTAGES:
+            return deserialize_uint16(&param_stream_latency_voltages, buf);
+        case PARAM_STREAM_LATENCY_RF_EVENTS:
+            return deserialize_uint16(&param_stream_latency_rf_events, buf);
+        case PARAM_STREAM_LATENCY_WATCHPOINTS:
+            return deserialize_uint16(&param_stream_latency_watchpoints, buf);
+        case PARAM_STREAM_DEADBAND:
+            return deserialize_uint16(&param_stream_deadband, buf);
+        case PARAM_STREAM_KEEPALIVE:
+            return deserialize_uint16(&param_stream_keepalive, buf);
+        case PARAM_STREAM_OVERSAMPLING:
+            return deserialize_uint16(&param_stream_oversampling, buf);
+        case PARAM_ENERGY_CAPACITANCE_UF:
+            return deserialize_uint16(&param_energy_capacitance_uf, buf);
+        case PARAM_ENERGY_REPORT_INTERVAL:
+            return deserialize_uint16(&param_energy_report_interval, buf);
+#ifdef CONFIG_HOST_UART
+        case PARAM_HOST_UART_CRC_ERRORS:
+            return deserialize_uint16(&host_uart_errors.crc, buf);
+        case PARAM_HOST_UART_FRAME_ERRORS:
+            return deserialize_uint16(&host_uart_errors.framing, buf);
+        case PARAM_HOST_UART_RX_OVERRUNS:
+            return deserialize_uint16(&host_uart_errors.overrun, buf);
+        case PARAM_HOST_TX_WEIGHT_VOLTAGES:
+            return deserialize_uint16(&host_tx_weights[TX_SOURCE_VOLTAGES], buf);
+        case PARAM_HOST_TX_WEIGHT_RF_EVENTS:
+            return deserialize_uint16(&host_tx_weights[TX_SOURCE_RF_EVENTS], buf);
+        case PARAM_HOST_TX_WEIGHT_WATCHPOINTS:
+            return deserialize_uint16(&host_tx_weights[TX_SOURCE_WATCHPOINTS], buf);
+        case PARAM_HOST_TX_WEIGHT_ENERGY:
+            return deserialize_uint16(&host_tx_weights[TX_SOURCE_ENERGY], buf);
+        case PARAM_TARGET_UART_RX_OVERRUNS:
+            return deserialize_uint16(&target_uart_rx_overruns, buf);
+#endif // CONFIG_HOST_UART
         default:
             return 0;
     }
@@ -68,6 +133,52 @@ unsigned get_param(param_t param, uint8_t *buf)
             return serialize_uint16(buf, param_target_boot_voltage_dl);
         case PARAM_TARGET_BOOT_LATENCY_KCYCLES:
             return serialize_uint16(buf, param_target_boot_latency_kcycles);
+        case PARAM_STREAM_STATS_WINDOW:
+            return serialize_uint16(buf, param_stream_stats_window);
+        case PARAM_STREAM_STATS:
+            return serialize_uint16(buf, param_stream_stats);
+        case PARAM_CAPTURE_PRE_SAMPLES:
+            return serialize_uint16(buf, param_capture_pre_samples);
+        case PARAM_CAPTURE_POST_SAMPLES:
+            return serialize_uint16(buf, param_capture_post_samples);
+        case PARAM_CAPTURE_TRIGGERS:
+            return serialize_uint16(buf, param_capture_triggers);
+        case PARAM_CAPTURE_BROWN_OUT_VOLTAGE_DL:
+            return serialize_uint16(buf, param_capture_brown_out_voltage_dl);
+        case PARAM_STREAM_LATENCY_VOLTAGES:
+            return serialize_uint16(buf, param_stream_latency_voltages);
+        case PARAM_STREAM_LATENCY_RF_EVENTS:
+            return serialize_uint16(buf, param_stream_latency_rf_events);
+        case PARAM_STREAM_LATENCY_WATCHPOINTS:
+            return serialize_uint16(buf, param_stream_latency_watchpoints);
+        case PARAM_STREAM_DEADBAND:
+            return serialize_uint16(buf, param_stream_deadband);
+        case PARAM_STREAM_KEEPALIVE:
+            return serialize_uint16(buf, param_stream_keepalive);
+        case PARAM_STREAM_OVERSAMPLING:
+            return serialize_uint16(buf, param_stream_oversampling);
+        case PARAM_ENERGY_CAPACITANCE_UF:
+            return serialize_uint16(buf, param_energy_capacitance_uf);
+        case PARAM_ENERGY_REPORT_INTERVAL:
+            return serialize_uint16(buf, param_energy_report_interval);
+#ifdef CONFIG_HOST_UART
+        case PARAM_HOST_UART_CRC_ERRORS:
+            return serialize_uint16(buf, host_uart_errors.crc);
+        case PARAM_HOST_UART_FRAME_ERRORS:
+            return serialize_uint16(buf, host_uart_errors.framing);
+        case PARAM_HOST_UART_RX_OVERRUNS:
+            return serialize_uint16(buf, host_uart_errors.overrun);
+        case PARAM_HOST_TX_WEIGHT_VOLTAGES:
+            return serialize_uint16(buf, host_tx_weights[TX_SOURCE_VOLTAGES]);
+        case PARAM_HOST_TX_WEIGHT_RF_EVENTS:
+            return serialize_uint16(buf, host_tx_weights[TX_SOURCE_RF_EVENTS]);
+        case PARAM_HOST_TX_WEIGHT_WATCHPOINTS:
+            return serialize_uint16(buf, host_tx_weights[TX_SOURCE_WATCHPOINTS]);
+        case PARAM_HOST_TX_WEIGHT_ENERGY:
+            return serialize_uint16(buf, host_tx_weights[TX_SOURCE_ENERGY]);
+        case PARAM_TARGET_UART_RX_OVERRUNS:
+            return serialize_uint16(buf, target_uart_rx_overruns);
+#endif // CONFIG_HOST_UART
         default:
             return 0;
     }
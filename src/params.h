@@ -8,6 +8,20 @@
 extern uint16_t param_test;
 extern uint16_t param_target_boot_voltage_dl;
 extern uint16_t param_target_boot_latency_kcycles;
+extern uint16_t param_stream_stats_window;
+extern uint16_t param_stream_stats;
+extern uint16_t param_capture_pre_samples;
+extern uint16_t param_capture_post_samples;
+extern uint16_t param_capture_triggers;
+extern uint16_t param_capture_brown_out_voltage_dl;
+extern uint16_t param_stream_latency_voltages;
+extern uint16_t param_stream_latency_rf_events;
+extern uint16_t param_stream_latency_watchpoints;
+extern uint16_t param_stream_deadband;
+extern uint16_t param_stream_keepalive;
+extern uint16_t param_stream_oversampling;
+extern uint16_t param_energy_capacitance_uf;
+extern uint16_t param_energy_report_interval;
 
 unsigned set_param(param_t param, uint8_t *buf);
 unsigned get_param(param_t param, uint8_t *buf);
@@ -111,6 +111,9 @@
 #define UART_TARGET                             1
 
 #define DMA_HOST_UART_TX                        0 //!< DMA channel for UART TX to host
+#define DMA_ADC_VOLTAGES                        1 //!< DMA channel for ADC results in stream mode
+#define DMA_ADC_TIMESTAMPS                      2 //!< DMA channel for sample timestamps in stream mode
+#define DMA_HOST_UART_RX                        2 //!< DMA channel for UART RX from host (lent to the ADC in stream mode)
 
 // TODO: warning: timer shared with voltage logging code
 // NOTE: if changed, the ISR in main.c must also be changed
@@ -267,5 +270,35 @@
 #error Invalid DMA channel index: DMA_HOST_UART_TX
 #endif
 
+#ifdef DMA_HOST_UART_RX
+#if DMA_HOST_UART_RX == 0 || DMA_HOST_UART_RX == 1
+#define DMA_HOST_UART_RX_CTL 0
+#elif DMA_HOST_UART_RX == 2
+#define DMA_HOST_UART_RX_CTL 1
+#else
+#error Invalid DMA channel index: DMA_HOST_UART_RX
+#endif
+#endif // DMA_HOST_UART_RX
+
+#ifdef DMA_ADC_VOLTAGES
+#if DMA_ADC_VOLTAGES == 0 || DMA_ADC_VOLTAGES == 1
+#define DMA_ADC_VOLTAGES_CTL 0
+#elif DMA_ADC_VOLTAGES == 2
+#define DMA_ADC_VOLTAGES_CTL 1
+#else
+#error Invalid DMA channel index: DMA_ADC_VOLTAGES
+#endif
+#endif // DMA_ADC_VOLTAGES
+
+#ifdef DMA_ADC_TIMESTAMPS
+#if DMA_ADC_TIMESTAMPS == 0 || DMA_ADC_TIMESTAMPS == 1
+#define DMA_ADC_TIMESTAMPS_CTL 0
+#elif DMA_ADC_TIMESTAMPS == 2
+#define DMA_ADC_TIMESTAMPS_CTL 1
+#else
+#error Invalid DMA channel index: DMA_ADC_TIMESTAMPS
+#endif
+#endif // DMA_ADC_TIMESTAMPS
+
 
 #endif // PIN_ASSIGN_H
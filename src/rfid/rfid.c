@@ -16,35 +16,14 @@
 #include "error.h"
 #include "rfid_decoder.h"
 #include "main_loop.h"
+#include "adc.h"
+#include "params.h"
 
 #include "rfid.h"
 
-/*Buffer structure:
- *  [ empty_space | header | rf_event_t #1 | rf_event_t #2 | ... | rf_event_t #n ]
- * where len(empty_space + header) == sizeof(rf_event_t) because compiler might
- * have alignment rules for structs: can't treat any memory address as pointer to
- * a struct (this is a hypothesis, though).
- *
- * Note that rf_event_t items include padding from the struct.
- *
- * The bytes sent in the UART message start at header.
- */
-
 #define NUM_BUFFERS                                  2 // double-buffer pair
 #define NUM_EVENTS_BUFFERED                         16
 
-#define RF_EVENT_BUF_HEADER_SPACE 2 // units of sizeof(rf_event_t)
-#define RF_EVENT_BUF_PAYLOAD_SPACE NUM_EVENTS_BUFFERED // units of sizeof(rf_event_t)
-#define RF_EVENT_BUF_SIZE (RF_EVENT_BUF_HEADER_SPACE + RF_EVENT_BUF_PAYLOAD_SPACE) // units of sizeof(rf_event_t)
-
-#if STREAM_DATA_MSG_HEADER > RF_EVENT_BUF_HEADER_SPACE
-#error Not enough space for header in event buf: add more units of sizeof(struct rf_event_t)
-#endif
-
-#define RF_EVENT_BUF_HEADER_OFFSET \
-    (RF_EVENT_BUF_HEADER_SPACE * sizeof(rf_event_t) - \
-        (UART_MSG_HEADER_SIZE + STREAM_DATA_MSG_HEADER_LEN))
-
 #define STARTING_EVENT_BUF_IDX 0
 
 typedef struct {
@@ -53,19 +32,15 @@ typedef struct {
 } rf_event_t;
 
 /** @brief Memory allocated for the double-buffer pair
- *
- *  @details To avoid an extra copy, the event buffer is contiguous with
- *           memory for the other message fields.
+ *  @details Holds just the events: the message header is sent as a
+ *           separate segment, see RFID_send_rf_events_to_host.
  */
-static rf_event_t rf_events_msg_bufs[NUM_BUFFERS][RF_EVENT_BUF_SIZE];
+static rf_event_t rf_events_bufs[NUM_BUFFERS][NUM_EVENTS_BUFFERED];
 
-/** @brief Pointers to each event buffer in the double-buffer pair
- *  @details These pointers point to the event data "payload" of the message,
- *           skipping the other message fields.
- */
-static rf_event_t * const rf_events_bufs[NUM_BUFFERS] = {
-    (rf_event_t *)&rf_events_msg_bufs[0][RF_EVENT_BUF_HEADER_SPACE],
-    (rf_event_t *)&rf_events_msg_bufs[1][RF_EVENT_BUF_HEADER_SPACE]
+/** @brief Stream data header sent before the events */
+static const uint8_t rf_events_header[STREAM_DATA_MSG_HEADER_LEN] = {
+    STREAM_RF_EVENTS,
+    0, // padding
 };
 
 /** @brief Pointer and index to current event buffer among the double-buffer pair
@@ -79,8 +54,13 @@ static rf_event_t * const rf_events_bufs[NUM_BUFFERS] = {
  * */
 static volatile unsigned rf_events_buf_idx;
 static rf_event_t *rf_events_buf;
-/** @brief Number of events in the current buffer so far */
-static unsigned rf_events_count[NUM_BUFFERS];
+/** @brief Number of events in the current buffer so far
+ *  @details Zeroed by the UART once a buffer is out, see on_rf_events_sent.
+ */
+static volatile unsigned rf_events_count[NUM_BUFFERS];
+
+/** @brief Flush ticks that the current buffer has had events for */
+static unsigned rf_events_age;
 
 
 static void append_event(rf_event_type_t id)
@@ -116,6 +96,9 @@ static void append_event(rf_event_type_t id)
 static inline void handle_rfid_cmd(rfid_cmd_code_t cmd_code)
 {
     append_event(RF_EVENT_TYPE_CMD | cmd_code);
+#ifdef CONFIG_ENABLE_VOLTAGE_STREAM
+    ADC_trigger_capture(CAPTURE_TRIGGER_RFID_CMD, cmd_code);
+#endif
 }
 
 static inline void handle_rfid_rsp(rfid_rsp_code_t rsp_code)
@@ -139,47 +122,66 @@ static inline void handle_rfid_rsp(rfid_rsp_code_t rsp_code)
  *          The disadvantage of the former approach is that we will end up
  *          doing a lot of buffer switches.
  */
+static void on_rf_events_sent(unsigned buf_idx)
+{
+    rf_events_count[buf_idx] = 0; // mark buffer as free
+}
+
 void RFID_send_rf_events_to_host()
 {
-    unsigned ready_events_count;
+    UART_segment_t events;
     unsigned ready_events_buf_idx = rf_events_buf_idx ^ 1; // the other one in the pair
 
-    ready_events_count = rf_events_count[ready_events_buf_idx];
-
-    UART_begin_transmission();
+    // TODO: the event count is == NUM_BUFFERED_EVENTS, except for the flush case
+    events.buf = (const uint8_t *)rf_events_bufs[ready_events_buf_idx];
+    events.len = rf_events_count[ready_events_buf_idx] * sizeof(rf_event_t);
 
-    // Must use a blocking call in order to mark buffer as free once transfer completes
-    UART_send_msg_to_host(USB_RSP_STREAM_EVENTS,
-            // TODO: the event count is == NUM_BUFFERED_EVENTS, except for the flush case
-            STREAM_DATA_MSG_HEADER_LEN + ready_events_count * sizeof(rf_event_t),
-            (uint8_t *)&rf_events_msg_bufs[ready_events_buf_idx][0] + RF_EVENT_BUF_HEADER_OFFSET);
+    // The buffer is marked as free once the transfer completes
+    UART_queue_segments_to_host(TX_SOURCE_RF_EVENTS, USB_RSP_STREAM_EVENTS,
+            rf_events_header, sizeof(rf_events_header), &events, 1,
+            on_rf_events_sent, ready_events_buf_idx);
+}
 
-    UART_end_transmission();
+/** @brief Hand the current buffer, however full, to the main loop to send */
+static void swap_partial_buffer()
+{
+    __disable_interrupt();
+    rf_events_buf_idx ^= 0x1;
+    rf_events_buf = rf_events_bufs[rf_events_buf_idx];
+    main_loop_flags |= FLAG_RF_DATA;
+    __enable_interrupt();
 
-    rf_events_count[ready_events_buf_idx] = 0; // mark buffer as free
+    rf_events_age = 0;
 }
 
-void RFID_init()
+void RFID_on_flush_tick()
 {
-    unsigned i;
-    unsigned offset;
-    uint8_t *header;
-
-    // Initialize message header
-    for (i = 0; i < NUM_BUFFERS; ++i) {
-        header = (uint8_t *)&rf_events_msg_bufs[i][0] +
-                    UART_MSG_HEADER_SIZE + RF_EVENT_BUF_HEADER_OFFSET;
-        offset = 0;
-        header[offset++] = STREAM_RF_EVENTS;
-        header[offset++] = 0; // padding
-        ASSERT(ASSERT_INVALID_STREAM_BUF_HEADER, offset == STREAM_DATA_MSG_HEADER_LEN);
+    if (!rf_events_count[rf_events_buf_idx]) {
+        rf_events_age = 0;
+        return;
     }
 
+    if (!param_stream_latency_rf_events || ++rf_events_age < param_stream_latency_rf_events)
+        return;
+
+    // The other buffer is still waiting to be sent, the events will go out
+    // with the next swap.
+    if (rf_events_count[rf_events_buf_idx ^ 1])
+        return;
+
+    swap_partial_buffer();
+}
+
+void RFID_init()
+{
     rfid_decoder_init(&handle_rfid_cmd, &handle_rfid_rsp);
 }
 
 void RFID_start_event_stream()
 {
+    // The counts are reset below, so the buffers from the last stream must be out
+    UART_wait_tx((uint8_t *)rf_events_bufs, sizeof(rf_events_bufs));
+
     // Start filling up the first of the two buffers
     rf_events_buf_idx = 0;
     rf_events_buf = rf_events_bufs[rf_events_buf_idx];
@@ -191,4 +193,15 @@ void RFID_start_event_stream()
 void RFID_stop_event_stream()
 {
     rfid_decoder_stop();
+
+    // Final flush: the buffer waiting to be sent, if any, then the partial one
+    if (main_loop_flags & FLAG_RF_DATA) {
+        main_loop_flags &= ~FLAG_RF_DATA;
+        RFID_send_rf_events_to_host();
+    }
+    if (rf_events_count[rf_events_buf_idx]) {
+        swap_partial_buffer();
+        main_loop_flags &= ~FLAG_RF_DATA;
+        RFID_send_rf_events_to_host();
+    }
 }
@@ -16,4 +16,10 @@ void RFID_start_event_stream();
 void RFID_stop_event_stream();
 void RFID_send_rf_events_to_host();
 
+/** @brief Swap out the current buffer of events if it has waited too long
+ *  @details Called by main on each stream flush tick (see
+ *           PARAM_STREAM_LATENCY_RF_EVENTS).
+ */
+void RFID_on_flush_tick();
+
 #endif
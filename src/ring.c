@@ -0,0 +1,41 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "minmax.h"
+
+#include "ring.h"
+
+unsigned ring_push(ring_t *ring, const uint8_t *src, unsigned len)
+{
+    unsigned tail = ring->tail;
+    unsigned index = tail & ring->mask;
+    unsigned first;
+
+    len = MIN(len, ring_size(ring) - (tail - ring->head));
+
+    // at most two spans: up to the end of the storage, and from its start
+    first = MIN(len, ring_size(ring) - index);
+    memcpy(&ring->buf[index], src, first);
+    memcpy(ring->buf, src + first, len - first);
+
+    RING_BARRIER();
+    ring->tail = tail + len;
+    return len;
+}
+
+unsigned ring_pop(ring_t *ring, uint8_t *dest, unsigned len)
+{
+    unsigned head = ring->head;
+    unsigned index = head & ring->mask;
+    unsigned first;
+
+    len = MIN(len, ring->tail - head);
+
+    first = MIN(len, ring_size(ring) - index);
+    memcpy(dest, &ring->buf[index], first);
+    memcpy(dest + first, ring->buf, len - first);
+
+    RING_BARRIER();
+    ring->head = head + len;
+    return len;
+}
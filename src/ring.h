@@ -0,0 +1,139 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @defgroup    RING    Single-producer single-consumer byte ring
+ * @brief       Circular byte buffer shared between an ISR (or a DMA) and the main loop
+ * @details     The size is a power of two, so positions wrap with a mask
+ *              instead of a division. Head and tail are free-running counts
+ *              of bytes popped and pushed: their difference is the length,
+ *              and all of the storage is usable. Only the producer writes the
+ *              tail and only the consumer writes the head, each with a single
+ *              word store after the data it covers, so neither side needs to
+ *              disable interrupts.
+ * @{
+ */
+
+/** @brief Keep the compiler from moving data accesses across an index update */
+#if defined(__GNUC__)
+#define RING_BARRIER() __asm__ __volatile__("" ::: "memory")
+#else
+#define RING_BARRIER()
+#endif
+
+typedef struct {
+    uint8_t *buf;               //!< Storage (at least mask + 1 bytes)
+    unsigned mask;              //!< Size minus one, the size is a power of two
+    volatile unsigned head;     //!< Bytes popped so far (written by the consumer)
+    volatile unsigned tail;     //!< Bytes pushed so far (written by the producer)
+} ring_t;
+
+/** @brief Static initializer for a ring over the given storage */
+#define RING_INIT(storage, size) \
+    { .buf = (uint8_t *)(storage), .mask = (size) - 1, .head = 0, .tail = 0 }
+
+/** @brief Whether a size is usable for a ring (for compile-time checks) */
+#define RING_SIZE_VALID(size) ((size) > 0 && ((size) & ((size) - 1)) == 0)
+
+static inline unsigned ring_size(const ring_t *ring)
+{
+    return ring->mask + 1;
+}
+
+/** @brief Number of bytes in the ring (at least, when called by the consumer) */
+static inline unsigned ring_len(const ring_t *ring)
+{
+    return ring->tail - ring->head;
+}
+
+/** @brief Number of free bytes (at least, when called by the producer) */
+static inline unsigned ring_free(const ring_t *ring)
+{
+    return ring_size(ring) - ring_len(ring);
+}
+
+static inline bool ring_empty(const ring_t *ring)
+{
+    return ring->head == ring->tail;
+}
+
+/** @brief Position in the storage of the byte at an offset from the head */
+static inline unsigned ring_index(const ring_t *ring, unsigned offset)
+{
+    return (ring->head + offset) & ring->mask;
+}
+
+/** @brief Read the byte at an offset from the head without popping it */
+static inline uint8_t ring_peek(const ring_t *ring, unsigned offset)
+{
+    return ring->buf[ring_index(ring, offset)];
+}
+
+/**
+ * @brief   Push one byte (producer)
+ * @return  Whether there was space for the byte
+ */
+static inline bool ring_push_byte(ring_t *ring, uint8_t byte)
+{
+    unsigned tail = ring->tail;
+
+    if (tail - ring->head > ring->mask)
+        return false;
+
+    ring->buf[tail & ring->mask] = byte;
+    RING_BARRIER();
+    ring->tail = tail + 1;
+    return true;
+}
+
+/** @brief Pop one byte from a ring that is not empty (consumer) */
+static inline uint8_t ring_pop_byte(ring_t *ring)
+{
+    unsigned head = ring->head;
+    uint8_t byte = ring->buf[head & ring->mask];
+
+    RING_BARRIER();
+    ring->head = head + 1;
+    return byte;
+}
+
+/** @brief Drop bytes from the head, e.g. after reading them in place (consumer) */
+static inline void ring_drop(ring_t *ring, unsigned len)
+{
+    RING_BARRIER();
+    ring->head += len;
+}
+
+/**
+ * @brief   Publish the position up to which the storage has been filled (producer)
+ * @param   index   Position in the storage one past the last byte written
+ * @details For a producer that writes the storage directly, such as a DMA.
+ *          Cannot tell a full ring from an empty one, so such a producer
+ *          must leave at least one byte free.
+ */
+static inline void ring_publish(ring_t *ring, unsigned index)
+{
+    unsigned tail = ring->tail;
+
+    RING_BARRIER();
+    ring->tail = tail + ((index - tail) & ring->mask);
+}
+
+/**
+ * @brief   Push as many bytes as fit (producer)
+ * @return  Number of bytes pushed
+ */
+unsigned ring_push(ring_t *ring, const uint8_t *src, unsigned len);
+
+/**
+ * @brief   Pop up to the given number of bytes (consumer)
+ * @return  Number of bytes popped
+ */
+unsigned ring_pop(ring_t *ring, uint8_t *dest, unsigned len);
+
+/** @} End RING */
+
+#endif // RING_H
@@ -0,0 +1,187 @@
+#include <msp430.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "host_comm.h"
+#include "stats.h"
+
+typedef struct {
+    uint16_t min;
+    uint16_t max;
+    uint32_t sum;
+
+    // CIC filter state (modular arithmetic, wrap-around is harmless)
+    uint32_t integ1;
+    uint32_t integ2;
+    uint32_t comb1_prev; // integ2 at the end of the previous window
+    uint32_t comb2_prev; // output of the first comb in the previous window
+} stats_chan_t;
+
+static stats_chan_t chans[STATS_MAX_CHANNELS];
+static unsigned num_chans;
+static unsigned window_len;
+static unsigned window_count;
+static unsigned selected_stats;
+static uint32_t window_start_time;
+
+// Reciprocals in 0.32 fixed point, for the mean and the CIC gain
+static uint32_t window_recip;
+static uint32_t cic_gain_recip;
+
+/** @brief High word of the 64-bit product of two 32-bit values, on the MPY32 */
+static uint32_t mul32_high(uint32_t a, uint32_t b)
+{
+    uint32_t high;
+    unsigned short int_state;
+
+    // The multiplier is shared with compiler-generated code in ISRs
+    int_state = __get_interrupt_state();
+    __disable_interrupt();
+
+    MPY32L = a;
+    MPY32H = a >> 16;
+    OP2L = b;
+    OP2H = b >> 16; // starts the multiplication
+    __delay_cycles(8); // 32x32 result latency
+
+    high = ((uint32_t)RES3 << 16) | RES2;
+
+    __set_interrupt_state(int_state);
+    return high;
+}
+
+/** @brief Reciprocal in 0.32 fixed point, rounded up so that x * recip >> 32
+ *         is exactly x / d for x that are multiples of d
+ *  @details Zero stands for 1/1, which does not fit.
+ */
+static uint32_t reciprocal(uint32_t d)
+{
+    return d > 1 ? 0xFFFFFFFF / d + 1 : 0;
+}
+
+static inline uint32_t mul_recip(uint32_t x, uint32_t recip)
+{
+    return recip ? mul32_high(x, recip) : x;
+}
+
+static void reset_window()
+{
+    unsigned i;
+
+    for (i = 0; i < num_chans; ++i) {
+        chans[i].min = 0xFFFF;
+        chans[i].max = 0;
+        chans[i].sum = 0;
+    }
+    window_count = 0;
+}
+
+unsigned stats_begin(unsigned num_channels, unsigned window, unsigned stats)
+{
+    unsigned i;
+
+    if (window == 0)
+        window = 1;
+    if (window > STATS_CIC_MAX_WINDOW)
+        stats &= ~ADC_STATS_FILTERED;
+
+    num_chans = num_channels;
+    window_len = window;
+    selected_stats = stats;
+
+    for (i = 0; i < num_chans; ++i) {
+        chans[i].integ1 = 0;
+        chans[i].integ2 = 0;
+        chans[i].comb1_prev = 0;
+        chans[i].comb2_prev = 0;
+    }
+    reset_window();
+
+    // Divisions only here, once per stream
+    window_recip = reciprocal(window);
+    cic_gain_recip = reciprocal((uint32_t)window * window);
+
+    return selected_stats;
+}
+
+bool stats_add(const uint16_t *samples, uint32_t timestamp)
+{
+    stats_chan_t *chan;
+    uint16_t sample;
+    unsigned i;
+
+    if (window_count == 0)
+        window_start_time = timestamp;
+
+    for (i = 0; i < num_chans; ++i) {
+        chan = &chans[i];
+        sample = samples[i];
+
+        if (sample < chan->min)
+            chan->min = sample;
+        if (sample > chan->max)
+            chan->max = sample;
+        chan->sum += sample;
+
+        chan->integ1 += sample;
+        chan->integ2 += chan->integ1;
+    }
+
+    return ++window_count == window_len;
+}
+
+static inline unsigned put_uint16(uint8_t *buf, uint16_t value)
+{
+    buf[0] = value;
+    buf[1] = value >> 8;
+    return sizeof(uint16_t);
+}
+
+unsigned stats_record(uint8_t *buf)
+{
+    stats_chan_t *chan;
+    uint32_t comb1, comb2;
+    unsigned len = 0;
+    unsigned i;
+
+    len += put_uint16(&buf[len], window_start_time);
+    len += put_uint16(&buf[len], window_start_time >> 16);
+
+    for (i = 0; i < num_chans; ++i) {
+        chan = &chans[i];
+
+        if (selected_stats & ADC_STATS_MIN)
+            len += put_uint16(&buf[len], chan->min);
+        if (selected_stats & ADC_STATS_MAX)
+            len += put_uint16(&buf[len], chan->max);
+        if (selected_stats & ADC_STATS_MEAN)
+            len += put_uint16(&buf[len], mul_recip(chan->sum, window_recip));
+        if (selected_stats & ADC_STATS_FILTERED) {
+            comb1 = chan->integ2 - chan->comb1_prev;
+            chan->comb1_prev = chan->integ2;
+            comb2 = comb1 - chan->comb2_prev;
+            chan->comb2_prev = comb1;
+            len += put_uint16(&buf[len], mul_recip(comb2, cic_gain_recip));
+        }
+    }
+
+    reset_window();
+    return len;
+}
+
+unsigned stats_record_len()
+{
+    unsigned stats_per_chan = 0;
+    unsigned stats = selected_stats;
+
+    while (stats) {
+        stats_per_chan += stats & 0x1;
+        stats >>= 1;
+    }
+    return sizeof(uint32_t) + num_chans * stats_per_chan * sizeof(uint16_t);
+}
+
+unsigned stats_window_len()
+{
+    return window_len;
+}
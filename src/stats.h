@@ -0,0 +1,58 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @defgroup    STATS   Windowed statistics
+ * @brief       Per-channel statistics over consecutive windows of samples
+ * @details     Min, max, mean, and a decimated waveform filtered by a
+ *              second-order CIC filter with a decimation factor equal to the
+ *              window length. The CIC integrators run on every sample (adds
+ *              only), the combs and the normalization run once per window
+ *              (on the MPY32). The first two filtered values of a stream are
+ *              the filter settling and should be discarded.
+ * @{
+ */
+
+#define STATS_MAX_CHANNELS          5
+
+/** @brief Longest window for the filtered statistic, so that the CIC gain
+ *         (window^2) times a 12-bit sample fits in 32 bits */
+#define STATS_CIC_MAX_WINDOW     1023
+
+/**
+ * @brief   Start collecting statistics
+ * @param   num_channels    Number of channels in each sequence of samples
+ * @param   window          Number of sequences per window (at least one, see stats_window_len)
+ * @param   stats           Bitmask of statistics to collect (see adc_stats_t in host_comm.h)
+ * @return  Bitmask of statistics that will actually be collected
+ */
+unsigned stats_begin(unsigned num_channels, unsigned window, unsigned stats);
+
+/**
+ * @brief   Add a sequence of samples to the current window
+ * @param   samples     One sample per channel
+ * @param   timestamp   Time of the sequence
+ * @return  Whether the window is complete and a record is ready
+ */
+bool stats_add(const uint16_t *samples, uint32_t timestamp);
+
+/**
+ * @brief   Serialize the record for the completed window and start the next
+ * @details Timestamp of the first sequence in the window (uint32), followed
+ *          by the selected statistics for each channel (uint16 each).
+ * @return  Length of the record in bytes
+ */
+unsigned stats_record(uint8_t *buf);
+
+/** @brief Length in bytes of each record */
+unsigned stats_record_len();
+
+/** @brief Number of sequences per window, as collected */
+unsigned stats_window_len();
+
+/** @} End STATS */
+
+#endif // STATS_H
@@ -8,11 +8,14 @@
 #include "config.h"
 #include "pin_assign.h"
 #include "error.h"
+#include "main_loop.h"
 
 #include "systick.h"
 
 uint32_t ticks = 0;
 
+static unsigned flush_tick_users; // see flush_tick_user_t
+
 void systick_start()
 {
     LOG("systick: start\r\n");
@@ -44,7 +47,20 @@ void systick_reset()
     ticks = 0;
 }
 
-#ifdef CONFIG_SYSTICK_32BIT
+void systick_start_flush_tick(unsigned user)
+{
+    flush_tick_users |= user;
+    TA2CCR1 = TA2R + CONFIG_STREAM_FLUSH_INTERVAL;
+    TA2CCTL1 = CCIE; // compare mode
+}
+
+void systick_stop_flush_tick(unsigned user)
+{
+    flush_tick_users &= ~user;
+    if (!flush_tick_users)
+        TA2CCTL1 = 0;
+}
+
 #if defined(__TI_COMPILER_VERSION__) || defined(__IAR_SYSTEMS_ICC__)
 #pragma vector=TIMER2_A1_VECTOR
 __interrupt void TIMER2_A1_ISR (void)
@@ -54,7 +70,17 @@ void __attribute__ ((interrupt(TIMER2_A1_VECTOR))) TIMER2_A1_ISR (void)
 #error Compiler not supported!
 #endif
 {
-    ticks += 0x10000UL;
-    TA2CTL &= ~TAIFG;
-}
+    switch (__even_in_range(TA2IV, TA2IV_TAIFG)) { // clears the flag
+        case TA2IV_TACCR1:
+            TA2CCR1 += CONFIG_STREAM_FLUSH_INTERVAL;
+            main_loop_flags |= FLAG_STREAM_FLUSH;
+            break;
+#ifdef CONFIG_SYSTICK_32BIT
+        case TA2IV_TAIFG:
+            ticks += 0x10000UL;
+            break;
 #endif // CONFIG_SYSTICK_32BIT
+        default:
+            break;
+    }
+}
@@ -26,4 +26,23 @@ void systick_start();
 void systick_stop();
 void systick_reset();
 
+/**
+ * @brief	Users of the stream flush tick
+ */
+typedef enum {
+    FLUSH_TICK_STREAMS  = 0x01, //!< the host streams (see USB_CMD_STREAM_BEGIN)
+    FLUSH_TICK_ENERGY   = 0x02, //!< the energy accounting reports
+} flush_tick_user_t;
+
+/**
+ * @brief	Start/stop the periodic stream flush tick
+ * @param   user    Which user starts or stops it (see flush_tick_user_t)
+ * @details Sets FLAG_STREAM_FLUSH every CONFIG_STREAM_FLUSH_INTERVAL cycles of
+ *          the systick timer, on a compare register of the same timer. The
+ *          tick runs as long as any user has it started. Starting it again
+ *          restarts the interval, as after a systick_reset.
+ */
+void systick_start_flush_tick(unsigned user);
+void systick_stop_flush_tick(unsigned user);
+
 #endif // SYSTICK_H
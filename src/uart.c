@@ -1,4 +1,7 @@
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
 #include <msp430.h>
 
 #include <libmsp/periph.h>
@@ -11,36 +14,228 @@
 #include "error.h"
 #include "main_loop.h"
 #include "dma.h"
+#include "crc16.h"
+#ifdef CONFIG_SYSTICK
+#include "systick.h"
+#endif // CONFIG_SYSTICK
 
 #include "uart.h"
+#include "uart_baud.h" // after uart.h, for CONFIG_UART_CLOCK_FREQ
 
 // TODO: rename "usb" to "host"
 
 volatile unsigned host_uart_status = 0;
 
+uart_errors_t host_uart_errors;
+uint16_t target_uart_rx_overruns;
+
+#if defined(CONFIG_HOST_UART_FRAMING) && defined(CONFIG_ABORT_ON_HOST_UART_ERROR)
+#error Framing recovers from host UART errors: disable CONFIG_ABORT_ON_HOST_UART_ERROR
+#endif
+
 #ifdef UART_HOST
-static uartBuf_t usbRx = { .head = 0, .tail = 0 };
+#if !RING_SIZE_VALID(CONFIG_HOST_UART_RX_BUF_LEN)
+#error Host UART RX buffer size must be a power of two: CONFIG_HOST_UART_RX_BUF_LEN
+#endif
+
+// Commands stay in the buffer until they are run, so it must hold all the
+// longest ones a parser can hand out, with a byte to spare (see host_rx_dma_arm)
+#if UART_RX_MAX_HELD_PKTS * (UART_MSG_HEADER_SIZE + CONFIG_HOST_UART_RX_MAX_DATA_LEN) >= \
+        CONFIG_HOST_UART_RX_BUF_LEN
+#error Host UART RX buffer too small for the command queue: CONFIG_HOST_UART_RX_BUF_LEN
+#endif
+
+#ifdef CONFIG_HOST_UART_FRAMING
+// every byte escaped, not counting the END
+#define HOST_FRAME_MAX_ESCAPED_LEN(max_len) \
+    (2 * (UART_MSG_HEADER_SIZE + (max_len) + UART_FRAME_CRC_LEN))
+
+#if HOST_FRAME_MAX_ESCAPED_LEN(CONFIG_HOST_UART_RX_MAX_DATA_LEN) >= CONFIG_HOST_UART_RX_BUF_LEN
+#error Host UART RX buffer too small for the longest frame: CONFIG_HOST_UART_RX_BUF_LEN
+#endif
+#endif // CONFIG_HOST_UART_FRAMING
+
+// Payloads are handed out in place and read as words, so the storage is
+// word-aligned, with room past the end to unwrap a payload that wraps around.
+static uint16_t usbRxStorage[(CONFIG_HOST_UART_RX_BUF_LEN + CONFIG_HOST_UART_RX_MAX_DATA_LEN + 1) /
+                             sizeof(uint16_t)];
+static ring_t usbRx = RING_INIT(usbRxStorage, CONFIG_HOST_UART_RX_BUF_LEN);
+static uartRxParser_t usbRxParser = {
+    .rxbuf = &usbRx, .state = CONSTRUCT_STATE_HEADER,
+    .max_len = CONFIG_HOST_UART_RX_MAX_DATA_LEN,
+};
+
+#ifdef CONFIG_USB_UART_BAUDRATE_UCOS16
+#define HOST_BOOT_BAUD_MCTL (UCOS16 | BRF_BITS(CONFIG_USB_UART_BAUDRATE_BRF))
+#else // !CONFIG_USB_UART_BAUDRATE_UCOS16
+#define HOST_BOOT_BAUD_MCTL BRS_BITS(CONFIG_USB_UART_BAUDRATE_BRS)
+#endif // !CONFIG_USB_UART_BAUDRATE_UCOS16
+
+// The configured rate, set up on boot, and the one the host can always fall back to
+static const uart_baud_t host_boot_baud = {
+    .baud = CONFIG_USB_UART_BAUDRATE,
+    .br = (CONFIG_USB_UART_BAUDRATE_BR1 << 8) | CONFIG_USB_UART_BAUDRATE_BR0,
+    .mctl = HOST_BOOT_BAUD_MCTL,
+};
+static const uart_baud_t *host_baud = &host_boot_baud;
+
+#ifdef UART_BAUD_TABLE
+static const uart_baud_t host_bauds[] = { UART_BAUD_TABLE };
+#endif // UART_BAUD_TABLE
 #endif // UART_HOST
 
 #ifdef UART_TARGET
-static uartBuf_t wispRx = { .head = 0, .tail = 0 };
-static uartBuf_t wispTx = { .head = 0, .tail = 0 };
+#if !RING_SIZE_VALID(UART_BUF_MAX_LEN)
+#error Target UART buffer size must be a power of two: UART_BUF_MAX_LEN
+#endif
+
+static uint16_t wispRxStorage[(UART_BUF_MAX_LEN + UART_PKT_MAX_DATA_LEN + 1) / sizeof(uint16_t)];
+static uint8_t wispTxStorage[UART_BUF_MAX_LEN];
+static ring_t wispRx = RING_INIT(wispRxStorage, UART_BUF_MAX_LEN);
+static ring_t wispTx = RING_INIT(wispTxStorage, UART_BUF_MAX_LEN);
+static uartRxParser_t wispRxParser = {
+    .rxbuf = &wispRx, .state = CONSTRUCT_STATE_HEADER,
+    .max_len = UART_PKT_MAX_DATA_LEN,
+};
 #endif // UART_TARGET
 
+#if defined(UART_HOST) && defined(DMA_HOST_UART_RX)
+
+static unsigned host_rx_dma_end; // position in the buffer where the armed transfer ends
+
 /**
- * @brief       Determine the length of the circular buffer
- * @param       buf        Pointer to the circular buffer
- * @return      Length of the buffer
+ * @brief   Start the RX DMA at the tail of the host RX buffer
+ * @details Single transfer up to the end of the buffer, or up to one byte
+ *          short of the head, whichever comes first, so that the DMA never
+ *          writes over bytes not yet consumed and a full ring does not read
+ *          as empty (see ring_publish). The position is what is left of the
+ *          count. The DMA ISR re-arms where the transfer ended. With no room
+ *          at all, the DMA stays off until host_rx_sync finds some: the UART
+ *          holds one byte meanwhile, and flags an overrun on the next one.
+ *          Level trigger, so a byte that is already waiting is taken.
  */
-static inline unsigned uartBuf_len(uartBuf_t *buf) {
-    int diff = buf->tail - buf->head;
-    if(diff >= 0) {
-        return diff;
-    } else {
-        return (diff + UART_BUF_MAX_LEN_WITH_TAIL);
+static void host_rx_dma_arm(unsigned start)
+{
+    unsigned len, room;
+
+    DMA(DMA_HOST_UART_RX, CTL) &= ~DMAEN;
+
+    len = ring_size(&usbRx) - start;
+    room = ring_free(&usbRx) - 1;
+    if (len > room)
+        len = room;
+    host_rx_dma_end = start + len;
+
+    if (!len) {
+        host_uart_status |= UART_STATUS_RX_STALLED;
+        return;
     }
+    host_uart_status &= ~UART_STATUS_RX_STALLED;
+
+    // A byte came in while the DMA was off, before the one waiting was taken
+    // (cleared when the DMA reads the waiting byte)
+    if (UART(UART_HOST, STAT) & UCOE)
+        host_uart_errors.overrun++;
+
+    // the trigger select register is shared with another channel
+    DMA_CTL(DMA_HOST_UART_RX_CTL) =
+        (DMA_CTL(DMA_HOST_UART_RX_CTL) & ~DMA_TRIG(DMA_HOST_UART_RX, DMA_TRIG_SRC_MASK)) |
+        DMA_TRIG(DMA_HOST_UART_RX, DMA_TRIG_UART(UART_HOST, RX));
+
+    DMA(DMA_HOST_UART_RX, CTL) =
+          DMADT_0 /* single */ |
+          DMADSTINCR_3 /* dest inc */ | DMASRCINCR_0 /* src no inc */ |
+          DMADSTBYTE | DMASRCBYTE | DMALEVEL | DMAIE;
+
+    DMA(DMA_HOST_UART_RX, SA) = (__DMA_ACCESS_REG__)(&UART(UART_HOST, RXBUF));
+    DMA(DMA_HOST_UART_RX, DA) = (__DMA_ACCESS_REG__)(&usbRx.buf[start]);
+    DMA(DMA_HOST_UART_RX, SZ) = len;
+
+    DMA(DMA_HOST_UART_RX, CTL) |= DMAEN;
+}
+
+/** @brief Publish the bytes written by the RX DMA as the buffer tail
+ *  @details With interrupts disabled, so that the DMA ISR does not re-arm
+ *           between the reads of the count and of the flag.
+ */
+static void host_rx_sync_locked()
+{
+    unsigned remaining;
+
+    if (!(host_uart_status & UART_STATUS_RX_DMA))
+        return; // the RX interrupt maintains the tail
+    if (host_uart_status & UART_STATUS_RX_STALLED)
+        return; // the tail is where the DMA stopped
+
+    // The count reloads on completion, so check the flag after the count
+    remaining = DMA(DMA_HOST_UART_RX, SZ);
+    if (DMA(DMA_HOST_UART_RX, CTL) & DMAIFG)
+        ring_publish(&usbRx, host_rx_dma_end);
+    else
+        ring_publish(&usbRx, host_rx_dma_end - remaining);
+}
+
+/** @brief Publish the bytes written by the RX DMA, and restart a stalled DMA
+ *         if bytes have been consumed since (from the main loop) */
+static inline void host_rx_sync()
+{
+    if (!(host_uart_status & UART_STATUS_RX_DMA))
+        return;
+
+    __disable_interrupt();
+    host_rx_sync_locked();
+    if ((host_uart_status & UART_STATUS_RX_STALLED) && ring_free(&usbRx) > 1)
+        host_rx_dma_arm(usbRx.tail & usbRx.mask);
+    __enable_interrupt();
+}
+
+void UART_on_host_rx_dma()
+{
+    ring_publish(&usbRx, host_rx_dma_end);
+    host_rx_dma_arm(host_rx_dma_end & usbRx.mask);
 }
 
+void UART_release_host_rx_dma()
+{
+    if (!(host_uart_status & UART_STATUS_RX_DMA))
+        return;
+
+    __disable_interrupt();
+    DMA(DMA_HOST_UART_RX, CTL) &= ~(DMAEN | DMAIE);
+    host_rx_sync_locked();
+    DMA(DMA_HOST_UART_RX, CTL) &= ~DMAIFG;
+    if ((host_uart_status & UART_STATUS_RX_STALLED) && (UART(UART_HOST, STAT) & UCOE))
+        host_uart_errors.overrun++; // the RX interrupt clears it without counting
+    host_uart_status &= ~(UART_STATUS_RX_DMA | UART_STATUS_RX_STALLED);
+    UART(UART_HOST, IE) |= UCRXIE; // takes a byte that arrived in between
+    __enable_interrupt();
+}
+
+void UART_acquire_host_rx_dma()
+{
+    if (host_uart_status & UART_STATUS_RX_DMA)
+        return;
+
+    __disable_interrupt();
+    UART(UART_HOST, IE) &= ~UCRXIE;
+    host_uart_status |= UART_STATUS_RX_DMA;
+    host_rx_dma_arm(usbRx.tail & usbRx.mask);
+    __enable_interrupt();
+}
+
+#else // !(UART_HOST && DMA_HOST_UART_RX)
+static inline void host_rx_sync() { }
+#endif // !(UART_HOST && DMA_HOST_UART_RX)
+
+#ifdef UART_HOST
+static inline void host_uart_write_baud(const uart_baud_t *rate)
+{
+    UART(UART_HOST, BR0) = rate->br & 0xFF;
+    UART(UART_HOST, BR1) = rate->br >> 8;
+    UART(UART_HOST, MCTL) = rate->mctl;
+}
+#endif // UART_HOST
+
 void UART_setup(unsigned interface)
 {
     switch(interface)
@@ -55,25 +250,15 @@ void UART_setup(unsigned interface)
         UART(UART_HOST, CTL1) |= UCRXEIE;
 #endif
 
-        UART(UART_HOST, BR0) = CONFIG_USB_UART_BAUDRATE_BR0;
-        UART(UART_HOST, BR1) = CONFIG_USB_UART_BAUDRATE_BR1;
-        UART(UART_HOST, MCTL) |= 0
-#ifdef CONFIG_USB_UART_BAUDRATE_UCOS16
-            | UCOS16
-#endif
-#ifdef CONFIG_USB_UART_BAUDRATE_BRS
-            | BRS_BITS(CONFIG_USB_UART_BAUDRATE_BRS)
-#endif
-#ifdef CONFIG_USB_UART_BAUDRATE_BRF
-            | BRF_BITS(CONFIG_USB_UART_BAUDRATE_BRF)
-#endif
-       ;
+        host_uart_write_baud(host_baud);
 
         // TX DMA
 
         DMA(DMA_HOST_UART_TX, CTL) &= ~DMAEN;
 
+        // the trigger select register is shared with another channel
         DMA_CTL(DMA_HOST_UART_TX_CTL) =
+            (DMA_CTL(DMA_HOST_UART_TX_CTL) & ~DMA_TRIG(DMA_HOST_UART_TX, DMA_TRIG_SRC_MASK)) |
             DMA_TRIG(DMA_HOST_UART_TX, DMA_TRIG_UART(UART_HOST, TX));
 
         DMACTL4 = DMARMWDIS;
@@ -88,7 +273,14 @@ void UART_setup(unsigned interface)
         // DMA(DMA_HOST_UART_TX, SZ) = set on each transfer
 
         UART(UART_HOST, CTL1) &= ~UCSWRST; // initialize USCI state machine
-        UART(UART_HOST, IE) |= UCRXIE;     // enable Tx + Rx interrupts
+
+        // RX DMA (or the RX interrupt, per byte)
+#ifdef DMA_HOST_UART_RX
+        host_uart_status |= UART_STATUS_RX_DMA;
+        host_rx_dma_arm(usbRx.tail & usbRx.mask);
+#else
+        UART(UART_HOST, IE) |= UCRXIE;     // enable Rx interrupt
+#endif
         break;
 #endif // PORT_PORT_UART_USB
 
@@ -132,6 +324,13 @@ void UART_teardown(unsigned interface)
 #ifdef UART_HOST
         case UART_INTERFACE_USB:
             UART(UART_HOST, IE) &= ~UCRXIE;   // disable Tx + Rx interrupts
+#ifdef DMA_HOST_UART_RX
+            if (host_uart_status & UART_STATUS_RX_DMA) {
+                host_rx_sync();
+                DMA(DMA_HOST_UART_RX, CTL) &= ~(DMAEN | DMAIE | DMAIFG);
+                host_uart_status &= ~(UART_STATUS_RX_DMA | UART_STATUS_RX_STALLED);
+            }
+#endif
             UART(UART_HOST, CTL1) |= UCSWRST; // put state machine in reset
             GPIO(PORT_UART_USB, SEL) &=
                 ~(BIT(PIN_UART_USB_TX) | BIT(PIN_UART_USB_RX));
@@ -158,11 +357,12 @@ unsigned UART_RxBufEmpty(unsigned interface)
     {
 #ifdef UART_HOST
     case UART_INTERFACE_USB:
-        return usbRx.head == usbRx.tail;
+        host_rx_sync();
+        return ring_empty(&usbRx);
 #endif // PORT_UART_USB
 #ifdef UART_TARGET
     case UART_INTERFACE_WISP:
-        return wispRx.head == wispRx.tail;
+        return ring_empty(&wispRx);
 #endif
     default:
         return 0;
@@ -170,156 +370,693 @@ unsigned UART_RxBufEmpty(unsigned interface)
 }
 
 /**
- * @brief       Copy an array of bytes into a uartBuf_t circular buffer
- * @param       bufInto     Pointer to a uartBuf_t structure to which bytes will be copied
- * @param       bufFrom     Pointer to a byte array from which bytes will be copied
- * @param       len         Number of bytes to copy
- * @warning     This function does not check if there is enough space to copy the bytes.
- *              It will overwrite anything in its way.
+ * @brief       Make the data of a received packet contiguous and aligned, in place
+ * @param       rxbuf       Circular buffer that holds the packet
+ * @param       start       Index of the first data byte in the buffer
+ * @param       len         Number of data bytes
+ * @return      Pointer to the data
+ * @details     Data is moved only when it wraps around the end of the buffer
+ *              (the wrapped part is continued past the end), or when it is at
+ *              an odd address because of an odd-length packet before it (it is
+ *              moved down onto the padding byte of its own header).
+ */
+static uint8_t *rx_data_in_place(ring_t *rxbuf, unsigned start, unsigned len)
+{
+    uint8_t *data = &rxbuf->buf[start];
+
+    if (start + len > ring_size(rxbuf))
+        memcpy(&rxbuf->buf[ring_size(rxbuf)], rxbuf->buf, start + len - ring_size(rxbuf));
+
+    if (start & 0x1) {
+        memmove(data - 1, data, len);
+        --data;
+    }
+
+    return data;
+}
+
+static inline bool rx_identifier_known(unsigned identifier)
+{
+    return identifier == UART_IDENTIFIER_USB || identifier == UART_IDENTIFIER_USB_EXT ||
+           identifier == UART_IDENTIFIER_USB_TAGGED || identifier == UART_IDENTIFIER_WISP;
+}
+
+/**
+ * @brief       Decode a message header
+ * @param       offset      Index of the header from the tail of the buffer
+ * @return      Whether the identifier is known
+ * @details     Extended and tagged host messages come out with the plain
+ *              identifier, since they are from the same source.
  */
-static void uartBuf_copyTo(uartBuf_t *bufInto, uint8_t *bufFrom, unsigned len)
+static bool rx_header(ring_t *rxbuf, unsigned offset, uartPkt_t *pkt)
 {
-    while(len--) {
-        ASSERT(ASSERT_UART_ERROR_CIRC_BUF_OVERFLOW, bufInto->tail < UART_BUF_MAX_LEN_WITH_TAIL);
-        bufInto->buf[bufInto->tail] = *bufFrom++; // copy byte
-        bufInto->tail = (bufInto->tail + sizeof(uint8_t)) % UART_BUF_MAX_LEN_WITH_TAIL;   // set tail of circular buffer
+    unsigned identifier = ring_peek(rxbuf, offset);
+
+    if (!rx_identifier_known(identifier))
+        return false;
+
+    pkt->identifier = identifier;
+    pkt->descriptor = ring_peek(rxbuf, offset + 1);
+    pkt->length = ring_peek(rxbuf, offset + 2);
+    pkt->tag = UART_TAG_NONE;
+
+    if (identifier == UART_IDENTIFIER_USB_EXT) {
+        pkt->identifier = UART_IDENTIFIER_USB;
+        pkt->length |= ring_peek(rxbuf, offset + 3) << 8;
+    } else if (identifier == UART_IDENTIFIER_USB_TAGGED) {
+        pkt->identifier = UART_IDENTIFIER_USB;
+        pkt->tag = ring_peek(rxbuf, offset + 3);
+    }
+    // otherwise followed by padding
+
+    return true;
+}
+
+/** @brief Release the packets at the front that are processed */
+static void rx_release(uartRxParser_t *parser)
+{
+    while (parser->num_held && parser->held[0].pkt->processed) {
+        ring_drop(parser->rxbuf, parser->held[0].len);
+        parser->base -= parser->held[0].len;
+        --parser->num_held;
+        memmove(&parser->held[0], &parser->held[1], parser->num_held * sizeof(uartRxHeld_t));
+    }
+}
+
+/** @brief Whether a packet handed out before is still held */
+static bool rx_held(uartRxParser_t *parser, const uartPkt_t *pkt)
+{
+    unsigned i;
+
+    for (i = 0; i < parser->num_held; ++i) {
+        if (parser->held[i].pkt == pkt)
+            return true;
+    }
+    return false;
+}
+
+/** @brief Keep the bytes of a packet handed out, until it is released */
+static void rx_hold(uartRxParser_t *parser, const uartPkt_t *pkt, unsigned len)
+{
+    parser->held[parser->num_held].pkt = pkt;
+    parser->held[parser->num_held].len = len;
+    parser->num_held++;
+    parser->base += len;
+}
+
+/** @brief Drop bytes at the parse position (released with the packet before them, if held) */
+static void rx_skip(uartRxParser_t *parser, unsigned len)
+{
+    if (parser->num_held) {
+        parser->held[parser->num_held - 1].len += len;
+        parser->base += len;
+    } else {
+        ring_drop(parser->rxbuf, len);
     }
 }
 
+#if defined(UART_HOST) && defined(CONFIG_HOST_UART_FRAMING)
 /**
- * @brief       Copy bytes from a uartBuf_t circular buffer into an array of bytes
- * @param       bufFrom     Pointer to a uartBuf_t structure from which bytes will be copied
- * @param       bufInto     Pointer to a byte array to which bytes will be copied
- * @param       len         Number of bytes to copy
- * @warning     This function does not check if there is enough space to copy the bytes.
- *              It will overwrite anything in its way.
+ * @brief       Take the next frame from the buffer, if it is all in
+ * @return      Same as UART_buildRxPkt
+ * @details     The frame is unescaped in place (it can only get shorter), so
+ *              the packet data points into the buffer as without framing. A
+ *              bad frame is dropped up to and including its END byte.
  */
-static void uartBuf_copyFrom(uartBuf_t *bufFrom, uint8_t *bufInto, unsigned len)
+static unsigned build_framed_pkt(uartRxParser_t *parser, uartPkt_t *pkt)
 {
-    while(len--) {
-        ASSERT(ASSERT_UART_ERROR_CIRC_BUF_OVERFLOW, bufFrom->head < UART_BUF_MAX_LEN_WITH_TAIL);
-        *bufInto++ = bufFrom->buf[bufFrom->head]; // copy byte
-        bufFrom->head = (bufFrom->head + sizeof(uint8_t)) % UART_BUF_MAX_LEN_WITH_TAIL;   // set head of circular buffer
+    ring_t *rxbuf = parser->rxbuf;
+    unsigned base = parser->base;
+    unsigned len = ring_len(rxbuf) - base;
+    unsigned end, i, n;
+    uint16_t crc = CRC16_INIT;
+    uint8_t byte;
+
+    // skip the delimiters between frames
+    while (len && parser->scanned == 0 && ring_peek(rxbuf, base) == UART_SLIP_END) {
+        rx_skip(parser, 1);
+        base = parser->base;
+        --len;
     }
+
+    for (end = parser->scanned; end < len; ++end) {
+        if (ring_peek(rxbuf, base + end) == UART_SLIP_END)
+            break;
+    }
+
+    if (end == len) {
+        // no END where there should have been one
+        if (len > HOST_FRAME_MAX_ESCAPED_LEN(parser->max_len)) {
+            rx_skip(parser, len);
+            parser->scanned = 0;
+            host_uart_errors.framing++;
+            return 1;
+        }
+        parser->scanned = len;
+        return 2; // packet construction will resume the next time this function is called
+    }
+    parser->scanned = 0;
+
+    n = 0;
+    for (i = 0; i < end; ++i) {
+        byte = ring_peek(rxbuf, base + i);
+        if (byte == UART_SLIP_ESC) {
+            byte = (++i < end) ? ring_peek(rxbuf, base + i) : 0;
+            if (byte == UART_SLIP_ESC_END)
+                byte = UART_SLIP_END;
+            else if (byte == UART_SLIP_ESC_ESC)
+                byte = UART_SLIP_ESC;
+            else
+                goto bad_frame;
+        }
+        rxbuf->buf[ring_index(rxbuf, base + n++)] = byte;
+        crc = crc16_update(crc, byte);
+    }
+
+    if (n < UART_MSG_HEADER_SIZE + UART_FRAME_CRC_LEN)
+        goto bad_frame;
+
+    if (crc != 0) {
+        host_uart_errors.crc++;
+        goto drop_frame;
+    }
+
+    if (!rx_header(rxbuf, base, pkt) || pkt->identifier != UART_IDENTIFIER_USB)
+        goto bad_frame;
+
+    if (pkt->length > parser->max_len ||
+        UART_MSG_HEADER_SIZE + pkt->length + UART_FRAME_CRC_LEN != n)
+        goto bad_frame;
+
+    pkt->data = rx_data_in_place(rxbuf,
+            ring_index(rxbuf, base + UART_MSG_HEADER_SIZE), pkt->length);
+
+    // released on a later call, once the packet is processed
+    rx_hold(parser, pkt, end + 1);
+
+    pkt->processed = 0;
+    return 0;
+
+bad_frame:
+    host_uart_errors.framing++;
+drop_frame:
+    rx_skip(parser, end + 1);
+    return 1;
 }
+#endif // UART_HOST && CONFIG_HOST_UART_FRAMING
 
 unsigned UART_buildRxPkt(unsigned interface, uartPkt_t *pkt)
 {
-    static pktConstructState_t state = CONSTRUCT_STATE_IDENTIFIER;
-    uartBuf_t *uartBuf;
+    uartRxParser_t *parser;
+    ring_t *rxbuf;
+    unsigned base;
     unsigned minUartBufLen; // the buffer length may change if bytes are received while
                            // this function is executing, but there are at least this
                            // many bytes
-    uint8_t pkt_byte;
-
-    if(!(pkt->processed)) {
-        // don't overwrite the existing RX packet
-        return 1;
-    }
 
     switch(interface)
     {
 #ifdef UART_HOST
     case UART_INTERFACE_USB:
-        uartBuf = &usbRx;
+        parser = &usbRxParser;
+        host_rx_sync();
         break;
 #endif // PORT_UART_USB
 #ifdef UART_TARGET
     case UART_INTERFACE_WISP:
-        uartBuf = &wispRx;
+        parser = &wispRxParser;
         break;
 #endif // PORT_UART_TARGET
     default:
         // unknown interface
-        state = CONSTRUCT_STATE_IDENTIFIER;
         pkt->processed = 1;
         return 1;
     }
 
-    minUartBufLen = uartBuf_len(uartBuf);
-    while(minUartBufLen > 0) {
-        switch(state)
-        {
-        case CONSTRUCT_STATE_IDENTIFIER:
-            // copy identifier to packet structure
-            uartBuf_copyFrom(uartBuf, &pkt_byte, sizeof(uint8_t));
-            pkt->identifier = pkt_byte;
-            if(pkt->identifier != UART_IDENTIFIER_USB &&
-                                    pkt->identifier != UART_IDENTIFIER_WISP) {
-                // unknown identifier
-                pkt->processed = 1; // reset packet processed state
-                state = CONSTRUCT_STATE_IDENTIFIER;
-                return 1;
-            }
-            minUartBufLen -= sizeof(uint8_t);
-            state = CONSTRUCT_STATE_DESCRIPTOR;
-            break;
-        case CONSTRUCT_STATE_DESCRIPTOR:
-            // copy descriptor
-            uartBuf_copyFrom(uartBuf, &pkt_byte, sizeof(uint8_t));
-            pkt->descriptor = pkt_byte;
-            minUartBufLen -= sizeof(uint8_t);
-            state = CONSTRUCT_STATE_DATA_LEN;
-            break;
-        case CONSTRUCT_STATE_DATA_LEN:
-            uartBuf_copyFrom(uartBuf, &pkt_byte, sizeof(uint8_t));
-            pkt->length = pkt_byte;
-            minUartBufLen -= sizeof(uint8_t);
-            state = CONSTRUCT_STATE_PADDING;
-            break;
-        case CONSTRUCT_STATE_PADDING:
-        {
-            uartBuf_copyFrom(uartBuf, &pkt_byte, sizeof(uint8_t));
-            minUartBufLen -= sizeof(uint8_t);
-            if (pkt->length > 0) {
-                state = CONSTRUCT_STATE_DATA;
-            } else { // done
-                pkt->processed = 0;
-                state = CONSTRUCT_STATE_IDENTIFIER;
-                return 0;   // packet construction succeeded
-            }
-            break;
+    if(!(pkt->processed)) {
+        // don't overwrite the existing RX packet
+        return 1;
+    }
+
+    rxbuf = parser->rxbuf;
+
+    // processed packets no longer need their bytes
+    rx_release(parser);
+    if (parser->num_held == UART_RX_MAX_HELD_PKTS || rx_held(parser, pkt))
+        return 2;
+
+#if defined(UART_HOST) && defined(CONFIG_HOST_UART_FRAMING)
+    if (parser == &usbRxParser)
+        return build_framed_pkt(parser, pkt);
+#endif // UART_HOST && CONFIG_HOST_UART_FRAMING
+
+    // The header stays at the parse position until the whole packet is in,
+    // so each call only looks at what is needed for its state.
+    base = parser->base;
+    minUartBufLen = ring_len(rxbuf) - base;
+
+    switch(parser->state)
+    {
+    case CONSTRUCT_STATE_HEADER:
+        if (minUartBufLen == 0)
+            return 2;
+
+        // resynchronize on the identifier as soon as it is in
+        if (!rx_identifier_known(ring_peek(rxbuf, base))) {
+            // unknown identifier
+            rx_skip(parser, sizeof(uint8_t));
+            return 1;
+        }
+
+        if (minUartBufLen < UART_MSG_HEADER_SIZE)
+            return 2;
+
+        rx_header(rxbuf, base, pkt);
+
+        if (pkt->length > parser->max_len) {
+            rx_skip(parser, UART_MSG_HEADER_SIZE); // drop the header
+            return 1;
+        }
+
+        parser->state = CONSTRUCT_STATE_DATA;
+        // fall through
+    case CONSTRUCT_STATE_DATA:
+        if (minUartBufLen < UART_MSG_HEADER_SIZE + pkt->length)
+            return 2; // packet construction will resume the next time this function is called
+
+        pkt->data = rx_data_in_place(rxbuf,
+                ring_index(rxbuf, base + UART_MSG_HEADER_SIZE), pkt->length);
+
+        // released on a later call, once the packet is processed
+        rx_hold(parser, pkt, UART_MSG_HEADER_SIZE + pkt->length);
+        parser->state = CONSTRUCT_STATE_HEADER;
+
+        // mark this packet as unprocessed
+        pkt->processed = 0;
+        return 0; // packet construction succeeded
+    default:
+        // unknown state, so reset the packet construction state
+        pkt->processed = 1;
+        parser->state = CONSTRUCT_STATE_HEADER;
+        return 1;       // packet construction failed
+    }
+}
+
+#ifdef UART_HOST
+#if !RING_SIZE_VALID(CONFIG_HOST_UART_TX_QUEUE_LEN)
+#error Host UART TX queue length must be a power of two: CONFIG_HOST_UART_TX_QUEUE_LEN
+#endif
+#define HOST_TX_QUEUE_MASK (CONFIG_HOST_UART_TX_QUEUE_LEN - 1)
+
+#if CONFIG_HOST_UART_TX_POOL_LEN > 255
+#error Host UART TX descriptors are indexed by a byte: CONFIG_HOST_UART_TX_POOL_LEN
+#endif
+
+// When a message is queued, to measure how long it waits (see USB_RSP_TX_STATS)
+#ifdef CONFIG_SYSTICK_32BIT
+typedef uint32_t host_tx_time_t;
+#else // !CONFIG_SYSTICK_32BIT
+typedef uint16_t host_tx_time_t;
+#endif // !CONFIG_SYSTICK_32BIT
+
+#ifdef CONFIG_SYSTICK
+#define HOST_TX_NOW() ((host_tx_time_t)SYSTICK_CURRENT_TIME)
+#else // !CONFIG_SYSTICK
+#define HOST_TX_NOW() 0
+#endif // !CONFIG_SYSTICK
+
+/** @brief A message queued for the host TX DMA, sent one segment at a time */
+typedef struct {
+    UART_segment_t segs[1 + UART_TX_MAX_SEGMENTS]; // the first starts with the UART header
+    unsigned num_segs;
+    unsigned seg; // the one being sent
+    unsigned len; // of all segments, charged to its source by the arbitration
+    host_tx_time_t queued;
+    UART_tx_release_t release;
+    unsigned arg;
+    uint8_t header[UART_MSG_HEADER_SIZE + UART_TX_MAX_HEADER_LEN]; // unless in place
+    volatile bool busy; // taken by the main loop, given back by the DMA ISR once sent
+} host_tx_msg_t;
+
+// The sources share one pool of message descriptors, most of them being
+// idle at any one time
+static host_tx_msg_t host_tx_pool[CONFIG_HOST_UART_TX_POOL_LEN];
+
+// One queue per source (tx_source_t) of descriptors from the pool, each with
+// a single producer (main loop) and a single consumer (DMA ISR), and
+// free-running indexes. A message stays at the head of its queue until it
+// is sent.
+typedef struct {
+    uint8_t msgs[CONFIG_HOST_UART_TX_QUEUE_LEN]; // index in host_tx_pool
+    volatile unsigned head;
+    volatile unsigned tail;
+} host_tx_queue_t;
+
+static host_tx_queue_t host_tx_queues[TX_SOURCE_COUNT];
+
+/** @brief The message at a position in the queue of a source */
+static inline host_tx_msg_t *host_tx_at(const host_tx_queue_t *queue, unsigned pos)
+{
+    return &host_tx_pool[queue->msgs[pos & HOST_TX_QUEUE_MASK]];
+}
+
+// Arbitration between the queues, from the DMA ISR or with interrupts disabled
+static host_tx_msg_t *host_tx_cur; // the message being sent (or NULL)
+static unsigned host_tx_cur_source;
+static unsigned host_tx_turn = TX_SOURCE_CONTROL + 1; // the stream whose round it is
+static uint32_t host_tx_deficit[TX_SOURCE_COUNT]; // bytes a stream may still send this round
+static uart_tx_delay_t host_tx_delays[TX_SOURCE_COUNT];
+
+uint16_t host_tx_weights[TX_SOURCE_COUNT] = { 1, 1, 1, 1, 1 };
+
+// Tag of the request that messages queued by the main loop reply to
+static unsigned host_reply_tag = UART_TAG_NONE;
+
+/** @brief Tag of a message to the host: only replies carry one, not the
+ *         stream frames that a command happens to send along the way */
+static inline unsigned host_tx_tag(unsigned source)
+{
+    return source == TX_SOURCE_CONTROL ? host_reply_tag : UART_TAG_NONE;
+}
+
+static inline void host_tx_start(const uint8_t *buf, unsigned len)
+{
+    DMA(DMA_HOST_UART_TX, CTL) &= ~DMAEN; // should already be disabled, but just in case
+
+    DMA(DMA_HOST_UART_TX, SA) = (__DMA_ACCESS_REG__)buf;
+    DMA(DMA_HOST_UART_TX, SZ) = len;
+
+    DMA(DMA_HOST_UART_TX, CTL) |= DMAEN;
+}
+
+/** @brief The oldest message of a source that has not started, or NULL */
+static inline host_tx_msg_t *host_tx_peek(unsigned source)
+{
+    host_tx_queue_t *queue = &host_tx_queues[source];
+    unsigned head = queue->head;
+
+    if (host_tx_cur && source == host_tx_cur_source)
+        head++;
+    if (head == queue->tail)
+        return NULL;
+    return host_tx_at(queue, head);
+}
+
+/** @brief Credit of a stream per round, its weight in quanta */
+static inline uint32_t host_tx_quantum(unsigned source)
+{
+    return (uint32_t)MAX(host_tx_weights[source], 1) * CONFIG_HOST_TX_QUANTUM;
+}
+
+/**
+ * @brief   Choose the message to send next
+ * @details Control messages go first. The streams then take turns by
+ *          deficit round robin: each round, a stream is credited its weight
+ *          in quanta of bytes, and sends messages while they fit in its
+ *          credit. The credit of a stream with nothing queued is dropped.
+ *          The rounds until a stream can send are credited in one step, so
+ *          the time taken does not grow with the length of the messages.
+ */
+static host_tx_msg_t *host_tx_pick(unsigned *source)
+{
+    host_tx_msg_t *msg, *next = NULL;
+    unsigned src = host_tx_turn;
+    unsigned pos, next_src = 0, next_pos = 0;
+    uint32_t need, rounds, next_rounds = 0;
+
+    msg = host_tx_peek(TX_SOURCE_CONTROL);
+    if (msg) {
+        *source = TX_SOURCE_CONTROL;
+        return msg;
+    }
+
+    // the stream whose round it is goes on while its credit lasts
+    msg = host_tx_peek(src);
+    if (msg && host_tx_deficit[src] >= msg->len) {
+        host_tx_deficit[src] -= msg->len;
+        *source = src;
+        return msg;
+    }
+
+    // Then the first stream, in turn order, whose credit reaches the length
+    // of its message: the one that needs the fewest rounds, and of those the
+    // nearest (the stream whose round it was comes last).
+    for (pos = 1; pos < TX_SOURCE_COUNT; ++pos) {
+        if (++src == TX_SOURCE_COUNT)
+            src = TX_SOURCE_CONTROL + 1;
+        msg = host_tx_peek(src);
+        if (!msg) {
+            host_tx_deficit[src] = 0;
+            continue;
+        }
+        need = msg->len > host_tx_deficit[src] ? msg->len - host_tx_deficit[src] : 0;
+        rounds = need ? (need + host_tx_quantum(src) - 1) / host_tx_quantum(src) : 1;
+        if (!next || rounds < next_rounds) {
+            next = msg;
+            next_src = src;
+            next_pos = pos;
+            next_rounds = rounds;
         }
-        case CONSTRUCT_STATE_DATA:
-            if(minUartBufLen >= pkt->length) {
-                // copy the data
-                if (pkt->length > UART_PKT_MAX_DATA_LEN) {
-                    pkt->processed = 1; // reset packet processed state
-                    state = CONSTRUCT_STATE_IDENTIFIER;
-                    return 1;
+    }
+    if (!next)
+        return NULL;
+
+    // Credit those rounds: streams up to the chosen one get all of them,
+    // the ones after it one fewer (their last round has not come yet).
+    for (pos = 1; pos < TX_SOURCE_COUNT; ++pos) {
+        if (++src == TX_SOURCE_COUNT)
+            src = TX_SOURCE_CONTROL + 1;
+        if (host_tx_peek(src))
+            host_tx_deficit[src] += (next_rounds - (pos > next_pos)) * host_tx_quantum(src);
+    }
+
+    host_tx_deficit[next_src] -= next->len;
+    host_tx_turn = next_src;
+    *source = next_src;
+    return next;
+}
+
+/** @brief Make the next message the one being sent, and note how long it waited */
+static host_tx_msg_t *host_tx_advance()
+{
+    unsigned source;
+    host_tx_msg_t *msg = host_tx_pick(&source);
+    uart_tx_delay_t *delay;
+    uint32_t waited;
+
+    host_tx_cur = msg;
+    if (!msg)
+        return NULL;
+    host_tx_cur_source = source;
+
+    delay = &host_tx_delays[source];
+    waited = (host_tx_time_t)(HOST_TX_NOW() - msg->queued);
+    if (delay->msgs != 0xFFFF) {
+        delay->msgs++;
+        delay->total += waited;
+    }
+    if (waited > delay->max)
+        delay->max = waited;
+
+    return msg;
+}
+
+#ifdef CONFIG_HOST_UART_FRAMING
+
+#define HOST_TX_CHUNK_LEN 64
+
+// Frames are escaped into a pair of chunks: the DMA sends one while the
+// other is filled, from the DMA ISR. Messages leave the queue (and their
+// buffers are released) as soon as they are encoded.
+static uint8_t host_tx_chunks[2][HOST_TX_CHUNK_LEN];
+static unsigned host_tx_chunk_len[2]; // encoded bytes not yet handed to the DMA
+static unsigned host_tx_chunk_idx; // the chunk last handed to the DMA
+
+typedef enum {
+    TX_ENC_START,
+    TX_ENC_DATA,
+    TX_ENC_CRC_HIGH,
+    TX_ENC_CRC_LOW,
+    TX_ENC_END,
+} tx_enc_state_t;
+
+// Position of the encoder in the message being sent
+static tx_enc_state_t host_tx_enc_state;
+static unsigned host_tx_enc_offset; // in the current segment
+static uint16_t host_tx_enc_crc;
+
+/** @brief Escape as much of the queued messages as fits into a chunk */
+static unsigned host_tx_encode(uint8_t *out)
+{
+    host_tx_msg_t *msg;
+    const UART_segment_t *seg;
+    unsigned len = 0;
+    uint8_t byte;
+
+    while (len + 2 <= HOST_TX_CHUNK_LEN) {
+        msg = host_tx_cur;
+        if (!msg && !(msg = host_tx_advance()))
+            break;
+
+        switch (host_tx_enc_state) {
+            case TX_ENC_START:
+                out[len++] = UART_SLIP_END; // flushes any line noise before the frame
+                host_tx_enc_crc = CRC16_INIT;
+                host_tx_enc_offset = 0;
+                host_tx_enc_state = TX_ENC_DATA;
+                continue;
+            case TX_ENC_DATA:
+                if (msg->seg == msg->num_segs) {
+                    host_tx_enc_state = TX_ENC_CRC_HIGH;
+                    continue;
                 }
-                uartBuf_copyFrom(uartBuf, pkt->data, pkt->length);
-                // no need to update the minUartBufLen, since packet construction is complete
-                // mark this packet as unprocessed
-				pkt->processed = 0;
-                state = CONSTRUCT_STATE_IDENTIFIER;
-                return 0; // packet construction succeeded
-            } else {
-                // not enough data
-                return 2; // packet construction will resume the next time this function is called
-            }
-        default:
-            // unknown state, so reset the packet construction state
-            pkt->processed = 1;
-            state = CONSTRUCT_STATE_IDENTIFIER;
-            return 1;       // packet construction failed
+                seg = &msg->segs[msg->seg];
+                byte = seg->buf[host_tx_enc_offset];
+                if (++host_tx_enc_offset == seg->len) {
+                    msg->seg++;
+                    host_tx_enc_offset = 0;
+                }
+                host_tx_enc_crc = crc16_update(host_tx_enc_crc, byte);
+                break;
+            case TX_ENC_CRC_HIGH:
+                byte = host_tx_enc_crc >> 8;
+                host_tx_enc_state = TX_ENC_CRC_LOW;
+                break;
+            case TX_ENC_CRC_LOW:
+                byte = host_tx_enc_crc & 0xFF;
+                host_tx_enc_state = TX_ENC_END;
+                break;
+            case TX_ENC_END:
+            default:
+                out[len++] = UART_SLIP_END;
+                host_tx_enc_state = TX_ENC_START;
+
+                if (msg->release)
+                    msg->release(msg->arg);
+                host_tx_queues[host_tx_cur_source].head++; // the slot may be reused from here on
+                msg->busy = false; // and the descriptor
+                host_tx_cur = NULL;
+                continue;
+        }
+
+        if (byte == UART_SLIP_END) {
+            out[len++] = UART_SLIP_ESC;
+            out[len++] = UART_SLIP_ESC_END;
+        } else if (byte == UART_SLIP_ESC) {
+            out[len++] = UART_SLIP_ESC;
+            out[len++] = UART_SLIP_ESC_ESC;
+        } else {
+            out[len++] = byte;
         }
     }
 
-    // ran out of data
-    return 2;   // packet construction will resume the next time this function is called
+    return len;
+}
+
+/**
+ * @brief   Hand the next chunk to the DMA, once the previous one is sent
+ * @param   prefetch    Whether to encode into the other chunk right away
+ */
+static void host_tx_next_chunk(bool prefetch)
+{
+    unsigned idx = host_tx_chunk_idx ^ 1;
+
+    if (!host_tx_chunk_len[idx])
+        host_tx_chunk_len[idx] = host_tx_encode(host_tx_chunks[idx]);
+
+    if (!host_tx_chunk_len[idx]) {
+        host_uart_status &= ~UART_STATUS_TX_BUSY;
+        return;
+    }
+
+    host_tx_start(host_tx_chunks[idx], host_tx_chunk_len[idx]);
+    host_tx_chunk_len[idx] = 0;
+    host_tx_chunk_idx = idx;
+
+    // the other chunk was the one just sent, so it is free
+    if (prefetch)
+        host_tx_chunk_len[idx ^ 1] = host_tx_encode(host_tx_chunks[idx ^ 1]);
+}
+#endif // CONFIG_HOST_UART_FRAMING
+
+/** @brief A descriptor that is not in use, or NULL if the pool is exhausted */
+static inline host_tx_msg_t *host_tx_find_free()
+{
+    unsigned i;
+
+    for (i = 0; i < CONFIG_HOST_UART_TX_POOL_LEN; ++i) {
+        if (!host_tx_pool[i].busy)
+            return &host_tx_pool[i];
+    }
+    return NULL;
+}
+
+/** @brief Take the slot at the tail of the queue of a source and a descriptor
+ *         for it, once there are both */
+static inline host_tx_msg_t *host_tx_reserve(unsigned source)
+{
+    host_tx_queue_t *queue = &host_tx_queues[source];
+    unsigned tail = queue->tail;
+    host_tx_msg_t *msg;
+
+    while (tail - queue->head == CONFIG_HOST_UART_TX_QUEUE_LEN); // source at its cap
+    while (!(msg = host_tx_find_free())); // pool exhausted
+
+    msg->busy = true;
+    queue->msgs[tail & HOST_TX_QUEUE_MASK] = msg - host_tx_pool;
+    return msg;
 }
 
+/** @brief Append the reserved slot to its queue, and start it if the link is idle */
+static inline void host_tx_commit(unsigned source, host_tx_msg_t *msg,
+                                  UART_tx_release_t release, unsigned arg)
+{
+    unsigned i;
+
+    msg->seg = 0;
+    msg->release = release;
+    msg->arg = arg;
+    msg->len = 0;
+    for (i = 0; i < msg->num_segs; ++i)
+        msg->len += msg->segs[i].len;
+    msg->queued = HOST_TX_NOW();
+
+    __disable_interrupt();
+    host_tx_queues[source].tail++;
+    if (!(host_uart_status & UART_STATUS_TX_BUSY)) {
+        host_uart_status |= UART_STATUS_TX_BUSY;
+#ifdef CONFIG_HOST_UART_FRAMING
+        host_tx_next_chunk(false); // keep interrupts off for one chunk only
+#else // !CONFIG_HOST_UART_FRAMING
+        msg = host_tx_advance(); // the same one: the link is idle only when all queues are empty
+        host_tx_start(msg->segs[0].buf, msg->segs[0].len);
+#endif // !CONFIG_HOST_UART_FRAMING
+    }
+    __enable_interrupt();
+}
+#endif // UART_HOST
+
 static inline unsigned write_header(uint8_t *buf,
                                     unsigned identifier, unsigned descriptor,
-                                    unsigned payload_len)
+                                    unsigned payload_len, unsigned tag)
 {
     unsigned len = 0;
 
+    // only messages to the host have an extended or tagged form
+    if (identifier == UART_IDENTIFIER_USB) {
+        if (payload_len > UART_MSG_MAX_SHORT_LEN)
+            identifier = UART_IDENTIFIER_USB_EXT; // no room left for the tag
+        else if (tag != UART_TAG_NONE)
+            identifier = UART_IDENTIFIER_USB_TAGGED;
+    }
+
     buf[len++] = identifier;
     buf[len++] = descriptor;
-    buf[len++] = payload_len;
-    buf[len++] = 0; // padding
+    buf[len++] = payload_len & 0xFF;
+    if (identifier == UART_IDENTIFIER_USB_TAGGED)
+        buf[len++] = tag;
+    else
+        buf[len++] = payload_len >> 8; // padding, unless extended
 
     len += payload_len;
 
@@ -330,84 +1067,226 @@ static inline unsigned write_header(uint8_t *buf,
 void UART_send_msg_to_target(unsigned descriptor, unsigned payload_len, uint8_t *buf)
 {
     unsigned len;
-    unsigned uartBufLen, copyLen;
+    unsigned copyLen;
     uint8_t *byte_ptr;
 
-    len = write_header(buf, UART_IDENTIFIER_WISP, descriptor, payload_len);
+    len = write_header(buf, UART_IDENTIFIER_WISP, descriptor, payload_len, UART_TAG_NONE);
 
-	// loop until we have copied all of buf into the UART TX buffer
+    // queue as much as fits, and start sending it while waiting for space for the rest
     byte_ptr = buf;
-	while(len > 0) {
-		uartBufLen = uartBuf_len(&wispTx);
-		copyLen = MIN(UART_BUF_MAX_LEN - uartBufLen, len);
-		uartBuf_copyTo(&wispTx, byte_ptr, copyLen);
-		byte_ptr += copyLen;
-		len -= copyLen;
-	}
-
-    // enable the correct interrupt to start sending data
-    UART(UART_TARGET, IE) |= UCTXIE;
+    while(len > 0) {
+        copyLen = ring_push(&wispTx, byte_ptr, len);
+        byte_ptr += copyLen;
+        len -= copyLen;
+
+        // enable the correct interrupt to start sending data
+        if (copyLen)
+            UART(UART_TARGET, IE) |= UCTXIE;
+    }
 }
 
 #ifdef UART_HOST
 
-void UART_send_msg_to_host(unsigned descriptor, unsigned payload_len, uint8_t *buf)
+void UART_queue_msg_to_host(unsigned source, unsigned descriptor,
+                            unsigned payload_len, uint8_t *buf,
+                            UART_tx_release_t release, unsigned arg)
 {
-    unsigned len;
+    host_tx_msg_t *msg = host_tx_reserve(source);
 
-    while (host_uart_status & UART_STATUS_TX_BUSY);
-    host_uart_status |= UART_STATUS_TX_BUSY;
+    msg->segs[0].buf = buf;
+    msg->segs[0].len = write_header(buf, UART_IDENTIFIER_USB, descriptor, payload_len,
+                                    host_tx_tag(source));
+    msg->num_segs = 1;
 
-    DMA(DMA_HOST_UART_TX, CTL) &= ~DMAEN; // should already be disabled, but just in case
+    host_tx_commit(source, msg, release, arg);
+}
 
-    len = write_header(buf, UART_IDENTIFIER_USB, descriptor, payload_len);
+void UART_queue_segments_to_host(unsigned source, unsigned descriptor,
+                                 const uint8_t *header, unsigned header_len,
+                                 const UART_segment_t *segs, unsigned num_segs,
+                                 UART_tx_release_t release, unsigned arg)
+{
+    host_tx_msg_t *msg = host_tx_reserve(source);
+    unsigned payload_len = header_len;
+    unsigned i;
+
+    ASSERT(ASSERT_UART_TX_SEGMENTS,
+           header_len <= UART_TX_MAX_HEADER_LEN && num_segs <= UART_TX_MAX_SEGMENTS);
+
+    msg->num_segs = 1;
+    for (i = 0; i < num_segs; ++i) {
+        if (!segs[i].len)
+            continue; // the DMA would not complete on an empty transfer
+        msg->segs[msg->num_segs++] = segs[i];
+        payload_len += segs[i].len;
+    }
 
-    DMA(DMA_HOST_UART_TX, SA) = (__DMA_ACCESS_REG__)buf;
-    DMA(DMA_HOST_UART_TX, SZ) = len;
+    write_header(msg->header, UART_IDENTIFIER_USB, descriptor, payload_len, host_tx_tag(source));
+    if (header_len)
+        memcpy(&msg->header[UART_MSG_HEADER_SIZE], header, header_len);
+    msg->segs[0].buf = msg->header;
+    msg->segs[0].len = UART_MSG_HEADER_SIZE + header_len;
 
-    DMA(DMA_HOST_UART_TX, CTL) |= DMAEN;
+    host_tx_commit(source, msg, release, arg);
+}
+
+void UART_send_msg_to_host(unsigned source, unsigned descriptor,
+                           unsigned payload_len, uint8_t *buf)
+{
+    UART_queue_msg_to_host(source, descriptor, payload_len, buf, NULL, 0);
+}
+
+bool UART_host_tx_full(unsigned source)
+{
+    host_tx_queue_t *queue = &host_tx_queues[source];
+
+    return queue->tail - queue->head == CONFIG_HOST_UART_TX_QUEUE_LEN || !host_tx_find_free();
+}
+
+void UART_get_host_tx_delays(uart_tx_delay_t *delays, bool reset)
+{
+    __disable_interrupt();
+    memcpy(delays, host_tx_delays, sizeof(host_tx_delays));
+    if (reset)
+        memset(host_tx_delays, 0, sizeof(host_tx_delays));
+    __enable_interrupt();
+}
+
+void UART_set_reply_tag(unsigned tag)
+{
+    host_reply_tag = tag;
+}
+
+#ifdef CONFIG_HOST_UART_FRAMING
+void UART_on_host_tx_dma()
+{
+    host_tx_next_chunk(true);
 }
+#else // !CONFIG_HOST_UART_FRAMING
+void UART_on_host_tx_dma()
+{
+    host_tx_msg_t *msg = host_tx_cur;
+    unsigned source = host_tx_cur_source;
+    host_tx_msg_t *next;
+
+    if (++msg->seg < msg->num_segs) {
+        host_tx_start(msg->segs[msg->seg].buf, msg->segs[msg->seg].len);
+        return;
+    }
+
+    // next one first, to keep the link busy
+    next = host_tx_advance();
+    if (next)
+        host_tx_start(next->segs[0].buf, next->segs[0].len);
+    else
+        host_uart_status &= ~UART_STATUS_TX_BUSY;
 
-static inline void UART_wait_for_tx_dma()
+    if (msg->release)
+        msg->release(msg->arg);
+
+    host_tx_queues[source].head++; // the slot may be reused from here on
+    msg->busy = false; // and the descriptor
+}
+#endif // !CONFIG_HOST_UART_FRAMING
+
+/** @brief Whether a queued message uses any part of a buffer */
+static bool host_tx_pending(const uint8_t *buf, unsigned len)
+{
+    unsigned source, i, j;
+    const host_tx_queue_t *queue;
+    const host_tx_msg_t *msg;
+    const UART_segment_t *seg;
+
+    for (source = 0; source < TX_SOURCE_COUNT; ++source) {
+        queue = &host_tx_queues[source];
+        for (i = queue->head; i != queue->tail; ++i) {
+            msg = host_tx_at(queue, i);
+            for (j = 0; j < msg->num_segs; ++j) {
+                seg = &msg->segs[j];
+                if (seg->buf < buf + len && buf < seg->buf + seg->len)
+                    return true;
+            }
+        }
+    }
+    return false;
+}
+
+void UART_wait_tx(const uint8_t *buf, unsigned len)
+{
+    while (host_tx_pending(buf, len)) {
+        __delay_cycles(10);
+    }
+}
+
+void UART_flush_tx()
 {
     while (host_uart_status & UART_STATUS_TX_BUSY) {
         __delay_cycles(10);
     }
 }
 
-void UART_begin_transmission()
+const uart_baud_t *UART_find_host_baud(uint32_t baud)
+{
+#ifdef UART_BAUD_TABLE
+    unsigned i;
+
+    for (i = 0; i < sizeof(host_bauds) / sizeof(host_bauds[0]); ++i) {
+        if (host_bauds[i].baud == baud)
+            return &host_bauds[i];
+    }
+#endif // UART_BAUD_TABLE
+    if (baud == host_boot_baud.baud)
+        return &host_boot_baud;
+    return NULL;
+}
+
+const uart_baud_t *UART_get_host_baud()
 {
-    UART_wait_for_tx_dma();
+    return host_baud;
 }
 
-void UART_end_transmission()
+void UART_set_host_baud(const uart_baud_t *rate)
 {
-    UART_wait_for_tx_dma();
+    UART_flush_tx();
+    // the last byte out of the shift register (nothing is being received:
+    // the host waits for the reply to the switch)
+    while (UART(UART_HOST, STAT) & UCBUSY);
+
+    __disable_interrupt();
+    UART(UART_HOST, CTL1) |= UCSWRST; // also clears the interrupt enables
+    host_uart_write_baud(rate);
+    UART(UART_HOST, CTL1) &= ~UCSWRST;
+    if (!(host_uart_status & UART_STATUS_RX_DMA))
+        UART(UART_HOST, IE) |= UCRXIE;
+    host_baud = rate;
+    __enable_interrupt();
+
+    // whatever came in around the switch was at the wrong rate on one side
+    host_rx_sync();
+    rx_skip(&usbRxParser, ring_len(&usbRx) - usbRxParser.base);
+    usbRxParser.state = CONSTRUCT_STATE_HEADER;
+    usbRxParser.scanned = 0;
 }
 
 #endif // UART_HOST
 
-static inline void on_rx_int(uint8_t data, uartBuf_t *rxbuf, unsigned flag)
+/** @return Whether there was space for the byte (it is dropped otherwise) */
+static inline bool on_rx_int(uint8_t data, ring_t *rxbuf, unsigned flag)
 {
-    rxbuf->buf[rxbuf->tail] = data; // copy the new byte
-
-    // update circular buffer tail
-    rxbuf->tail = (rxbuf->tail + sizeof(uint8_t)) % UART_BUF_MAX_LEN_WITH_TAIL;
+    bool stored = ring_push_byte(rxbuf, data);
 
     main_loop_flags |= flag;
+    return stored;
 }
 
 static inline void on_tx_int(volatile uint8_t *datareg, volatile uint8_t *intreg,
-                             uartBuf_t *txbuf, unsigned flag)
+                             ring_t *txbuf, unsigned flag)
 {
-    *datareg = txbuf->buf[txbuf->head];
-
-    // update circular buffer headd
-    txbuf->head = (txbuf->head + sizeof(uint8_t)) % UART_BUF_MAX_LEN_WITH_TAIL;
+    *datareg = ring_pop_byte(txbuf);
 
     main_loop_flags |= flag;
 
-    if (txbuf->head == txbuf->tail) {
+    if (ring_empty(txbuf)) {
         // the software buffer is empty
         *intreg &= ~UCTXIE; // disable TX interrupt
     }
@@ -436,9 +1315,11 @@ void __attribute__ ((interrupt(USCI_A0_VECTOR))) USCI_A0_ISR (void)
         ASSERT(ASSERT_UART_FAULT,  !(UCA0STAT & UCRXERR));
 #endif
 
-        on_rx_int(UART(UART_HOST, RXBUF), &usbRx, FLAG_UART_USB_RX);
+        if (!on_rx_int(UART(UART_HOST, RXBUF), &usbRx, FLAG_UART_USB_RX))
+            host_uart_errors.overrun++;
 #elif defined(UART_TARGET) && UART_TARGET == 0
-        on_rx_int(UART(UART_TARGET, RXBUF), &wispRx, FLAG_UART_WISP_RX);
+        if (!on_rx_int(UART(UART_TARGET, RXBUF), &wispRx, FLAG_UART_WISP_RX))
+            target_uart_rx_overruns++;
 #endif
         break;
     }
@@ -481,9 +1362,11 @@ void __attribute__ ((interrupt(USCI_A1_VECTOR))) USCI_A1_ISR (void)
         ASSERT(ASSERT_UART_FAULT,  !(UCA1STAT & UCRXERR));
 #endif
 
-        on_rx_int(UART(UART_HOST, RXBUF), &usbRx, FLAG_UART_USB_RX);
+        if (!on_rx_int(UART(UART_HOST, RXBUF), &usbRx, FLAG_UART_USB_RX))
+            host_uart_errors.overrun++;
 #elif defined(UART_TARGET) && UART_TARGET == 1
-        on_rx_int(UART(UART_TARGET, RXBUF), &wispRx, FLAG_UART_WISP_RX);
+        if (!on_rx_int(UART(UART_TARGET, RXBUF), &wispRx, FLAG_UART_WISP_RX))
+            target_uart_rx_overruns++;
 #endif
         break;
     }
@@ -4,6 +4,10 @@
 #include <libedb/target_comm.h>
 #include <libmsp/clock.h>
 
+#include "config.h"
+#include "ring.h"
+#include "host_comm.h"
+
 #define CONFIG_UART_CLOCK_FREQ CONFIG_SMCLK_FREQ
 
 // UART baudrate specification:
@@ -305,9 +309,10 @@
 /** @} End UART_MACROS */
 
 #define UART_MSG_HEADER_SIZE                    4 // marker, msg id, size, padding (must be aligned to 2)
+#define UART_MSG_MAX_SHORT_LEN                  0xFF // longest data without an extended header
+#define UART_TAG_NONE                           0x100 // not a tag (tags are one byte)
 
-#define UART_BUF_MAX_LEN                        64
-#define UART_BUF_MAX_LEN_WITH_TAIL				(UART_BUF_MAX_LEN + 1) //!< Add a byte because the tail should never point to a full byte
+#define UART_BUF_MAX_LEN                        64 //!< Size of the target UART buffers (a power of two)
 #define UART_PKT_MAX_DATA_LEN                   (UART_BUF_MAX_LEN - UART_MSG_HEADER_SIZE)
 
 // TODO: factor out a uart protocol header (even a whole library)
@@ -324,37 +329,78 @@
  * @brief       Enumeration used to place a UART message into a variable of type uartPkt_t.
  */
 typedef enum {
-    CONSTRUCT_STATE_IDENTIFIER,     //!< Currently parsing the UART identifier from the software buffer
-    CONSTRUCT_STATE_DESCRIPTOR,     //!< Currently parsing the message descriptor from the software buffer
-    CONSTRUCT_STATE_DATA_LEN,       //!< Currently parsing length of the data from the software buffer
-    CONSTRUCT_STATE_PADDING,        //!< Padding in msg header for alignment
-    CONSTRUCT_STATE_DATA            //!< Currently parsing the message data from the software buffer
+    CONSTRUCT_STATE_HEADER,         //!< Waiting for a complete message header in the software buffer
+    CONSTRUCT_STATE_DATA            //!< Waiting for the complete message data in the software buffer
 } pktConstructState_t;
 
 /**
  * @brief       UART message packet structure
  */
 typedef struct {
-    uint8_t data[UART_PKT_MAX_DATA_LEN];    //!< Data field of the UART message
+    uint8_t *data;                           //!< Data field of the UART message (in the RX buffer, word-aligned)
     unsigned identifier;                     //!< UART message identifier
     unsigned descriptor;                     //!< Message descriptor
     unsigned length;                         //!< Message data length
+    unsigned tag;                            //!< Tag of a request from the host (or UART_TAG_NONE)
     unsigned processed;                      //!< Indicates whether the packet structure is free to be overwritten
 } uartPkt_t;
 
+/** @brief Packets a parser can hand out before the first one is processed
+ *  @details One more than the command queue holds, so that a full queue
+ *           still leaves room to parse the confirmation of USB_CMD_SET_BAUD.
+ */
+#define UART_RX_MAX_HELD_PKTS (CONFIG_HOST_CMD_QUEUE_LEN + 1)
+
+/** @brief A packet handed out by a parser, whose bytes are still in the buffer */
+typedef struct {
+    const uartPkt_t *pkt;            //!< Released once processed
+    unsigned len;                    //!< Bytes it takes at the front of the buffer
+} uartRxHeld_t;
+
 /**
- * @brief       Circular buffer type for UART communication
+ * @brief       Incremental packet parser state, one per RX interface
  */
 typedef struct {
-    uint8_t buf[UART_BUF_MAX_LEN_WITH_TAIL];  //!< Circular buffer to be used for UART interfaces
-    unsigned head;                   //!< Relative buffer head
-    unsigned tail;                   //!< Relative buffer tail
-    // the tail should never point to byte that contains data
-} uartBuf_t;
+    ring_t *rxbuf;                   //!< Buffer the parser consumes (storage extends
+                                     //!< UART_PKT_MAX_DATA_LEN bytes past the ring, to
+                                     //!< unwrap a payload in place)
+    pktConstructState_t state;       //!< Position within the current message
+    uartRxHeld_t held[UART_RX_MAX_HELD_PKTS]; //!< Packets handed out, oldest first
+    unsigned num_held;               //!< Entries in held
+    unsigned base;                   //!< Bytes held at the front of the buffer (parsing starts after them)
+    unsigned max_len;                //!< Longest message data accepted
+    unsigned scanned;                //!< Bytes searched for the end of a frame so far
+} uartRxParser_t;
+
+/** @brief Errors on the host link, for the host to check (see PARAM_HOST_UART_*) */
+typedef struct {
+    uint16_t crc;                    //!< Frames dropped for a bad CRC
+    uint16_t framing;                //!< Frames dropped for a bad escape, length, or header
+    uint16_t overrun;                //!< Bytes dropped because the RX buffer was full: one
+                                     //!< per byte on the RX interrupt, one per run of bytes
+                                     //!< on the RX DMA (seen as UCOE once it is re-armed)
+} uart_errors_t;
+
+extern uart_errors_t host_uart_errors;
+
+/** @brief Bytes from the target dropped because the RX buffer was full (see PARAM_TARGET_UART_RX_OVERRUNS) */
+extern uint16_t target_uart_rx_overruns;
+
+/** @brief Delay of the messages to the host from one source, from queued to started */
+typedef struct {
+    uint16_t msgs;                   //!< Messages started (saturates)
+    uint32_t total;                  //!< Sum of their delays in systick ticks
+    uint32_t max;                    //!< Longest delay in systick ticks
+} uart_tx_delay_t;
+
+/** @brief Share of the host link of each stream source (see tx_source_t), at least 1 */
+extern uint16_t host_tx_weights[TX_SOURCE_COUNT];
 
 typedef enum {
     UART_STATUS_TX_BUSY = 0x01,
     UART_STATUS_RX_BUSY = 0x02,
+    UART_STATUS_RX_DMA = 0x04, //!< host RX is on the DMA (otherwise on the RX interrupt)
+    UART_STATUS_RX_STALLED = 0x08, //!< host RX DMA is off until bytes are consumed
 } uart_status_t;
 
 extern volatile unsigned host_uart_status;
@@ -396,6 +442,11 @@ void UART_dropBufferBytes(unsigned interface, uint8_t *buf, unsigned len);
  * @brief       Construct a UART packet from the UART buffer
  * @param       interface   UART interface to use.  See @ref UART_INTERFACES
  * @param       pkt     Pointer to a uartPkt_t structure in which to store the message
+ * @details     The packet data is not copied: it points into the RX buffer and
+ *              stays valid until the packet is marked processed, and the bytes
+ *              are released on a later call. Up to UART_RX_MAX_HELD_PKTS
+ *              packets can be handed out (each into its own structure) before
+ *              the first is processed; they must be processed in order.
  * @retval      0       Packet construction succeeded
  * @retval      1       Packet construction failure
  * @retval      2       More data is needed to finish constructing the packet
@@ -413,22 +464,117 @@ unsigned UART_buildRxPkt(unsigned interface, uartPkt_t *pkt);
 void UART_send_msg_to_target(unsigned descriptor, unsigned data_len, uint8_t *data);
 
 /**
- * @brief   Send message to host via UART
- * @param   buf             Complete msg buffer (including space for header
+ * @brief   Called from the DMA ISR once a queued message is sent
+ * @param   arg     The argument given when the message was queued
+ * @details Gives the buffer back to its owner, e.g. marks it free.
+ */
+typedef void (*UART_tx_release_t)(unsigned arg);
+
+/**
+ * @brief   Queue a message to the host via UART
+ * @param   source          Where the message comes from (tx_source_t)
+ * @param   buf             Complete msg buffer (including space for header)
  * @param   payload_len     Number of bytes in payload data (excludes msg header)
- * @details This function will fill in the payload length field in the header.
- *          Waits for UART to become available, and returns after setting up
- *          the DMA request.
+ * @param   release         Called once the message is sent (or NULL)
+ * @param   arg             Argument for the release callback
+ * @details This function will fill in the header. Messages are sent by DMA
+ *          one after the other: in the order they are queued for each
+ *          source, and control messages before stream messages (see
+ *          tx_source_t). The buffer must not be modified until it is
+ *          released. Returns right away, unless the queue of the source is
+ *          full (see UART_host_tx_full).
+ */
+void UART_queue_msg_to_host(unsigned source, unsigned descriptor,
+                            unsigned payload_len, uint8_t *buf,
+                            UART_tx_release_t release, unsigned arg);
+
+/** @brief A part of a message payload, sent as is from where it is */
+typedef struct {
+    const uint8_t *buf;
+    unsigned len;
+} UART_segment_t;
+
+#define UART_TX_MAX_HEADER_LEN  4 //!< Bytes of message header that UART_queue_segments_to_host copies
+#define UART_TX_MAX_SEGMENTS    2 //!< Payload segments per message
+
+/**
+ * @brief   Queue a message to the host via UART from separate parts
+ * @param   header          Start of the payload, copied into the queue (or NULL)
+ * @param   header_len      Bytes in header, at most UART_TX_MAX_HEADER_LEN
+ * @param   segs            Rest of the payload, sent back to back without copying
+ * @param   num_segs        Number of segments, at most UART_TX_MAX_SEGMENTS
+ * @param   release         Called once the message is sent (or NULL)
+ * @param   arg             Argument for the release callback
+ * @details The segments need no space for a header around them. Like
+ *          UART_queue_msg_to_host, their buffers must not be modified until
+ *          released, but the segment array itself is copied.
+ */
+void UART_queue_segments_to_host(unsigned source, unsigned descriptor,
+                                 const uint8_t *header, unsigned header_len,
+                                 const UART_segment_t *segs, unsigned num_segs,
+                                 UART_tx_release_t release, unsigned arg);
+
+/**
+ * @brief   Queue a message to the host via UART, without a release callback
+ * @details See UART_queue_msg_to_host. Use UART_wait_tx before modifying the
+ *          buffer again.
  */
-void UART_send_msg_to_host(unsigned descriptor, unsigned payload_len, uint8_t *buf);
+void UART_send_msg_to_host(unsigned source, unsigned descriptor,
+                           unsigned payload_len, uint8_t *buf);
+
+/** @brief  Whether queueing a message from a source would wait for a free slot */
+bool UART_host_tx_full(unsigned source);
+
+/**
+ * @brief   Get the delay of the messages from each source since the last reset
+ * @param   delays      One per source, in tx_source_t order
+ * @param   reset       Whether to start over
+ */
+void UART_get_host_tx_delays(uart_tx_delay_t *delays, bool reset);
+
+/** @brief Divider settings of the host UART for one baud rate */
+typedef struct {
+    uint32_t baud;
+    uint16_t br;                     //!< BR1:BR0
+    uint8_t mctl;                    //!< UCOS16 and BRF, or BRS
+} uart_baud_t;
 
 /**
- * @brief   Wraps transmissions (incl. buffer filling) to serialize them
- * @details Waits for DMA to complete and therefore "release" the buffer
- *          in use by the previous transmission.
+ * @brief   Look up the settings for a host baud rate
+ * @return  An entry of the generated table (see uart_baud.h), or NULL if the
+ *          rate is not supported at this UART clock
  */
-void UART_begin_transmission();
-void UART_end_transmission();
+const uart_baud_t *UART_find_host_baud(uint32_t baud);
+
+/** @brief  The rate that the host UART runs at (the configured one after boot) */
+const uart_baud_t *UART_get_host_baud();
+
+/**
+ * @brief   Switch the host UART to another baud rate
+ * @details Waits for the queued messages to go out at the old rate first.
+ *          Bytes received but not parsed yet are dropped, since they may
+ *          have been received at the wrong rate.
+ */
+void UART_set_host_baud(const uart_baud_t *rate);
+
+/**
+ * @brief   Tag the messages to the host queued from now on (see UART_IDENTIFIER_USB_TAGGED)
+ * @param   tag     Tag of the request they reply to, or UART_TAG_NONE
+ */
+void UART_set_reply_tag(unsigned tag);
+
+/**
+ * @brief   Wait until no queued message uses any part of a buffer
+ * @param   buf     Start of the buffer
+ * @param   len     Length of the buffer
+ */
+void UART_wait_tx(const uint8_t *buf, unsigned len);
+
+/** @brief  Wait until all queued messages are sent */
+void UART_flush_tx();
+
+/** @brief  Start the next queued message (from DMA ISR) */
+void UART_on_host_tx_dma();
 
 /**
  * @brief       Determine whether a software UART RX buffer is empty
@@ -438,4 +584,18 @@ void UART_end_transmission();
  */
 unsigned UART_RxBufEmpty(unsigned interface);
 
+#ifdef DMA_HOST_UART_RX
+/**
+ * @brief   Hand the host RX DMA channel over to another user
+ * @details Host RX continues on the RX interrupt, into the same buffer.
+ */
+void UART_release_host_rx_dma();
+
+/** @brief  Take the host RX DMA channel back after UART_release_host_rx_dma */
+void UART_acquire_host_rx_dma();
+
+/** @brief  Re-arm the host RX DMA at the start of the buffer (from DMA ISR) */
+void UART_on_host_rx_dma();
+#endif // DMA_HOST_UART_RX
+
 #endif // UART_H
@@ -0,0 +1,126 @@
+// Generated by scripts/gen-uart-baud.py: do not edit
+
+#ifndef UART_BAUD_H
+#define UART_BAUD_H
+
+/**
+ * @brief  Host UART rates for the UART clock: { baud, BR, MCTL }
+ * @details Within 2% of the requested rate, with at least 4 clocks per bit.
+ */
+#if CONFIG_UART_CLOCK_FREQ == 24576000
+#define UART_BAUD_TABLE \
+    {    9600,  160, UCOS16 | BRF_BITS(0)   }, /* N = 2560.0000, error 0.00% */ \
+    {   19200,   80, UCOS16 | BRF_BITS(0)   }, /* N = 1280.0000, error 0.00% */ \
+    {   38400,   40, UCOS16 | BRF_BITS(0)   }, /* N = 640.0000, error 0.00% */ \
+    {   57600,   26, UCOS16 | BRF_BITS(11)  }, /* N = 426.6667, error 0.08% */ \
+    {  115200,   13, UCOS16 | BRF_BITS(5)   }, /* N = 213.3333, error 0.16% */ \
+    {  171264,    8, UCOS16 | BRF_BITS(15)  }, /* N = 143.4978, error 0.35% */ \
+    {  230400,    6, UCOS16 | BRF_BITS(11)  }, /* N = 106.6667, error 0.31% */ \
+    {  460800,    3, UCOS16 | BRF_BITS(5)   }, /* N = 53.3333, error 0.63% */ \
+    {  500000,    3, UCOS16 | BRF_BITS(1)   }, /* N = 49.1520, error 0.31% */ \
+    {  576000,    2, UCOS16 | BRF_BITS(11)  }, /* N = 42.6667, error 0.78% */ \
+    {  921600,    1, UCOS16 | BRF_BITS(11)  }, /* N = 26.6667, error 1.25% */ \
+    { 1000000,    1, UCOS16 | BRF_BITS(9)   }, /* N = 24.5760, error 1.73% */ \
+    { 2000000,   12, BRS_BITS(2)            }, /* N = 12.2880, error 0.31% */ \
+    { 3000000,    8, BRS_BITS(2)            }, /* N = 8.1920, error 0.71% */
+#elif CONFIG_UART_CLOCK_FREQ == 24000000
+#define UART_BAUD_TABLE \
+    {    9600,  156, UCOS16 | BRF_BITS(4)   }, /* N = 2500.0000, error 0.00% */ \
+    {   19200,   78, UCOS16 | BRF_BITS(2)   }, /* N = 1250.0000, error 0.00% */ \
+    {   38400,   39, UCOS16 | BRF_BITS(1)   }, /* N = 625.0000, error 0.00% */ \
+    {   57600,   26, UCOS16 | BRF_BITS(1)   }, /* N = 416.6667, error 0.08% */ \
+    {  115200,   13, UCOS16 | BRF_BITS(0)   }, /* N = 208.3333, error 0.16% */ \
+    {  171264,    8, UCOS16 | BRF_BITS(12)  }, /* N = 140.1345, error 0.10% */ \
+    {  230400,    6, UCOS16 | BRF_BITS(8)   }, /* N = 104.1667, error 0.16% */ \
+    {  460800,    3, UCOS16 | BRF_BITS(4)   }, /* N = 52.0833, error 0.16% */ \
+    {  500000,    3, UCOS16 | BRF_BITS(0)   }, /* N = 48.0000, error 0.00% */ \
+    {  576000,    2, UCOS16 | BRF_BITS(10)  }, /* N = 41.6667, error 0.80% */ \
+    {  921600,    1, UCOS16 | BRF_BITS(10)  }, /* N = 26.0417, error 0.16% */ \
+    { 1000000,    1, UCOS16 | BRF_BITS(8)   }, /* N = 24.0000, error 0.00% */ \
+    { 1500000,    1, UCOS16 | BRF_BITS(0)   }, /* N = 16.0000, error 0.00% */ \
+    { 2000000,   12, BRS_BITS(0)            }, /* N = 12.0000, error 0.00% */ \
+    { 3000000,    8, BRS_BITS(0)            }, /* N = 8.0000, error 0.00% */
+#elif CONFIG_UART_CLOCK_FREQ == 21921792
+#define UART_BAUD_TABLE \
+    {    9600,  142, UCOS16 | BRF_BITS(12)  }, /* N = 2283.5200, error 0.02% */ \
+    {   19200,   71, UCOS16 | BRF_BITS(6)   }, /* N = 1141.7600, error 0.02% */ \
+    {   38400,   35, UCOS16 | BRF_BITS(11)  }, /* N = 570.8800, error 0.02% */ \
+    {   57600,   23, UCOS16 | BRF_BITS(13)  }, /* N = 380.5867, error 0.11% */ \
+    {  115200,   11, UCOS16 | BRF_BITS(14)  }, /* N = 190.2933, error 0.15% */ \
+    {  171264,    8, UCOS16 | BRF_BITS(0)   }, /* N = 128.0000, error 0.00% */ \
+    {  230400,    5, UCOS16 | BRF_BITS(15)  }, /* N = 95.1467, error 0.15% */ \
+    {  460800,    3, UCOS16 | BRF_BITS(0)   }, /* N = 47.5733, error 0.90% */ \
+    {  500000,    2, UCOS16 | BRF_BITS(12)  }, /* N = 43.8436, error 0.36% */ \
+    {  576000,    2, UCOS16 | BRF_BITS(6)   }, /* N = 38.0587, error 0.15% */ \
+    {  921600,    1, UCOS16 | BRF_BITS(8)   }, /* N = 23.7867, error 0.90% */ \
+    { 1000000,    1, UCOS16 | BRF_BITS(6)   }, /* N = 21.9218, error 0.36% */ \
+    { 1500000,   14, BRS_BITS(5)            }, /* N = 14.6145, error 0.07% */ \
+    { 2000000,   11, BRS_BITS(0)            }, /* N = 10.9609, error 0.36% */ \
+    { 3000000,    7, BRS_BITS(2)            }, /* N = 7.3073, error 0.78% */
+#elif CONFIG_UART_CLOCK_FREQ == 12500000
+#define UART_BAUD_TABLE \
+    {    9600,   81, UCOS16 | BRF_BITS(6)   }, /* N = 1302.0833, error 0.01% */ \
+    {   19200,   40, UCOS16 | BRF_BITS(11)  }, /* N = 651.0417, error 0.01% */ \
+    {   38400,   20, UCOS16 | BRF_BITS(6)   }, /* N = 325.5208, error 0.15% */ \
+    {   57600,   13, UCOS16 | BRF_BITS(9)   }, /* N = 217.0139, error 0.01% */ \
+    {  115200,    6, UCOS16 | BRF_BITS(13)  }, /* N = 108.5069, error 0.45% */ \
+    {  171264,    4, UCOS16 | BRF_BITS(9)   }, /* N = 72.9867, error 0.02% */ \
+    {  230400,    3, UCOS16 | BRF_BITS(6)   }, /* N = 54.2535, error 0.47% */ \
+    {  460800,    1, UCOS16 | BRF_BITS(11)  }, /* N = 27.1267, error 0.47% */ \
+    {  500000,    1, UCOS16 | BRF_BITS(9)   }, /* N = 25.0000, error 0.00% */ \
+    {  576000,    1, UCOS16 | BRF_BITS(6)   }, /* N = 21.7014, error 1.38% */ \
+    {  921600,   13, BRS_BITS(5)            }, /* N = 13.5634, error 0.45% */ \
+    { 1000000,   12, BRS_BITS(4)            }, /* N = 12.5000, error 0.00% */ \
+    { 1500000,    8, BRS_BITS(3)            }, /* N = 8.3333, error 0.50% */ \
+    { 2000000,    6, BRS_BITS(2)            }, /* N = 6.2500, error 0.00% */ \
+    { 3000000,    4, BRS_BITS(1)            }, /* N = 4.1667, error 1.00% */
+#elif CONFIG_UART_CLOCK_FREQ == 12000000
+#define UART_BAUD_TABLE \
+    {    9600,   78, UCOS16 | BRF_BITS(2)   }, /* N = 1250.0000, error 0.00% */ \
+    {   19200,   39, UCOS16 | BRF_BITS(1)   }, /* N = 625.0000, error 0.00% */ \
+    {   38400,   19, UCOS16 | BRF_BITS(8)   }, /* N = 312.5000, error 0.16% */ \
+    {   57600,   13, UCOS16 | BRF_BITS(0)   }, /* N = 208.3333, error 0.16% */ \
+    {  115200,    6, UCOS16 | BRF_BITS(8)   }, /* N = 104.1667, error 0.16% */ \
+    {  171264,    4, UCOS16 | BRF_BITS(6)   }, /* N = 70.0673, error 0.10% */ \
+    {  230400,    3, UCOS16 | BRF_BITS(4)   }, /* N = 52.0833, error 0.16% */ \
+    {  460800,    1, UCOS16 | BRF_BITS(10)  }, /* N = 26.0417, error 0.16% */ \
+    {  500000,    1, UCOS16 | BRF_BITS(8)   }, /* N = 24.0000, error 0.00% */ \
+    {  576000,    1, UCOS16 | BRF_BITS(5)   }, /* N = 20.8333, error 0.80% */ \
+    {  921600,   13, BRS_BITS(0)            }, /* N = 13.0208, error 0.16% */ \
+    { 1000000,   12, BRS_BITS(0)            }, /* N = 12.0000, error 0.00% */ \
+    { 1500000,    8, BRS_BITS(0)            }, /* N = 8.0000, error 0.00% */ \
+    { 2000000,    6, BRS_BITS(0)            }, /* N = 6.0000, error 0.00% */ \
+    { 3000000,    4, BRS_BITS(0)            }, /* N = 4.0000, error 0.00% */
+#elif CONFIG_UART_CLOCK_FREQ == 8192000
+#define UART_BAUD_TABLE \
+    {    9600,   53, UCOS16 | BRF_BITS(5)   }, /* N = 853.3333, error 0.04% */ \
+    {   19200,   26, UCOS16 | BRF_BITS(11)  }, /* N = 426.6667, error 0.08% */ \
+    {   38400,   13, UCOS16 | BRF_BITS(5)   }, /* N = 213.3333, error 0.16% */ \
+    {   57600,    8, UCOS16 | BRF_BITS(14)  }, /* N = 142.2222, error 0.16% */ \
+    {  115200,    4, UCOS16 | BRF_BITS(7)   }, /* N = 71.1111, error 0.16% */ \
+    {  171264,    3, UCOS16 | BRF_BITS(0)   }, /* N = 47.8326, error 0.35% */ \
+    {  230400,    2, UCOS16 | BRF_BITS(4)   }, /* N = 35.5556, error 1.25% */ \
+    {  460800,    1, UCOS16 | BRF_BITS(2)   }, /* N = 17.7778, error 1.25% */ \
+    {  576000,   14, BRS_BITS(2)            }, /* N = 14.2222, error 0.20% */ \
+    {  921600,    8, BRS_BITS(7)            }, /* N = 8.8889, error 0.16% */ \
+    { 1000000,    8, BRS_BITS(2)            }, /* N = 8.1920, error 0.71% */ \
+    { 1500000,    5, BRS_BITS(4)            }, /* N = 5.4613, error 0.71% */ \
+    { 2000000,    4, BRS_BITS(1)            }, /* N = 4.0960, error 0.71% */
+#elif CONFIG_UART_CLOCK_FREQ == 6250000
+#define UART_BAUD_TABLE \
+    {    9600,   40, UCOS16 | BRF_BITS(11)  }, /* N = 651.0417, error 0.01% */ \
+    {   19200,   20, UCOS16 | BRF_BITS(6)   }, /* N = 325.5208, error 0.15% */ \
+    {   38400,   10, UCOS16 | BRF_BITS(3)   }, /* N = 162.7604, error 0.15% */ \
+    {   57600,    6, UCOS16 | BRF_BITS(13)  }, /* N = 108.5069, error 0.45% */ \
+    {  115200,    3, UCOS16 | BRF_BITS(6)   }, /* N = 54.2535, error 0.47% */ \
+    {  171264,    2, UCOS16 | BRF_BITS(4)   }, /* N = 36.4934, error 1.35% */ \
+    {  230400,    1, UCOS16 | BRF_BITS(11)  }, /* N = 27.1267, error 0.47% */ \
+    {  460800,   13, BRS_BITS(5)            }, /* N = 13.5634, error 0.45% */ \
+    {  500000,   12, BRS_BITS(4)            }, /* N = 12.5000, error 0.00% */ \
+    {  576000,   10, BRS_BITS(7)            }, /* N = 10.8507, error 0.22% */ \
+    {  921600,    6, BRS_BITS(6)            }, /* N = 6.7817, error 0.47% */ \
+    { 1000000,    6, BRS_BITS(2)            }, /* N = 6.2500, error 0.00% */ \
+    { 1500000,    4, BRS_BITS(1)            }, /* N = 4.1667, error 1.00% */
+#endif // CONFIG_UART_CLOCK_FREQ
+
+#endif // UART_BAUD_H
@@ -0,0 +1,478 @@
+#include <msp430.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <libmsp/periph.h>
+#include <libedb/target_comm.h>
+
+#include "pin_assign.h"
+#include "dev_console.h"
+#include "config.h"
+#include "host_comm.h"
+#include "host_comm_impl.h"
+#include "host_cmd.h"
+#include "target_comm_impl.h"
+#include "usb_cmd.h"
+#include "adc.h"
+#include "uart.h"
+#include "systick.h"
+#include "main_loop.h"
+#include "params.h"
+#include "charge.h"
+#include "comparator.h"
+#include "codepoint.h"
+
+#ifdef CONFIG_ENABLE_RF_PROTOCOL_MONITORING
+#include "rfid.h"
+#endif
+
+#ifdef CONFIG_ENABLE_ENERGY_ACCOUNTING
+#include "energy.h"
+#endif
+
+#ifdef CONFIG_PWM_CHARGING
+#include "pwm.h"
+#endif
+
+#ifdef CONFIG_SYSTICK
+static uint16_t active_streams; // streams begun and not ended, for the flush tick
+#endif
+
+// Tags of commands whose reply is sent once they complete, from the main loop
+static unsigned charger_reply_tag = UART_TAG_NONE;
+unsigned debug_mode_reply_tag = UART_TAG_NONE;
+
+/**
+ * @brief       Switch the host UART to another rate, if the host follows (USB_CMD_SET_BAUD)
+ * @details     The reply goes out at the old rate. The host then switches too,
+ *              and repeats the command at the new rate, which gets a reply at
+ *              the new rate. Without that confirmation within
+ *              CONFIG_HOST_BAUD_CONFIRM_TIMEOUT_MS (e.g. the cable cannot
+ *              carry the rate), the link goes back to the old rate. The
+ *              parser keeps a held packet spare for the confirmation, so it
+ *              gets through even behind a full queue of commands.
+ */
+static void set_host_baud(uint32_t baud)
+{
+    static uartPkt_t confirm = { .processed = 1 }; // held by the parser past this call
+    const uart_baud_t *old_rate = UART_get_host_baud();
+    const uart_baud_t *new_rate = UART_find_host_baud(baud);
+    unsigned ms, rc;
+
+    if (!new_rate) {
+        send_return_code(RETURN_CODE_INVALID_ARGS);
+        return;
+    }
+
+    send_return_code(RETURN_CODE_SUCCESS);
+    UART_set_host_baud(new_rate);
+
+    for (ms = 0; ms < CONFIG_HOST_BAUD_CONFIRM_TIMEOUT_MS; ++ms) {
+        __delay_cycles(CONFIG_MCLK_FREQ / 1000);
+
+        while ((rc = UART_buildRxPkt(UART_INTERFACE_USB, &confirm)) == 1); // skip garbage
+        if (rc != 0)
+            continue;
+        confirm.processed = 1;
+
+        if (confirm.descriptor == USB_CMD_SET_BAUD && confirm.length >= sizeof(uint32_t) &&
+            *((uint32_t *)confirm.data) == baud) {
+            UART_set_reply_tag(confirm.tag);
+            send_return_code(RETURN_CODE_SUCCESS);
+            return;
+        }
+    }
+
+    LOG("host baud not confirmed\r\n");
+    UART_set_host_baud(old_rate);
+}
+
+void executeUSBCmd(uartPkt_t *pkt)
+{
+    uint16_t adc12Result;
+    uint16_t target_vcap, actual_vcap;
+
+#ifdef CONFIG_SCOPE_TRIGGER_SIGNAL
+    trigger_scope();
+#endif
+
+    switch(pkt->descriptor)
+    {
+    case USB_CMD_SENSE:
+        {
+            adc_chan_index_t chan_idx = (adc_chan_index_t)pkt->data[0];
+            if (pkt->length > 1 && pkt->data[1]) // oversampling exponent
+                adc12Result = ADC_read_oversampled(chan_idx, pkt->data[1]);
+            else
+                adc12Result = ADC_read(chan_idx);
+            send_voltage(adc12Result);
+            break;
+        }
+#ifdef CONFIG_PWM_CHARGING
+    case USB_CMD_SET_VCAP:
+        adc12Target = *((uint16_t *)(pkt->data));
+        setWispVoltage_block(ADC_CHAN_INDEX_VCAP, adc12Target);
+        break;
+
+    case USB_CMD_SET_VBOOST:
+        adc12Target = *((uint16_t *)(pkt->data));
+        setWispVoltage_block(ADC_CHAN_INDEX_VBOOST, adc12Target);
+        break;
+#endif
+
+#ifdef CONFIG_ENABLE_DEBUG_MODE
+    case USB_CMD_ENTER_ACTIVE_DEBUG:
+    	// todo: turn off all logging?
+        debug_mode_reply_tag = pkt->tag;
+        enter_debug_mode(INTERRUPT_TYPE_DEBUGGER_REQ, DEBUG_MODE_FULL_FEATURES);
+        break;
+
+    case USB_CMD_EXIT_ACTIVE_DEBUG:
+        debug_mode_reply_tag = pkt->tag;
+        exit_debug_mode();
+        break;
+
+    case USB_CMD_INTERRUPT:
+        debug_mode_reply_tag = pkt->tag;
+        interrupt_target();
+        break;
+
+    case USB_CMD_GET_WISP_PC:
+        target_comm_send_get_pc();
+    	while((UART_buildRxPkt(UART_INTERFACE_WISP, &wispRxPkt) != 0) ||
+    			(wispRxPkt.descriptor != WISP_RSP_ADDRESS)); // wait for response
+        forward_msg_to_host(USB_RSP_ADDRESS, wispRxPkt.data, wispRxPkt.length);
+    	wispRxPkt.processed = 1;
+    	break;
+#endif // CONFIG_ENABLE_DEBUG_MODE
+
+    case USB_CMD_STREAM_BEGIN: {
+        uint16_t streams = pkt->data[0];
+#ifdef CONFIG_ENABLE_VOLTAGE_STREAM
+        unsigned sampling_period = (pkt->data[2] << 8) | pkt->data[1];
+        unsigned adc_flags = pkt->length > 3 ? pkt->data[3] : 0; // optional
+        unsigned num_divisors = pkt->length > 4 ? pkt->length - 4 : 0; // optional
+#endif
+
+#ifdef CONFIG_SYSTICK
+        systick_reset(); // to avoid timestamp wrap-around in middle of stream
+        systick_start_flush_tick(FLUSH_TICK_STREAMS);
+        active_streams |= streams;
+#endif
+
+#ifdef CONFIG_ENABLE_RF_PROTOCOL_MONITORING
+        if (streams & STREAM_RF_EVENTS)
+            RFID_start_event_stream();
+#endif
+        if (streams & STREAM_WATCHPOINTS)
+            watchpoints_start_stream();
+
+#ifdef CONFIG_ENABLE_VOLTAGE_STREAM
+        // actions common to all adc streams
+        if (streams & ADC_STREAMS) {
+            unsigned rc = ADC_start(streams & ADC_STREAMS, sampling_period,
+                                    adc_flags, &pkt->data[4], num_divisors);
+            if (rc == RETURN_CODE_SUCCESS) {
+                main_loop_flags |= FLAG_LOGGING; // for main loop
+            } else {
+                send_return_code(rc); // the other streams run regardless
+#ifdef CONFIG_SYSTICK
+                active_streams &= ~ADC_STREAMS;
+                if (!active_streams)
+                    systick_stop_flush_tick(FLUSH_TICK_STREAMS);
+#endif
+            }
+        }
+#endif
+        break;
+    }
+
+    case USB_CMD_STREAM_END: {
+        unsigned streams = pkt->data[0];
+
+#ifdef CONFIG_ENABLE_RF_PROTOCOL_MONITORING
+        if (streams & STREAM_RF_EVENTS)
+            RFID_stop_event_stream();
+#endif
+        if (streams & STREAM_WATCHPOINTS)
+            watchpoints_stop_stream();
+
+#ifdef CONFIG_ENABLE_VOLTAGE_STREAM
+        // actions common to all adc streams
+        if (streams & ADC_STREAMS) {
+            ADC_stop();
+            main_loop_flags &= ~FLAG_LOGGING; // for main loop
+        }
+#endif
+
+#ifdef CONFIG_SYSTICK
+        active_streams &= ~streams;
+        if (!active_streams)
+            systick_stop_flush_tick(FLUSH_TICK_STREAMS);
+#endif
+        break;
+    }
+
+    case USB_CMD_SEND_RF_TX_DATA:
+		// not implemented
+		break;
+
+    case USB_CMD_ENABLE_PORT_INT_TAG_PWR:
+    	// not implemented
+    	break;
+
+    case USB_CMD_DISABLE_PORT_INT_TAG_PWR:
+    	// not implemented
+    	break;
+
+#ifdef CONFIG_PWM_CHARGING
+    case USB_CMD_PWM_ON:
+    	PWM_start();
+    	break;
+#endif
+
+    case USB_CMD_CHARGE:
+        target_vcap = *((uint16_t *)(&pkt->data[0]));
+        actual_vcap = charge_adc(target_vcap);
+        send_voltage(actual_vcap);
+        break;
+
+    case USB_CMD_DISCHARGE:
+        target_vcap = *((uint16_t *)(pkt->data));
+        actual_vcap = discharge_adc(target_vcap);
+        send_voltage(actual_vcap);
+        break;
+
+    case USB_CMD_CHARGE_CMP: {
+        target_vcap = *((uint16_t *)(pkt->data));
+        comparator_ref_t cmp_ref = (comparator_ref_t)pkt->data[2];
+        charger_reply_tag = pkt->tag;
+        charge_cmp(target_vcap, cmp_ref);
+        break;
+    }
+
+    case USB_CMD_DISCHARGE_CMP: {
+        target_vcap = *((uint16_t *)(pkt->data));
+        comparator_ref_t cmp_ref = (comparator_ref_t)pkt->data[2];
+        charger_reply_tag = pkt->tag;
+        discharge_cmp(target_vcap, cmp_ref);
+        break;
+    }
+
+    case USB_CMD_RESET_STATE:
+        reset_state();
+        send_return_code(RETURN_CODE_SUCCESS);
+        break;
+
+#ifdef CONFIG_PWM_CHARGING
+    case USB_CMD_RELEASE_POWER:
+    case USB_CMD_PWM_OFF:
+    case USB_CMD_PWM_LOW:
+    	PWM_stop();
+    	break;
+
+    case USB_CMD_SET_PWM_FREQUENCY:
+        PWM_set_freq((*((uint16_t *)(pkt->data))) - 1);
+    	break;
+
+    case USB_CMD_SET_PWM_DUTY_CYCLE:
+        PWM_set_duty_cycle(*((uint16_t *)(pkt->data)));
+    	break;
+
+    case USB_CMD_PWM_HIGH:
+    	PWM_stop();
+        GPIO(PORT_CHARGE, OUT) |= BIT(PIN_CHARGE); // output high
+    	break;
+#endif
+
+    // USB_CMD_PWM_LOW and USB_CMD_PWM_OFF do the same thing
+
+    case USB_CMD_MONITOR_MARKER_BEGIN:
+    case USB_CMD_MONITOR_MARKER_END:
+        // DEPRECATED
+        break;
+
+#ifdef CONFIG_ENABLE_DEBUG_MODE
+    case USB_CMD_BREAK_AT_VCAP_LEVEL: {
+        target_vcap = *((uint16_t *)(&pkt->data[0]));
+        energy_breakpoint_impl_t impl = (energy_breakpoint_impl_t)pkt->data[2];
+        switch (impl) {
+            case ENERGY_BREAKPOINT_IMPL_ADC:
+                break_at_vcap_level_adc(target_vcap);
+                break;
+            case ENERGY_BREAKPOINT_IMPL_CMP: {
+                comparator_ref_t cmp_ref = (comparator_ref_t)pkt->data[3];
+                break_at_vcap_level_cmp(target_vcap, cmp_ref);
+                break;
+            }
+        }
+        break;
+    }
+
+    case USB_CMD_READ_MEM:
+    {
+        uint32_t address = *((uint32_t *)(&pkt->data[0]));
+        unsigned len = pkt->data[4];
+
+        target_comm_send_read_mem(address, len);
+        while((UART_buildRxPkt(UART_INTERFACE_WISP, &wispRxPkt) != 0) ||
+                (wispRxPkt.descriptor != WISP_RSP_MEMORY)); // wait for response
+        forward_msg_to_host(USB_RSP_WISP_MEMORY, wispRxPkt.data, wispRxPkt.length);
+        wispRxPkt.processed = 1;
+        break;
+    }
+
+    case USB_CMD_WRITE_MEM:
+    {
+        uint32_t address = *((uint32_t *)(&pkt->data[0]));
+        unsigned len = pkt->data[4];
+        uint8_t *value = &pkt->data[5];
+
+        if (len > WISP_CMD_MAX_LEN - sizeof(uint32_t) - sizeof(uint8_t)) {
+            send_return_code(RETURN_CODE_BUFFER_TOO_SMALL);
+            break;
+        }
+
+        target_comm_send_write_mem(address, value, len);
+        while((UART_buildRxPkt(UART_INTERFACE_WISP, &wispRxPkt) != 0) ||
+                (wispRxPkt.descriptor != WISP_RSP_MEMORY)); // wait for response
+        wispRxPkt.processed = 1;
+
+        send_return_code(RETURN_CODE_SUCCESS); // TODO: have WISP return a code
+        break;
+    }
+#endif // CONFIG_ENABLE_DEBUG_MODE
+
+    case USB_CMD_CONT_POWER:
+    {
+        bool power_on = (bool)pkt->data[0];
+        if (power_on) {
+            continuous_power_on();
+            target_powered = true;
+        } else {
+            continuous_power_off();
+            target_powered = false;
+        }
+        send_return_code(RETURN_CODE_SUCCESS);
+        break;
+    }
+
+    case USB_CMD_BREAKPOINT:
+    {
+        breakpoint_type_t type = (breakpoint_type_t)pkt->data[0];
+        unsigned index = (uint8_t)pkt->data[1];
+        uint16_t energy_level = *(uint16_t *)(&pkt->data[2]);
+        comparator_ref_t cmp_ref = (comparator_ref_t)pkt->data[4];
+        bool enable = (bool)pkt->data[5];
+        unsigned rc = toggle_breakpoint(type, index, energy_level,
+                                        cmp_ref, enable);
+        send_return_code(rc);
+        break;
+    }
+
+#ifdef CONFIG_ENABLE_ENERGY_ACCOUNTING
+    case USB_CMD_ENERGY_ACCOUNTING:
+    {
+        unsigned rc = energy_accounting(pkt->data[0]);
+        if (pkt->data[0] != ENERGY_ACCOUNTING_OP_REPORT || rc != RETURN_CODE_SUCCESS)
+            send_return_code(rc); // the report is the response
+        break;
+    }
+#endif // CONFIG_ENABLE_ENERGY_ACCOUNTING
+
+    case USB_CMD_WATCHPOINT:
+    {
+        unsigned index = pkt->data[0];
+        bool enable = (bool)(pkt->data[1] & (1 << 0));
+        bool vcap_snapshot = (bool)(pkt->data[1] & (1 << 1));
+        unsigned rc = toggle_watchpoint(index, enable, vcap_snapshot);
+        send_return_code(rc);
+        break;
+    }
+
+#ifdef CONFIG_ENABLE_DEBUG_MODE
+    case USB_CMD_GET_INTERRUPT_CONTEXT: {
+        interrupt_context_t target_int_context;
+        interrupt_source_t source = (interrupt_source_t)pkt->data[0];
+
+        switch (source) {
+            case INTERRUPT_SOURCE_DEBUGGER:
+                send_interrupt_context(&interrupt_context);
+                break;
+            case INTERRUPT_SOURCE_TARGET:
+                get_target_interrupt_context(&target_int_context);
+                send_interrupt_context(&target_int_context);
+                break;
+            default:
+                send_return_code(RETURN_CODE_INVALID_ARGS);
+                break;
+        }
+        break;
+    }
+#endif // CONFIG_ENABLE_DEBUG_MODE
+
+#ifdef CONFIG_ENABLE_TARGET_SIDE_DEBUG_MODE
+    case USB_CMD_SERIAL_ECHO: {
+        unsigned value = pkt->data[0];
+        serial_echo_target(value);
+        send_echo(value);
+        break;
+    }
+#endif // CONFIG_ENABLE_DEBUG_MODE
+
+    case USB_CMD_DMA_ECHO: {
+        unsigned value = pkt->data[0];
+        send_echo(value);
+        break;
+    }
+
+    case USB_CMD_ENABLE_TARGET_UART: {
+        bool enable = pkt->data[0];
+        if (enable) {
+            UART_setup(UART_INTERFACE_WISP);
+        } else {
+            UART_teardown(UART_INTERFACE_WISP);
+        }
+        send_return_code(RETURN_CODE_SUCCESS);
+        break;
+    }
+
+    case USB_CMD_SET_PARAM: {
+        param_t param = (pkt->data[1] << 8) | pkt->data[0];
+        set_param(param, &pkt->data[2]);
+        send_param(param);
+        break;
+    }
+
+    case USB_CMD_GET_PARAM: {
+        param_t param = pkt->data[0];
+        send_param(param);
+        break;
+    }
+
+    case USB_CMD_BATCH:
+        host_cmd_run_batch(pkt, executeUSBCmd);
+        break;
+
+    case USB_CMD_SET_BAUD:
+        set_host_baud(*((uint32_t *)(&pkt->data[0])));
+        break;
+
+    case USB_CMD_GET_TX_STATS:
+        send_tx_stats(pkt->length && pkt->data[0]);
+        break;
+
+    default:
+        break;
+    }
+
+    pkt->processed = 1;
+}
+
+void usb_cmd_charger_complete()
+{
+    UART_set_reply_tag(charger_reply_tag);
+    send_return_code(RETURN_CODE_SUCCESS);
+    UART_set_reply_tag(UART_TAG_NONE);
+    charger_reply_tag = UART_TAG_NONE;
+}
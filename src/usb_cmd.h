@@ -0,0 +1,63 @@
+#ifndef USB_CMD_H
+#define USB_CMD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "uart.h"
+#include "interrupt.h"
+#include "comparator.h"
+
+/**
+ * @brief       Execute a command received from the computer through the USB port
+ * @param       pkt     Packet structure that contains the received message info
+ * @details     Shared by the board and the host build (see src/host), which
+ *              mocks the board operations below.
+ */
+void executeUSBCmd(uartPkt_t *pkt);
+
+/**
+ * @brief       Reply to the charge or discharge command that completed (FLAG_CHARGER_COMPLETE)
+ */
+void usb_cmd_charger_complete();
+
+/** @brief Tag of the debug mode command to reply to once it completes, from the main loop */
+extern unsigned debug_mode_reply_tag;
+
+/**
+ * @defgroup    USB_CMD_BOARD   Board operations that commands drive
+ * @brief       In main.c on the board, mocked by the host build
+ * @{
+ */
+
+extern bool target_powered; //!< user requested continuous power
+
+void reset_state();
+void continuous_power_on();
+void continuous_power_off();
+
+#ifdef CONFIG_SCOPE_TRIGGER_SIGNAL
+void trigger_scope();
+#endif
+
+#ifdef CONFIG_ENABLE_DEBUG_MODE
+extern interrupt_context_t interrupt_context;
+
+void enter_debug_mode(interrupt_type_t int_type, unsigned flags);
+void exit_debug_mode();
+void interrupt_target();
+void break_at_vcap_level_adc(uint16_t level);
+void break_at_vcap_level_cmp(uint16_t level, comparator_ref_t ref);
+void get_target_interrupt_context(interrupt_context_t *int_context);
+#endif // CONFIG_ENABLE_DEBUG_MODE
+
+#ifdef CONFIG_ENABLE_TARGET_SIDE_DEBUG_MODE
+/**
+ * @brief       Have the target echo a value over the signal line and UART, for testing
+ */
+void serial_echo_target(unsigned value);
+#endif // CONFIG_ENABLE_TARGET_SIDE_DEBUG_MODE
+
+/** @} End USB_CMD_BOARD */
+
+#endif // USB_CMD_H